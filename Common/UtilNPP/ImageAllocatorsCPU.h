@@ -30,21 +30,87 @@
 
 #include "Exceptions.h"
 
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
 namespace npp
 {
 
+    /// Row alignment in bytes of CPU images that are not allocated tight.
+    ///     64 bytes (a cache line) by default, so every row starts on a cache
+    /// line and vector loads of a row never split one; any power of two up to
+    /// 4096 can be set, e.g. 512 to match the pitch nppiMalloc_* returns on
+    /// device. Applies to images allocated afterwards.
+    inline
+    std::atomic<size_t> &
+    cpuPitchAlignmentValue()
+    {
+        static std::atomic<size_t> nAlignment(64);
+        return nAlignment;
+    }
+
+    inline
+    size_t
+    cpuPitchAlignment()
+    {
+        return cpuPitchAlignmentValue();
+    }
+
+    inline
+    void
+    setCpuPitchAlignment(size_t nAlignment)
+    {
+        NPP_ASSERT(nAlignment > 0 && nAlignment <= 4096 && (nAlignment & (nAlignment - 1)) == 0);
+        cpuPitchAlignmentValue() = nAlignment;
+    }
+
+    /// Pitch of a row of nRowBytes: padded to cpuPitchAlignment(), or exactly
+    /// nRowBytes for a tight image (I/O buffers that must be contiguous).
+    inline
+    unsigned int
+    cpuPitch(size_t nRowBytes, bool bTight)
+    {
+        const size_t nAlignment = bTight ? 1 : cpuPitchAlignment();
+        const size_t nPitch = (nRowBytes + nAlignment - 1) & ~(nAlignment - 1);
+        NPP_ASSERT(nPitch <= 0xFFFFFFFFu);
+        return static_cast<unsigned int>(nPitch);
+    }
+
+    /// Alignment of the first row: at least a cache line, and the pitch
+    /// alignment so that every row is aligned.
+    inline
+    size_t
+    cpuBaseAlignment()
+    {
+        return cpuPitchAlignment() > 64 ? cpuPitchAlignment() : 64;
+    }
+
     template <typename D, size_t N>
     class ImageAllocatorCPU
     {
         public:
             static
             D *
-            Malloc2D(unsigned int nWidth, unsigned int nHeight, unsigned int *pPitch)
+            Malloc2D(unsigned int nWidth, unsigned int nHeight, unsigned int *pPitch, bool bTight = false)
             {
-                NPP_ASSERT(nWidth * nHeight > 0);
+                NPP_ASSERT(nWidth > 0 && nHeight > 0);
 
-                D *pResult = new D[nWidth * N * nHeight];
-                *pPitch = nWidth * sizeof(D) * N;
+                *pPitch = cpuPitch(static_cast<size_t>(nWidth) * sizeof(D) * N, bTight);
+
+                // aligned_alloc wants a multiple of the alignment
+                const size_t nAlignment = cpuBaseAlignment();
+                const size_t nBytes = (static_cast<size_t>(*pPitch) * nHeight + nAlignment - 1) & ~(nAlignment - 1);
+                D *pResult = static_cast<D *>(std::aligned_alloc(nAlignment, nBytes));
+                if (pResult == 0)
+                {
+                    throw std::bad_alloc();
+                }
 
                 return pResult;
             };
@@ -53,26 +119,384 @@ namespace npp
             void
             Free2D(D *pPixels)
             {
-                delete[] pPixels;
+                std::free(pPixels);
             };
 
             static
             void
             Copy2D(D *pDst, size_t nDstPitch, const D *pSrc, size_t nSrcPitch, size_t nWidth, size_t nHeight)
             {
-                const void *pSrcLine = pSrc;
-                void        *pDstLine = pDst;
+                // pitches are in bytes, so step through the rows as bytes
+                const unsigned char *pSrcLine = reinterpret_cast<const unsigned char *>(pSrc);
+                unsigned char       *pDstLine = reinterpret_cast<unsigned char *>(pDst);
 
                 for (size_t iLine = 0; iLine < nHeight; ++iLine)
                 {
                     // copy one line worth of data
-                    memcpy(pDst, pSrc, nWidth * N * sizeof(D));
+                    memcpy(pDstLine, pSrcLine, nWidth * N * sizeof(D));
                     // move data pointers to next line
-                    pDst += nDstPitch;
-                    pSrc += nSrcPitch;
+                    pDstLine += nDstPitch;
+                    pSrcLine += nSrcPitch;
+                }
+            };
+
+    };
+
+    /// Allocation counters of the ImagePool.
+    struct ImagePoolStats
+    {
+        size_t nHits;        ///< allocations served from a cached buffer
+        size_t nMisses;      ///< allocations passed on to the system allocator
+        size_t nCachedBytes; ///< bytes currently held by the pool
+    };
+
+    /// Process-wide pool of image pixel buffers.
+    ///     Requests are rounded up to size classes, eight per power of two, so
+    /// frames of the same or nearly the same size reuse each other's buffers
+    /// instead of going back to the system allocator (and page faulting the
+    /// fresh memory in) every time. A freed buffer goes to a small cache of
+    /// the freeing thread first and overflows into a locked free list per
+    /// size class, so a thread that frees and reallocates a frame never takes
+    /// the lock. Buffers are aligned as requested, at least to 64 bytes, and
+    /// only reused for requests of the same alignment. At most capacity()
+    /// bytes are kept; buffers freed beyond that are released.
+    ///     A buffer belongs to the NUMA node of the thread that allocated it
+    /// (setThreadNode(), 0 for threads that never set one), and free lists
+    /// are kept per node, so a freed buffer is only reused on its own node
+    /// and keeps the pages the allocating thread first touched there.
+    class ImagePool
+    {
+        public:
+            /// The pool is never destroyed, so images with static storage
+            /// duration can still free their buffers at exit.
+            static
+            ImagePool &
+            instance()
+            {
+                static ImagePool *pPool = new ImagePool();
+                return *pPool;
+            }
+
+            void *
+            allocate(size_t nBytes, size_t nAlignment = 64)
+            {
+                const int iClass = sizeClass(nBytes);
+                const size_t nClassBytes = classBytes(iClass);
+                if (nAlignment < gnMinAlignment)
+                {
+                    nAlignment = gnMinAlignment;
+                }
+
+                const size_t iNode = static_cast<size_t>(threadNodeRef());
+                ThreadCache &rCache = threadCache();
+                for (int i = rCache.nBlocks - 1; i >= 0; --i)
+                {
+                    if (rCache.aClass[i] == iClass && header(rCache.aData[i])[1] == nAlignment
+                        && header(rCache.aData[i])[2] == iNode)
+                    {
+                        void *pData = rCache.aData[i];
+                        --rCache.nBlocks;
+                        rCache.aClass[i] = rCache.aClass[rCache.nBlocks];
+                        rCache.aData[i] = rCache.aData[rCache.nBlocks];
+                        return take(pData, nClassBytes);
+                    }
+                }
+
+                void *pStale = 0;
+                {
+                    std::lock_guard<std::mutex> oLock(oMutex_);
+                    std::vector<void *> &rFree = freeList(iNode, iClass);
+                    if (!rFree.empty())
+                    {
+                        void *pData = rFree.back();
+                        rFree.pop_back();
+                        if (header(pData)[1] == nAlignment)
+                        {
+                            return take(pData, nClassBytes);
+                        }
+                        // left over from before the alignment changed
+                        pStale = pData;
+                    }
+                }
+                if (pStale != 0)
+                {
+                    nCachedBytes_ -= nClassBytes;
+                    release(pStale);
+                }
+
+                ++nMisses_;
+                // the header sits in the alignment padding before the data;
+                // aligned_alloc wants a multiple of the alignment
+                const size_t nBlockBytes = (nAlignment + nClassBytes + nAlignment - 1) & ~(nAlignment - 1);
+                void *pBlock = std::aligned_alloc(nAlignment, nBlockBytes);
+                if (pBlock == 0)
+                {
+                    throw std::bad_alloc();
+                }
+                void *pData = static_cast<char *>(pBlock) + nAlignment;
+                header(pData)[0] = static_cast<size_t>(iClass);
+                header(pData)[1] = nAlignment;
+                header(pData)[2] = iNode;
+                return pData;
+            }
+
+            void
+            free(void *pData)
+            {
+                if (pData == 0)
+                {
+                    return;
+                }
+
+                const int iClass = static_cast<int>(header(pData)[0]);
+                const size_t nClassBytes = classBytes(iClass);
+
+                // reserve the bytes before caching, so concurrent frees
+                // cannot all pass the check and overshoot the capacity
+                size_t nCached = nCachedBytes_.load();
+                do
+                {
+                    if (nCached + nClassBytes > nCapacity_)
+                    {
+                        release(pData);
+                        return;
+                    }
+                }
+                while (!nCachedBytes_.compare_exchange_weak(nCached, nCached + nClassBytes));
+
+                // a buffer of another node goes back to that node's list
+                ThreadCache &rCache = threadCache();
+                if (rCache.nBlocks < gnThreadCacheBlocks && header(pData)[2] == static_cast<size_t>(threadNodeRef()))
+                {
+                    rCache.aClass[rCache.nBlocks] = iClass;
+                    rCache.aData[rCache.nBlocks] = pData;
+                    ++rCache.nBlocks;
+                    return;
+                }
+
+                std::lock_guard<std::mutex> oLock(oMutex_);
+                freeList(header(pData)[2], iClass).push_back(pData);
+            }
+
+            ImagePoolStats
+            stats()
+            const
+            {
+                ImagePoolStats oStats;
+                oStats.nHits = nHits_;
+                oStats.nMisses = nMisses_;
+                oStats.nCachedBytes = nCachedBytes_;
+                return oStats;
+            }
+
+            size_t
+            capacity()
+            const
+            {
+                return nCapacity_;
+            }
+
+            /// Limit the bytes held by the pool; 0 disables pooling. Buffers
+            /// already cached are kept until trim().
+            void
+            setCapacity(size_t nBytes)
+            {
+                nCapacity_ = nBytes;
+            }
+
+            /// Release the buffers on the global free lists.
+            void
+            trim()
+            {
+                std::lock_guard<std::mutex> oLock(oMutex_);
+                for (auto &pLists : aNodes_)
+                {
+                    for (int iClass = 0; iClass < gnClasses; ++iClass)
+                    {
+                        for (void *pData : pLists->aClass[iClass])
+                        {
+                            nCachedBytes_ -= classBytes(iClass);
+                            release(pData);
+                        }
+                        pLists->aClass[iClass].clear();
+                    }
+                }
+            }
+
+            /// NUMA node of the buffers the calling thread allocates from
+            /// now on; negative values mean node 0.
+            static
+            void
+            setThreadNode(int iNode)
+            {
+                threadNodeRef() = iNode > 0 ? iNode : 0;
+            }
+
+        private:
+            static const size_t gnMinAlignment = 64;
+            static const int gnMinClassLog2 = 12;    // class 0 covers everything up to 4 KB
+            static const int gnClassesPerDoubling = 8;
+            static const int gnClasses = 1 + (64 - gnMinClassLog2) * gnClassesPerDoubling;
+            static const int gnThreadCacheBlocks = 4;
+
+            struct ThreadCache
+            {
+                int nBlocks;
+                int aClass[gnThreadCacheBlocks];
+                void *aData[gnThreadCacheBlocks];
+
+                ThreadCache(): nBlocks(0)
+                {
+                    ;
+                }
+
+                // hand the blocks of an exiting thread to the free lists
+                ~ThreadCache()
+                {
+                    ImagePool &rPool = ImagePool::instance();
+                    std::lock_guard<std::mutex> oLock(rPool.oMutex_);
+                    for (int i = 0; i < nBlocks; ++i)
+                    {
+                        rPool.freeList(header(aData[i])[2], aClass[i]).push_back(aData[i]);
+                    }
+                }
+            };
+
+            struct FreeLists
+            {
+                std::vector<void *> aClass[gnClasses];
+            };
+
+            ImagePool(): nCapacity_(size_t(1) << 30)
+                , nHits_(0)
+                , nMisses_(0)
+                , nCachedBytes_(0)
+            {
+                ;
+            }
+
+            static
+            ThreadCache &
+            threadCache()
+            {
+                static thread_local ThreadCache oCache;
+                return oCache;
+            }
+
+            static
+            int &
+            threadNodeRef()
+            {
+                static thread_local int iNode = 0;
+                return iNode;
+            }
+
+            // free list of a node and size class; call with oMutex_ held
+            std::vector<void *> &
+            freeList(size_t iNode, int iClass)
+            {
+                while (aNodes_.size() <= iNode)
+                {
+                    aNodes_.emplace_back(new FreeLists());
+                }
+                return aNodes_[iNode]->aClass[iClass];
+            }
+
+            // Smallest class holding nBytes: class 0 is 4 KB, then each
+            // power of two 2^k is followed by classes 2^k (1 + j / 8), j = 1..8
+            static
+            int
+            sizeClass(size_t nBytes)
+            {
+                if (nBytes <= (size_t(1) << gnMinClassLog2))
+                {
+                    return 0;
+                }
+                int nLog2 = gnMinClassLog2;
+                while ((nBytes - 1) >> (nLog2 + 1))
+                {
+                    ++nLog2;
+                }
+                const size_t nStep = (size_t(1) << nLog2) / gnClassesPerDoubling;
+                const size_t j = (nBytes - (size_t(1) << nLog2) + nStep - 1) / nStep;
+                return 1 + (nLog2 - gnMinClassLog2) * gnClassesPerDoubling + static_cast<int>(j) - 1;
+            }
+
+            static
+            size_t
+            classBytes(int iClass)
+            {
+                if (iClass == 0)
+                {
+                    return size_t(1) << gnMinClassLog2;
                 }
+                const int nLog2 = gnMinClassLog2 + (iClass - 1) / gnClassesPerDoubling;
+                const size_t j = (iClass - 1) % gnClassesPerDoubling + 1;
+                return (size_t(1) << nLog2) + j * ((size_t(1) << nLog2) / gnClassesPerDoubling);
+            }
+
+            // size class, alignment and node of a buffer, stored just
+            // before it
+            static
+            size_t *
+            header(void *pData)
+            {
+                return static_cast<size_t *>(pData) - 3;
+            }
+
+            static
+            void
+            release(void *pData)
+            {
+                std::free(static_cast<char *>(pData) - header(pData)[1]);
+            }
+
+            void *
+            take(void *pData, size_t nClassBytes)
+            {
+                ++nHits_;
+                nCachedBytes_ -= nClassBytes;
+                return pData;
+            }
+
+            std::mutex oMutex_;
+            std::vector<std::unique_ptr<FreeLists>> aNodes_;
+            std::atomic<size_t> nCapacity_;
+            std::atomic<size_t> nHits_;
+            std::atomic<size_t> nMisses_;
+            std::atomic<size_t> nCachedBytes_;
+    };
+
+    /// Drop-in replacement for ImageAllocatorCPU that takes its buffers
+    /// from the ImagePool.
+    template <typename D, size_t N>
+    class ImageAllocatorPooledCPU
+    {
+        public:
+            static
+            D *
+            Malloc2D(unsigned int nWidth, unsigned int nHeight, unsigned int *pPitch, bool bTight = false)
+            {
+                NPP_ASSERT(nWidth > 0 && nHeight > 0);
+
+                *pPitch = cpuPitch(static_cast<size_t>(nWidth) * sizeof(D) * N, bTight);
+                return static_cast<D *>(ImagePool::instance().allocate(static_cast<size_t>(*pPitch) * nHeight,
+                                                                       cpuBaseAlignment()));
             };
 
+            static
+            void
+            Free2D(D *pPixels)
+            {
+                ImagePool::instance().free(pPixels);
+            };
+
+            static
+            void
+            Copy2D(D *pDst, size_t nDstPitch, const D *pSrc, size_t nSrcPitch, size_t nWidth, size_t nHeight)
+            {
+                ImageAllocatorCPU<D, N>::Copy2D(pDst, nDstPitch, pSrc, nSrcPitch, nWidth, nHeight);
+            };
     };
 
 } // npp namespace
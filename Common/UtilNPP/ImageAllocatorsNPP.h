@@ -41,7 +41,7 @@ namespace npp
     {
         D *pResult;
         *pPitch = nWidth * sizeof(D) * N;
-        NPP_CHECK_CUDA(cudaMalloc(&pResult, *pPitch * nHeight));
+        NPP_CHECK_CUDA(cudaMalloc(&pResult, static_cast<size_t>(*pPitch) * nHeight));
         NPP_ASSERT_NOT_NULL(pResult);
 
         return pResult;
@@ -30,11 +30,18 @@
 
 #include "ImagesCPU.h"
 #include "ImagesNPP.h"
+#include "PngWriter.h"
+#include "QoiCodec.h"
 
 #include "FreeImage.h"
 #include "Exceptions.h"
 
+#include <algorithm>
+#include <iostream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "string.h"
 
 
@@ -194,89 +201,180 @@ namespace npp
         oImage.swap(rImage);
     }
 
-    // Load a 3-channel color image from disk.
-    void loadImage8uC3(const std::string &rFileName, ImageCPU_8u_C3 &rImage)
+    /// A decoded 3-channel image that keeps FreeImage's bitmap as its pixel
+    /// storage instead of copying it out. FreeImage stores rows bottom-up,
+    /// so view() starts at the last row in memory and walks back with a
+    /// negative pitch. Move-only; the bitmap is unloaded with the image.
+    class DecodedImage8uC3
     {
-        // Set FreeImage error handler
-        FreeImage_SetOutputMessage(FreeImageErrorHandler);
+        public:
+            DecodedImage8uC3(): pBitmap_(0)
+            {
+                ;
+            }
+
+            DecodedImage8uC3(DecodedImage8uC3 &&rImage) noexcept: pBitmap_(rImage.pBitmap_)
+            {
+                rImage.pBitmap_ = 0;
+            }
+
+            DecodedImage8uC3 &
+            operator= (DecodedImage8uC3 &&rImage) noexcept
+            {
+                std::swap(pBitmap_, rImage.pBitmap_);
+                return *this;
+            }
+
+            DecodedImage8uC3(const DecodedImage8uC3 &) = delete;
+            DecodedImage8uC3 &operator= (const DecodedImage8uC3 &) = delete;
+
+            ~DecodedImage8uC3()
+            {
+                reset(0);
+            }
+
+            /// Take ownership of a 24-bit bitmap, or empty the image for 0
+            void
+            reset(FIBITMAP *pBitmap)
+            {
+                if (pBitmap_)
+                {
+                    FreeImage_Unload(pBitmap_);
+                }
+                pBitmap_ = pBitmap;
+            }
+
+            unsigned int
+            width()
+            const
+            {
+                return pBitmap_ ? FreeImage_GetWidth(pBitmap_) : 0;
+            }
+
+            unsigned int
+            height()
+            const
+            {
+                return pBitmap_ ? FreeImage_GetHeight(pBitmap_) : 0;
+            }
+
+            /// Top-down view of the pixels, empty if nothing was decoded
+            ConstImageView_8u_C3
+            view()
+            const
+            {
+                if (!pBitmap_)
+                {
+                    return ConstImageView_8u_C3();
+                }
+                const int nPitch = static_cast<int>(FreeImage_GetPitch(pBitmap_));
+                const Npp8u *pTopLine = FreeImage_GetBits(pBitmap_) + static_cast<size_t>(nPitch) * (height() - 1);
+                return ConstImageView_8u_C3(pTopLine, -nPitch, width(), height());
+            }
+
+        private:
+            FIBITMAP *pBitmap_;
+    };
 
-        // Check if file exists
-        std::ifstream fileCheck(rFileName.c_str());
-        if (!fileCheck.good())
+    // FreeImage keeps 24-bit pixels in B, G, R order on little-endian hosts
+    const bool gbFreeImageBgr = FI_RGBA_RED == 2;
+
+    // Decode a .qoi file into a freshly allocated 24-bit bitmap, so that
+    // it is stored like any FreeImage decode
+    void decodeQoi8uC3(const std::string &rFileName, DecodedImage8uC3 &rImage)
+    {
+        std::vector<Npp8u> oData;
+        unsigned int nWidth, nHeight;
+        if (!readFileBytes(rFileName, oData) || !qoiReadHeader(oData.data(), oData.size(), nWidth, nHeight))
         {
-            std::cerr << "Error: File does not exist: " << rFileName << std::endl;
+            std::cerr << "Error: Failed to load image " << rFileName << std::endl;
+            return;
         }
-        fileCheck.close();
 
-        // Get file format
-        FREE_IMAGE_FORMAT eFormat = FreeImage_GetFileType(rFileName.c_str());
+        FIBITMAP *pBitmap = FreeImage_Allocate(nWidth, nHeight, 24 /* bits per pixel */);
+        if (!pBitmap)
+        {
+            std::cerr << "Error: Failed to allocate memory for " << rFileName << std::endl;
+            return;
+        }
+        const int nPitch = static_cast<int>(FreeImage_GetPitch(pBitmap));
+        Npp8u *pTopLine = FreeImage_GetBits(pBitmap) + static_cast<size_t>(nPitch) * (nHeight - 1);
+        if (!qoiDecode(oData.data(), oData.size(), ImageView_8u_C3(pTopLine, -nPitch, nWidth, nHeight), gbFreeImageBgr))
+        {
+            std::cerr << "Error: Corrupt QOI image " << rFileName << std::endl;
+            FreeImage_Unload(pBitmap);
+            return;
+        }
+
+        rImage.reset(pBitmap);
+    }
+
+    // Decode a color image into FreeImage's own buffer. Only images that are
+    // not 24-bit already are converted; 24-bit images are used as decoded.
+    // .qoi files are decoded natively. On failure an error is printed and
+    // rImage is left empty.
+    void decodeImage8uC3(const std::string &rFileName, DecodedImage8uC3 &rImage)
+    {
+        rImage.reset(0);
 
-        // No signature? Try to guess the file format from the file extension
+        if (isQoiFileName(rFileName))
+        {
+            decodeQoi8uC3(rFileName, rImage);
+            return;
+        }
+
+        // Set FreeImage error handler
+        FreeImage_SetOutputMessage(FreeImageErrorHandler);
+
+        // Get file format, or guess it from the file extension
+        FREE_IMAGE_FORMAT eFormat = FreeImage_GetFileType(rFileName.c_str());
         if (eFormat == FIF_UNKNOWN)
         {
             eFormat = FreeImage_GetFIFFromFilename(rFileName.c_str());
-            if (eFormat == FIF_UNKNOWN)
-            {
-                std::cerr << "Error: Unknown file format for " << rFileName << std::endl;
-            }
         }
-
-        // Check if the format supports reading
-        if (!FreeImage_FIFSupportsReading(eFormat))
+        if (eFormat == FIF_UNKNOWN || !FreeImage_FIFSupportsReading(eFormat))
         {
-            std::cerr << "Error: FreeImage doesn't support reading this format" << std::endl;
+            std::cerr << "Error: Unknown or unreadable file format for " << rFileName << std::endl;
+            return;
         }
 
-        // Load the image
         FIBITMAP *pBitmap = FreeImage_Load(eFormat, rFileName.c_str());
         if (!pBitmap)
         {
             std::cerr << "Error: Failed to load image " << rFileName << std::endl;
+            return;
         }
 
         // Convert to 24-bit (3 channel) if it's not already
-        FIBITMAP *pTemp = nullptr;
         if (FreeImage_GetBPP(pBitmap) != 24)
         {
-            pTemp = FreeImage_ConvertTo24Bits(pBitmap);
+            FIBITMAP *pConverted = FreeImage_ConvertTo24Bits(pBitmap);
             FreeImage_Unload(pBitmap);
-            if (!pTemp)
+            if (!pConverted)
             {
                 std::cerr << "Error: Failed to convert image to 24-bit format" << std::endl;
+                return;
             }
-            pBitmap = pTemp;
+            pBitmap = pConverted;
         }
 
-        // Create an ImageCPU to receive the loaded image data
-        unsigned int width = FreeImage_GetWidth(pBitmap);
-        unsigned int height = FreeImage_GetHeight(pBitmap);
-        ImageCPU_8u_C3 oImage(width, height);
+        rImage.reset(pBitmap);
+    }
 
-        // Copy the FreeImage data into the new ImageCPU
-        unsigned int nSrcPitch = FreeImage_GetPitch(pBitmap);
-        const Npp8u *pSrcLine = FreeImage_GetBits(pBitmap) + nSrcPitch * (height - 1);
-        Npp8u *pDstLine = oImage.data();
-        unsigned int nDstPitch = oImage.pitch();
+    // Load a 3-channel color image from disk into a top-down ImageCPU. The
+    // image is decoded in place and copied once; rImage's buffer is reused
+    // when it already has the right size.
+    void loadImage8uC3(const std::string &rFileName, ImageCPU_8u_C3 &rImage)
+    {
+        DecodedImage8uC3 oDecoded;
+        decodeImage8uC3(rFileName, oDecoded);
 
-        // FreeImage stores data in BGR format, assuming ImageCPU_8u_C3 expects RGB
-        // We need to copy 3 bytes per pixel
-        for (unsigned int y = 0; y < height; ++y)
+        const ConstImageView_8u_C3 oView = oDecoded.view();
+        if (rImage.size() != oView.size())
         {
-            // For better performance, use a direct memcpy if no color conversion is needed
-            // Otherwise use a pixel-by-pixel copy with color channel reordering
-            memcpy(pDstLine, pSrcLine, width * 3 * sizeof(Npp8u));
-
-            // Move to the next line (FreeImage stores bottom-up, so we go backwards)
-            pSrcLine -= nSrcPitch;
-            pDstLine += nDstPitch;
+            rImage = ImageCPU_8u_C3(oView.size());
         }
-
-        // Clean up
-        FreeImage_Unload(pBitmap);
-
-        // Swap the user given image with our result image
-        oImage.swap(rImage);
-
+        copyPixels(oView, rImage.view());
     }
 
     // Save an gray-scale image to disk.
@@ -305,15 +403,67 @@ namespace npp
         NPP_ASSERT_MSG(bSuccess, "Failed to save result image.");
     }
 
+    /// Effort settings of the encoders used by saveImage8uC3
+    struct EncodeOptions
+    {
+        int nPngLevel;      ///< zlib level 0 (stored) to 9 (smallest, slowest)
+        int nJpegQuality;   ///< 1 to 100
+        int nPngThreads;    ///< 1: FreeImage; N: savePngParallel on N threads; 0: on every
+                            ///< hardware thread for images of PARALLEL_PNG_PIXELS and more
+
+        static const unsigned int PARALLEL_PNG_PIXELS = 4 << 20;
+
+        EncodeOptions(): nPngLevel(9), nJpegQuality(90), nPngThreads(1)
+        {
+            ;
+        }
+
+        /// Deflate threads for a PNG of nWidth x nHeight, 1 for FreeImage
+        int
+        pngThreads(unsigned int nWidth, unsigned int nHeight)
+        const
+        {
+            if (nPngThreads != 0)
+            {
+                return std::max(nPngThreads, 1);
+            }
+            if (static_cast<size_t>(nWidth) * nHeight < PARALLEL_PNG_PIXELS)
+            {
+                return 1;
+            }
+            return std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+        }
+
+        /// FreeImage_Save flags for eFormat
+        int
+        flags(FREE_IMAGE_FORMAT eFormat)
+        const
+        {
+            if (eFormat == FIF_JPEG)
+            {
+                return nJpegQuality;
+            }
+            if (eFormat == FIF_PNG)
+            {
+                return nPngLevel == 0 ? PNG_Z_NO_COMPRESSION : nPngLevel;
+            }
+            return 0;
+        }
+    };
+
     /**
  * Save a 3-channel color image to disk.
  * 
  * @param rFileName - The file path where the image will be saved
  * @param rImage - The 3-channel image data to save
- * @param format - Optional: The image format to save as (default: auto-detect from filename)
+ * @param format - Optional: The image format to save as (default: auto-detect from filename;
+ *                 a .qoi name is written by the built-in QOI encoder)
+ * @param rOptions - PNG level and JPEG quality (default: level 9, quality 90), and the
+ *                   threads that deflate a PNG (default: FreeImage's encoder)
  * @return true if the image was saved successfully, false otherwise
  */
-    bool saveImage8uC3(const std::string &rFileName, const ImageCPU_8u_C3 &rImage, FREE_IMAGE_FORMAT format = FIF_UNKNOWN)
+    bool saveImage8uC3(const std::string &rFileName, const ImageCPU_8u_C3 &rImage, FREE_IMAGE_FORMAT format = FIF_UNKNOWN,
+                       const EncodeOptions &rOptions = EncodeOptions())
     {
         // Validate input
         if (rFileName.empty() || rImage.width() == 0 || rImage.height() == 0 || rImage.data() == nullptr)
@@ -322,6 +472,17 @@ namespace npp
             return false;
         }
 
+        // QOI is encoded natively, without a FreeImage bitmap
+        if (format == FIF_UNKNOWN && isQoiFileName(rFileName))
+        {
+            if (!saveQoi(rFileName, rImage, gbFreeImageBgr))
+            {
+                std::cerr << "Error: Failed to save image to " << rFileName << std::endl;
+                return false;
+            }
+            return true;
+        }
+
         // Auto-detect format from filename if not specified
         if (format == FIF_UNKNOWN)
         {
@@ -334,6 +495,18 @@ namespace npp
             }
         }
 
+        // Large PNGs are deflated on several threads by our own writer
+        const int nPngThreads = format == FIF_PNG ? rOptions.pngThreads(rImage.width(), rImage.height()) : 1;
+        if (nPngThreads > 1)
+        {
+            if (!savePngParallel(rFileName, rImage, rOptions.nPngLevel, nPngThreads, gbFreeImageBgr))
+            {
+                std::cerr << "Error: Failed to save image to " << rFileName << std::endl;
+                return false;
+            }
+            return true;
+        }
+
         // Check if the format supports writing
         if (!FreeImage_FIFSupportsWriting(format))
         {
@@ -368,19 +541,7 @@ namespace npp
         }
 
         // Save the image
-        int flags = 0;
-        if (format == FIF_JPEG)
-        {
-            // For JPEG, use a quality setting of 90%
-            flags = 90;
-        }
-        else if (format == FIF_PNG)
-        {
-            // For PNG, use maximum compression
-            flags = PNG_Z_BEST_COMPRESSION;
-        }
-
-        bool bSuccess = (FreeImage_Save(format, pResultBitmap, rFileName.c_str(), flags) == TRUE);
+        bool bSuccess = (FreeImage_Save(format, pResultBitmap, rFileName.c_str(), rOptions.flags(format)) == TRUE);
 
         // Clean up
         FreeImage_Unload(pResultBitmap);
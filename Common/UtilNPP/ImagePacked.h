@@ -28,11 +28,93 @@
 #ifndef NV_UTIL_NPP_IMAGE_PACKED_H
 #define NV_UTIL_NPP_IMAGE_PACKED_H
 
+#include "Exceptions.h"
 #include "Image.h"
 #include "Pixel.h"
 
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
 namespace npp
 {
+    /// Non-owning view of packed pixels: a pointer to the first pixel, a
+    /// pitch in bytes and a size. The pitch is signed, so a view can walk a
+    /// bottom-up buffer top-down. Views are cheap to copy and can be narrowed
+    /// to a sub-rectangle without copying pixels; the owner of the pixels
+    /// must outlive them. Constness is shallow: a const view still gives
+    /// write access unless D is const, as in the views of const images.
+    template<typename D, size_t N>
+    class ImageView: public npp::Image
+    {
+        public:
+            typedef D                   tData;
+            static const size_t         gnChannels = N;
+
+            ImageView(): pData_(0)
+                , nPitch_(0)
+            {
+                ;
+            }
+
+            ImageView(D *pData, int nPitch, unsigned int nWidth, unsigned int nHeight): Image(nWidth, nHeight)
+                , pData_(pData)
+                , nPitch_(nPitch)
+            {
+                ;
+            }
+
+            /// A view of mutable pixels converts to a read-only view.
+            template<typename X>
+            ImageView(const ImageView<X, N> &rView): Image(rView)
+                , pData_(rView.data())
+                , nPitch_(rView.pitch())
+            {
+                ;
+            }
+
+            int
+            pitch()
+            const
+            {
+                return nPitch_;
+            }
+
+            D *
+            data(int nX = 0, int nY = 0)
+            const
+            {
+                typedef typename std::conditional<std::is_const<D>::value, const unsigned char, unsigned char>::type tByte;
+                return reinterpret_cast<D *>(reinterpret_cast<tByte *>(pData_) + static_cast<std::ptrdiff_t>(nY) * nPitch_
+                                             + static_cast<std::ptrdiff_t>(nX) * N * sizeof(D));
+            }
+
+            /// Sub-rectangle nWidth x nHeight at (nX, nY) of this view
+            ImageView<D, N>
+            view(unsigned int nX, unsigned int nY, unsigned int nWidth, unsigned int nHeight)
+            const
+            {
+                NPP_ASSERT(nX + nWidth <= width() && nY + nHeight <= height());
+                return ImageView<D, N>(data(nX, nY), nPitch_, nWidth, nHeight);
+            }
+
+        private:
+            D *pData_;
+            int nPitch_;
+    };
+
+    /// Copy the pixels of rSrc into rDst, which must have the same size
+    template<typename S, typename D, size_t N>
+    void
+    copyPixels(const ImageView<S, N> &rSrc, const ImageView<D, N> &rDst)
+    {
+        NPP_ASSERT(rSrc.size() == rDst.size());
+        for (unsigned int iLine = 0; iLine < rSrc.height(); ++iLine)
+        {
+            memcpy(rDst.data(0, iLine), rSrc.data(0, iLine), rSrc.width() * N * sizeof(D));
+        }
+    }
+
     template<typename D, size_t N, class A>
     class ImagePacked: public npp::Image
     {
@@ -74,7 +156,15 @@ namespace npp
                 , nPitch_(rImage.pitch())
             {
                 aPixels_ = A::Malloc2D(width(), height(), &nPitch_);
-                A::Copy2D(aPixels_, nPitch_, rImage.pixels(), rImage.pitch(), width(), height());
+                A::Copy2D(aPixels_, nPitch_, rImage.data(), rImage.pitch(), width(), height());
+            }
+
+            /// Take over rImage's pixels; rImage is left empty.
+            ImagePacked(ImagePacked<D, N, A> &&rImage) noexcept: Image(rImage)
+                , aPixels_(rImage.aPixels_)
+                , nPitch_(rImage.nPitch_)
+            {
+                rImage.release();
             }
 
             virtual
@@ -92,19 +182,38 @@ namespace npp
                     return *this;
                 }
 
-                A::Free2D(aPixels_);
-                aPixels_ = 0;
-                nPitch_ = 0;
+                // reuse the buffer when the size does not change
+                if (size() != rImage.size() || aPixels_ == 0)
+                {
+                    A::Free2D(aPixels_);
+                    aPixels_ = 0;
+                    nPitch_ = 0;
 
-                // assign parent class's data fields (width, height)
-                Image::operator =(rImage);
+                    // assign parent class's data fields (width, height)
+                    Image::operator =(rImage);
 
-                aPixels_ = A::Malloc2D(width(), height(), &nPitch_);
+                    aPixels_ = A::Malloc2D(width(), height(), &nPitch_);
+                }
                 A::Copy2D(aPixels_, nPitch_, rImage.data(), rImage.pitch(), width(), height());
 
                 return *this;
             }
 
+            ImagePacked &
+            operator= (ImagePacked<D, N, A> &&rImage) noexcept
+            {
+                if (&rImage != this)
+                {
+                    A::Free2D(aPixels_);
+                    Image::operator =(rImage);
+                    aPixels_ = rImage.aPixels_;
+                    nPitch_ = rImage.nPitch_;
+                    rImage.release();
+                }
+
+                return *this;
+            }
+
             unsigned int
             pitch()
             const
@@ -121,7 +230,7 @@ namespace npp
             tPixel *
             pixels(int nX = 0, int nY = 0)
             {
-                return reinterpret_cast<tPixel *>(reinterpret_cast<unsigned char *>(aPixels_) + nY * pitch() + nX * gnChannels * sizeof(D));
+                return reinterpret_cast<tPixel *>(reinterpret_cast<unsigned char *>(aPixels_) + rowOffset(nX, nY));
             }
 
             const
@@ -129,7 +238,7 @@ namespace npp
             pixels(int nX = 0, int nY = 0)
             const
             {
-                return reinterpret_cast<const tPixel *>(reinterpret_cast<unsigned char *>(aPixels_) + nY * pitch() + nX * gnChannels * sizeof(D));
+                return reinterpret_cast<const tPixel *>(reinterpret_cast<unsigned char *>(aPixels_) + rowOffset(nX, nY));
             }
 
             D *
@@ -146,6 +255,40 @@ namespace npp
                 return reinterpret_cast<const D *>(pixels(nX, nY));
             }
 
+            /// Non-owning view of the whole image or of a sub-rectangle.
+            ImageView<D, N>
+            view()
+            {
+                return ImageView<D, N>(data(), static_cast<int>(pitch()), width(), height());
+            }
+
+            ImageView<const D, N>
+            view()
+            const
+            {
+                return ImageView<const D, N>(data(), static_cast<int>(pitch()), width(), height());
+            }
+
+            /// Images pass as read-only views wherever one is expected
+            operator ImageView<const D, N>()
+            const
+            {
+                return view();
+            }
+
+            ImageView<D, N>
+            view(unsigned int nX, unsigned int nY, unsigned int nWidth, unsigned int nHeight)
+            {
+                return view().view(nX, nY, nWidth, nHeight);
+            }
+
+            ImageView<const D, N>
+            view(unsigned int nX, unsigned int nY, unsigned int nWidth, unsigned int nHeight)
+            const
+            {
+                return view().view(nX, nY, nWidth, nHeight);
+            }
+
             void
             swap(ImagePacked<D, N, A> &rImage)
             {
@@ -161,6 +304,24 @@ namespace npp
             }
 
         private:
+            // leave a moved-from image empty
+            void
+            release()
+            {
+                Image::operator =(Image());
+                aPixels_ = 0;
+                nPitch_ = 0;
+            }
+
+            // Byte offset of pixel (nX, nY). Computed in ptrdiff_t: with an
+            // unsigned int pitch, nY * pitch() wraps around beyond 4 GB.
+            std::ptrdiff_t
+            rowOffset(int nX, int nY)
+            const
+            {
+                return static_cast<std::ptrdiff_t>(nY) * pitch() + static_cast<std::ptrdiff_t>(nX) * gnChannels * sizeof(D);
+            }
+
             D *aPixels_;
             unsigned int nPitch_;
     };
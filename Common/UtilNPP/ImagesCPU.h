@@ -35,6 +35,8 @@
 
 #include <npp.h>
 
+#include <utility>
+
 
 namespace npp
 {
@@ -54,13 +56,25 @@ namespace npp
                 ;
             }
 
+            /// bTight packs the rows without padding (pitch = width * N * sizeof(D)),
+            /// for buffers read or written in one piece by I/O code.
+            ImageCPU(unsigned int nWidth, unsigned int nHeight, bool bTight): ImagePacked<D, N, A>(nWidth, nHeight, bTight)
+            {
+                ;
+            }
+
             explicit
             ImageCPU(const npp::Image::Size &rSize): ImagePacked<D, N, A>(rSize)
             {
                 ;
             }
 
-            ImageCPU(const ImageCPU<D, N, A> &rImage): Image(rImage)
+            ImageCPU(const ImageCPU<D, N, A> &rImage): ImagePacked<D, N, A>(rImage)
+            {
+                ;
+            }
+
+            ImageCPU(ImageCPU<D, N, A> &&rImage) noexcept: ImagePacked<D, N, A>(std::move(rImage))
             {
                 ;
             }
@@ -79,6 +93,14 @@ namespace npp
                 return *this;
             }
 
+            ImageCPU &
+            operator= (ImageCPU<D, N, A> &&rImage) noexcept
+            {
+                ImagePacked<D, N, A>::operator= (std::move(rImage));
+
+                return *this;
+            }
+
             npp::Pixel<D, N> &
             operator()(unsigned int iX, unsigned int iY)
             {
@@ -95,26 +117,132 @@ namespace npp
     };
 
 
-    typedef ImageCPU<Npp8u,  1, npp::ImageAllocatorCPU<Npp8u,      1>  >   ImageCPU_8u_C1;
-    typedef ImageCPU<Npp8u,  2, npp::ImageAllocatorCPU<Npp8u,      2>  >   ImageCPU_8u_C2;
-    typedef ImageCPU<Npp8u,  3, npp::ImageAllocatorCPU<Npp8u,      3>  >   ImageCPU_8u_C3;
-    typedef ImageCPU<Npp8u,  4, npp::ImageAllocatorCPU<Npp8u,      4>  >   ImageCPU_8u_C4;
+    /// Planar host image: one single-channel plane per channel, all with
+    /// the same size and pitch. Per-channel filters run on the planes as
+    /// gray images, with SIMD lanes full of one channel instead of pixels.
+    template<typename D, unsigned int N, class A>
+    class ImageCPUPlanar: public npp::Image
+    {
+        public:
+            typedef D                   tData;
+            static const size_t         gnChannels = N;
+
+            ImageCPUPlanar()
+            {
+                ;
+            }
+
+            ImageCPUPlanar(unsigned int nWidth, unsigned int nHeight): Image(nWidth, nHeight)
+            {
+                for (unsigned int iPlane = 0; iPlane < N; ++iPlane)
+                {
+                    aPlanes_[iPlane] = ImageCPU<D, 1, A>(nWidth, nHeight);
+                }
+            }
+
+            explicit
+            ImageCPUPlanar(const npp::Image::Size &rSize): ImageCPUPlanar(rSize.nWidth, rSize.nHeight)
+            {
+                ;
+            }
+
+            ImageCPUPlanar(const ImageCPUPlanar<D, N, A> &rImage) = default;
+
+            /// rImage is left empty
+            ImageCPUPlanar(ImageCPUPlanar<D, N, A> &&rImage) noexcept
+            {
+                swap(rImage);
+            }
+
+            ImageCPUPlanar &
+            operator= (const ImageCPUPlanar<D, N, A> &rImage) = default;
+
+            ImageCPUPlanar &
+            operator= (ImageCPUPlanar<D, N, A> &&rImage) noexcept
+            {
+                ImageCPUPlanar<D, N, A> oEmpty;
+                oEmpty.swap(rImage);
+                swap(oEmpty);
+
+                return *this;
+            }
+
+            ImageCPU<D, 1, A> &
+            plane(unsigned int iPlane)
+            {
+                return aPlanes_[iPlane];
+            }
+
+            const ImageCPU<D, 1, A> &
+            plane(unsigned int iPlane)
+            const
+            {
+                return aPlanes_[iPlane];
+            }
+
+            unsigned int
+            pitch()
+            const
+            {
+                return aPlanes_[0].pitch();
+            }
+
+            D *
+            data(unsigned int iPlane, int nX = 0, int nY = 0)
+            {
+                return aPlanes_[iPlane].data(nX, nY);
+            }
+
+            const D *
+            data(unsigned int iPlane, int nX = 0, int nY = 0)
+            const
+            {
+                return aPlanes_[iPlane].data(nX, nY);
+            }
+
+            void
+            swap(ImageCPUPlanar<D, N, A> &rImage)
+            {
+                Image::swap(rImage);
+                for (unsigned int iPlane = 0; iPlane < N; ++iPlane)
+                {
+                    aPlanes_[iPlane].swap(rImage.aPlanes_[iPlane]);
+                }
+            }
+
+        private:
+            ImageCPU<D, 1, A> aPlanes_[N];
+    };
+
+
+    // Host images take their buffers from the ImagePool, so frames that
+    // are freed and reallocated at the same size do not hit the system
+    // allocator; use ImageAllocatorCPU as A for plain new[]/delete[].
+    typedef ImageCPU<Npp8u,  1, npp::ImageAllocatorPooledCPU<Npp8u,      1>  >   ImageCPU_8u_C1;
+    typedef ImageCPU<Npp8u,  2, npp::ImageAllocatorPooledCPU<Npp8u,      2>  >   ImageCPU_8u_C2;
+    typedef ImageCPU<Npp8u,  3, npp::ImageAllocatorPooledCPU<Npp8u,      3>  >   ImageCPU_8u_C3;
+    typedef ImageCPU<Npp8u,  4, npp::ImageAllocatorPooledCPU<Npp8u,      4>  >   ImageCPU_8u_C4;
+
+    typedef ImageCPUPlanar<Npp8u, 3, npp::ImageAllocatorPooledCPU<Npp8u, 1>  >   ImageCPU_8u_P3;
+
+    typedef ImageView<Npp8u, 3>                                                 ImageView_8u_C3;
+    typedef ImageView<const Npp8u, 3>                                           ConstImageView_8u_C3;
 
-    typedef ImageCPU<Npp16u, 1, npp::ImageAllocatorCPU<Npp16u,     1>  >   ImageCPU_16u_C1;
-    typedef ImageCPU<Npp16u, 3, npp::ImageAllocatorCPU<Npp16u,     3>  >   ImageCPU_16u_C3;
-    typedef ImageCPU<Npp16u, 4, npp::ImageAllocatorCPU<Npp16u,     4>  >   ImageCPU_16u_C4;
+    typedef ImageCPU<Npp16u, 1, npp::ImageAllocatorPooledCPU<Npp16u,     1>  >   ImageCPU_16u_C1;
+    typedef ImageCPU<Npp16u, 3, npp::ImageAllocatorPooledCPU<Npp16u,     3>  >   ImageCPU_16u_C3;
+    typedef ImageCPU<Npp16u, 4, npp::ImageAllocatorPooledCPU<Npp16u,     4>  >   ImageCPU_16u_C4;
 
-    typedef ImageCPU<Npp16s, 1, npp::ImageAllocatorCPU<Npp16s,     1>  >   ImageCPU_16s_C1;
-    typedef ImageCPU<Npp16s, 3, npp::ImageAllocatorCPU<Npp16s,     3>  >   ImageCPU_16s_C3;
-    typedef ImageCPU<Npp16s, 4, npp::ImageAllocatorCPU<Npp16s,     4>  >   ImageCPU_16s_C4;
+    typedef ImageCPU<Npp16s, 1, npp::ImageAllocatorPooledCPU<Npp16s,     1>  >   ImageCPU_16s_C1;
+    typedef ImageCPU<Npp16s, 3, npp::ImageAllocatorPooledCPU<Npp16s,     3>  >   ImageCPU_16s_C3;
+    typedef ImageCPU<Npp16s, 4, npp::ImageAllocatorPooledCPU<Npp16s,     4>  >   ImageCPU_16s_C4;
 
-    typedef ImageCPU<Npp32s, 1, npp::ImageAllocatorCPU<Npp32s,     1>  >   ImageCPU_32s_C1;
-    typedef ImageCPU<Npp32s, 3, npp::ImageAllocatorCPU<Npp32s,     3>  >   ImageCPU_32s_C3;
-    typedef ImageCPU<Npp32s, 4, npp::ImageAllocatorCPU<Npp32s,     4>  >   ImageCPU_32s_C4;
+    typedef ImageCPU<Npp32s, 1, npp::ImageAllocatorPooledCPU<Npp32s,     1>  >   ImageCPU_32s_C1;
+    typedef ImageCPU<Npp32s, 3, npp::ImageAllocatorPooledCPU<Npp32s,     3>  >   ImageCPU_32s_C3;
+    typedef ImageCPU<Npp32s, 4, npp::ImageAllocatorPooledCPU<Npp32s,     4>  >   ImageCPU_32s_C4;
 
-    typedef ImageCPU<Npp32f, 1, npp::ImageAllocatorCPU<Npp32f,     1>  >   ImageCPU_32f_C1;
-    typedef ImageCPU<Npp32f, 3, npp::ImageAllocatorCPU<Npp32f,     3>  >   ImageCPU_32f_C3;
-    typedef ImageCPU<Npp32f, 4, npp::ImageAllocatorCPU<Npp32f,     4>  >   ImageCPU_32f_C4;
+    typedef ImageCPU<Npp32f, 1, npp::ImageAllocatorPooledCPU<Npp32f,     1>  >   ImageCPU_32f_C1;
+    typedef ImageCPU<Npp32f, 3, npp::ImageAllocatorPooledCPU<Npp32f,     3>  >   ImageCPU_32f_C3;
+    typedef ImageCPU<Npp32f, 4, npp::ImageAllocatorPooledCPU<Npp32f,     4>  >   ImageCPU_32f_C4;
 
 } // npp namespace
 
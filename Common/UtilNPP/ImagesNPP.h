@@ -35,6 +35,8 @@
 #include "ImageAllocatorsNPP.h"
 #include <cuda_runtime.h>
 
+#include <utility>
+
 namespace npp
 {
     // forward declaration
@@ -59,7 +61,12 @@ namespace npp
                 ;
             }
 
-            ImageNPP(const ImageNPP<D, N> &rImage): Image(rImage)
+            ImageNPP(const ImageNPP<D, N> &rImage): ImagePacked<D, N, npp::ImageAllocator<D, N> >(rImage)
+            {
+                ;
+            }
+
+            ImageNPP(ImageNPP<D, N> &&rImage) noexcept: ImagePacked<D, N, npp::ImageAllocator<D, N> >(std::move(rImage))
             {
                 ;
             }
@@ -90,6 +97,14 @@ namespace npp
                 return *this;
             }
 
+            ImageNPP &
+            operator= (ImageNPP<D, N> &&rImage) noexcept
+            {
+                ImagePacked<D, N, npp::ImageAllocator<D, N> >::operator= (std::move(rImage));
+
+                return *this;
+            }
+
             void
             copyTo(D *pData, unsigned int nPitch)
             const
@@ -0,0 +1,372 @@
+#ifndef NV_UTIL_NPP_PNG_WRITER_H
+#define NV_UTIL_NPP_PNG_WRITER_H
+
+#include "ImagesCPU.h"
+
+#include <npp.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace npp
+{
+    /// PNG writer that deflates the image on several threads, the way pigz
+    /// compresses a file. The filtered scanlines are cut into chunks of
+    /// about 1 MB; each chunk is deflated on its own, primed with the last
+    /// 32 KB of the chunk before it as dictionary so the ratio stays close
+    /// to a single stream, and ended with a sync flush, which byte-aligns
+    /// it without ending the deflate stream. The chunks concatenate into
+    /// one valid zlib stream; its Adler-32 is combined from the chunks'
+    /// with adler32_combine, and every chunk becomes one IDAT with its CRC
+    /// computed by the thread that compressed it. A writer thread stores
+    /// the chunks in order while later ones are compressed, and at most a
+    /// few chunks per thread are held in memory.
+    namespace png
+    {
+        const size_t WINDOW_SIZE = 32768;
+        const size_t CHUNK_BYTES = 1 << 20;
+
+        inline
+        void
+        put32(Npp8u *pDst, Npp32u nValue)
+        {
+            pDst[0] = static_cast<Npp8u>(nValue >> 24);
+            pDst[1] = static_cast<Npp8u>(nValue >> 16);
+            pDst[2] = static_cast<Npp8u>(nValue >> 8);
+            pDst[3] = static_cast<Npp8u>(nValue);
+        }
+
+        inline
+        int
+        paeth(int a, int b, int c)
+        {
+            const int p  = a + b - c;
+            const int pa = std::abs(p - a);
+            const int pb = std::abs(p - b);
+            const int pc = std::abs(p - c);
+            return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+        }
+
+        /// Filter one RGB scanline into pOut (filter type byte + nBytes).
+        /// With bAdaptive the filter with the smallest sum of absolute
+        /// values wins, as in libpng; otherwise the row is stored as is.
+        inline
+        void
+        filterRow(const Npp8u *pRow, const Npp8u *pPrevious, size_t nBytes, bool bAdaptive,
+                  Npp8u *pOut, Npp8u *pScratch)
+        {
+            pOut[0] = 0;
+            std::copy(pRow, pRow + nBytes, pOut + 1);
+            if (!bAdaptive)
+            {
+                return;
+            }
+
+            unsigned long nBest = 0;
+            for (size_t i = 0; i < nBytes; ++i)
+            {
+                nBest += std::abs(static_cast<signed char>(pRow[i]));
+            }
+
+            for (int nType = 1; nType <= 4; ++nType)
+            {
+                unsigned long nSum = 0;
+                for (size_t i = 0; i < nBytes && nSum < nBest; ++i)
+                {
+                    const int a = i >= 3 ? pRow[i - 3] : 0;
+                    const int b = pPrevious ? pPrevious[i] : 0;
+                    const int c = i >= 3 && pPrevious ? pPrevious[i - 3] : 0;
+                    int nPredictor = 0;
+                    switch (nType)
+                    {
+                        case 1: nPredictor = a;                 break;
+                        case 2: nPredictor = b;                 break;
+                        case 3: nPredictor = (a + b) >> 1;      break;
+                        default: nPredictor = paeth(a, b, c);   break;
+                    }
+                    pScratch[i] = static_cast<Npp8u>(pRow[i] - nPredictor);
+                    nSum += std::abs(static_cast<signed char>(pScratch[i]));
+                }
+                if (nSum < nBest)
+                {
+                    nBest = nSum;
+                    pOut[0] = static_cast<Npp8u>(nType);
+                    std::copy(pScratch, pScratch + nBytes, pOut + 1);
+                }
+            }
+        }
+
+        /// Scanline iLine of rImage in R, G, B order
+        inline
+        void
+        rgbRow(const ConstImageView_8u_C3 &rImage, unsigned int iLine, bool bBgr, Npp8u *pRow)
+        {
+            const Npp8u *pSrc = rImage.data(0, iLine);
+            if (!bBgr)
+            {
+                std::copy(pSrc, pSrc + 3 * rImage.width(), pRow);
+                return;
+            }
+            for (unsigned int i = 0; i < rImage.width(); ++i)
+            {
+                pRow[3 * i]     = pSrc[3 * i + 2];
+                pRow[3 * i + 1] = pSrc[3 * i + 1];
+                pRow[3 * i + 2] = pSrc[3 * i];
+            }
+        }
+
+        /// Filtered scanlines [nBegin, nEnd) appended to rOut
+        inline
+        void
+        filterRows(const ConstImageView_8u_C3 &rImage, unsigned int nBegin, unsigned int nEnd, bool bBgr,
+                   bool bAdaptive, std::vector<Npp8u> &rOut)
+        {
+            const size_t nBytes = 3 * static_cast<size_t>(rImage.width());
+            std::vector<Npp8u> oRows(2 * nBytes);
+            std::vector<Npp8u> oScratch(nBytes);
+            Npp8u *pRow = oRows.data();
+            Npp8u *pPrevious = oRows.data() + nBytes;
+
+            if (nBegin > 0)
+            {
+                rgbRow(rImage, nBegin - 1, bBgr, pPrevious);
+            }
+            const size_t nStart = rOut.size();
+            rOut.resize(nStart + (nEnd - nBegin) * (nBytes + 1));
+            for (unsigned int iLine = nBegin; iLine < nEnd; ++iLine)
+            {
+                rgbRow(rImage, iLine, bBgr, pRow);
+                filterRow(pRow, iLine > 0 ? pPrevious : 0, nBytes, bAdaptive,
+                          rOut.data() + nStart + (iLine - nBegin) * (nBytes + 1), oScratch.data());
+                std::swap(pRow, pPrevious);
+            }
+        }
+
+        /// A compressed chunk of scanlines, stored as one IDAT
+        struct Chunk
+        {
+            std::vector<Npp8u> oIdat;   ///< length, "IDAT", data; CRC added on writing
+            uLong nAdler;               ///< Adler-32 of the filtered bytes
+            uLong nLength;              ///< number of filtered bytes
+            uLong nCrc;                 ///< CRC-32 of "IDAT" and the data
+            bool  bReady;
+            bool  bFailed;
+        };
+
+        /// Filter and deflate scanlines [nBegin, nEnd) into rChunk
+        inline
+        void
+        compressChunk(const ConstImageView_8u_C3 &rImage, unsigned int nBegin, unsigned int nEnd, int nLevel,
+                      bool bBgr, Chunk &rChunk)
+        {
+            const size_t nLineBytes = 3 * static_cast<size_t>(rImage.width()) + 1;
+            const bool bAdaptive = nLevel > 0;
+            const bool bFirst = nBegin == 0;
+            const bool bLast = nEnd == rImage.height();
+
+            // the scanlines before nBegin that make up the dictionary,
+            // then the chunk's own
+            const unsigned int nHistory = bFirst ? 0 :
+                std::min<unsigned int>(nBegin, static_cast<unsigned int>((WINDOW_SIZE + nLineBytes - 1) / nLineBytes));
+            std::vector<Npp8u> oFiltered;
+            filterRows(rImage, nBegin - nHistory, nEnd, bBgr, bAdaptive, oFiltered);
+            const size_t nDictionary = std::min(WINDOW_SIZE, nHistory * nLineBytes);
+            const Npp8u *pInput = oFiltered.data() + nHistory * nLineBytes;
+            const size_t nInput = oFiltered.size() - nHistory * nLineBytes;
+
+            z_stream oStream = z_stream();
+            rChunk.bFailed = deflateInit2(&oStream, nLevel, Z_DEFLATED, -15, 9,
+                                          bAdaptive ? Z_FILTERED : Z_DEFAULT_STRATEGY) != Z_OK;
+            if (rChunk.bFailed)
+            {
+                return;
+            }
+            if (nDictionary > 0)
+            {
+                deflateSetDictionary(&oStream, pInput - nDictionary, static_cast<uInt>(nDictionary));
+            }
+
+            // 8 bytes of IDAT header, the zlib header in the first chunk,
+            // and room for the sync flush marker
+            const size_t nHeader = 8 + (bFirst ? 2 : 0);
+            rChunk.oIdat.resize(nHeader + deflateBound(&oStream, static_cast<uLong>(nInput)) + 16);
+            Npp8u *pIdat = rChunk.oIdat.data();
+            if (bFirst)
+            {
+                // CMF: deflate with a 32 KB window; FLG: compression level
+                // hint, with check bits making the pair a multiple of 31
+                const int nFlevel = nLevel < 2 ? 0 : (nLevel < 6 ? 1 : (nLevel == 6 ? 2 : 3));
+                pIdat[8] = 0x78;
+                pIdat[9] = static_cast<Npp8u>(nFlevel << 6);
+                pIdat[9] = static_cast<Npp8u>(pIdat[9] + 31 - (0x78 * 256 + pIdat[9]) % 31);
+            }
+
+            oStream.next_in = const_cast<Bytef *>(pInput);
+            oStream.avail_in = static_cast<uInt>(nInput);
+            oStream.next_out = pIdat + nHeader;
+            oStream.avail_out = static_cast<uInt>(rChunk.oIdat.size() - nHeader);
+            const int nResult = deflate(&oStream, bLast ? Z_FINISH : Z_SYNC_FLUSH);
+            rChunk.bFailed = (bLast ? nResult != Z_STREAM_END : nResult != Z_OK) || oStream.avail_in != 0;
+            const size_t nData = nHeader - 8 + oStream.total_out;
+            deflateEnd(&oStream);
+
+            rChunk.oIdat.resize(8 + nData);
+            pIdat = rChunk.oIdat.data();
+            put32(pIdat, static_cast<Npp32u>(nData));
+            pIdat[4] = 'I'; pIdat[5] = 'D'; pIdat[6] = 'A'; pIdat[7] = 'T';
+            rChunk.nCrc = crc32(0L, pIdat + 4, static_cast<uInt>(4 + nData));
+            rChunk.nAdler = adler32(adler32(0L, Z_NULL, 0), pInput, static_cast<uInt>(nInput));
+            rChunk.nLength = static_cast<uLong>(nInput);
+        }
+
+        /// Write a complete PNG chunk of the given type
+        inline
+        bool
+        writeChunk(FILE *pFile, const char *zType, const Npp8u *pData, Npp32u nLength)
+        {
+            Npp8u aHeader[8];
+            put32(aHeader, nLength);
+            std::copy(zType, zType + 4, aHeader + 4);
+            uLong nCrc = crc32(0L, aHeader + 4, 4);
+            if (nLength > 0)
+            {
+                // crc32() restarts on a null buffer
+                nCrc = crc32(nCrc, pData, nLength);
+            }
+            Npp8u aCrc[4];
+            put32(aCrc, static_cast<Npp32u>(nCrc));
+
+            // IEND has no data, and fwrite must not be given a null buffer
+            return fwrite(aHeader, 1, 8, pFile) == 8 &&
+                   (nLength == 0 || fwrite(pData, 1, nLength, pFile) == nLength) &&
+                   fwrite(aCrc, 1, 4, pFile) == 4;
+        }
+    } // png namespace
+
+    /// Write rImage as an 8-bit RGB PNG deflated at zlib level nLevel on
+    /// nThreads threads. bBgr says the image holds B, G, R in memory.
+    inline
+    bool
+    savePngParallel(const std::string &rFileName, const ConstImageView_8u_C3 &rImage, int nLevel, int nThreads,
+                    bool bBgr)
+    {
+        FILE *pFile = fopen(rFileName.c_str(), "wb");
+        if (!pFile)
+        {
+            return false;
+        }
+
+        static const Npp8u aSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        Npp8u aHeader[13];
+        png::put32(aHeader, rImage.width());
+        png::put32(aHeader + 4, rImage.height());
+        aHeader[8]  = 8;   // bit depth
+        aHeader[9]  = 2;   // RGB
+        aHeader[10] = 0;   // deflate
+        aHeader[11] = 0;   // adaptive filtering
+        aHeader[12] = 0;   // not interlaced
+        if (fwrite(aSignature, 1, 8, pFile) != 8 || !png::writeChunk(pFile, "IHDR", aHeader, 13))
+        {
+            // before any worker starts: the writer loop below is what lets
+            // them past the window, so they must not wait on a dead file
+            fclose(pFile);
+            return false;
+        }
+        bool bWritten = true;
+
+        const size_t nLineBytes = 3 * static_cast<size_t>(rImage.width()) + 1;
+        const unsigned int nChunkRows = static_cast<unsigned int>(std::max<size_t>(1, png::CHUNK_BYTES / nLineBytes));
+        const unsigned int nChunks = (rImage.height() + nChunkRows - 1) / nChunkRows;
+        nThreads = std::max(1, std::min(nThreads, static_cast<int>(nChunks)));
+
+        // chunks in flight, indexed by chunk number modulo the window
+        const unsigned int nWindow = 4 * static_cast<unsigned int>(nThreads);
+        std::vector<png::Chunk> aChunks(nWindow);
+        std::mutex oMutex;
+        std::condition_variable oChanged;
+        unsigned int nNext = 0;
+        unsigned int nStored = 0;
+        bool bAbort = false;
+
+        std::vector<std::thread> aThreads;
+        for (int iThread = 0; iThread < nThreads; ++iThread)
+        {
+            aThreads.emplace_back([&]() {
+                std::unique_lock<std::mutex> oLock(oMutex);
+                while (!bAbort && nNext < nChunks)
+                {
+                    const unsigned int iChunk = nNext++;
+                    oChanged.wait(oLock, [&]() { return bAbort || iChunk < nStored + nWindow; });
+                    if (bAbort)
+                    {
+                        break;
+                    }
+                    png::Chunk &rChunk = aChunks[iChunk % nWindow];
+                    oLock.unlock();
+
+                    const unsigned int nBegin = iChunk * nChunkRows;
+                    png::compressChunk(rImage, nBegin, std::min(rImage.height(), nBegin + nChunkRows), nLevel, bBgr,
+                                       rChunk);
+
+                    oLock.lock();
+                    rChunk.bReady = true;
+                    oChanged.notify_all();
+                }
+            });
+        }
+
+        // store the chunks in order as they complete
+        uLong nAdler = adler32(0L, Z_NULL, 0);
+        for (unsigned int iChunk = 0; iChunk < nChunks && bWritten; ++iChunk)
+        {
+            png::Chunk &rChunk = aChunks[iChunk % nWindow];
+            {
+                std::unique_lock<std::mutex> oLock(oMutex);
+                oChanged.wait(oLock, [&]() { return rChunk.bReady; });
+            }
+
+            bWritten = !rChunk.bFailed;
+            nAdler = iChunk == 0 ? rChunk.nAdler : adler32_combine(nAdler, rChunk.nAdler, rChunk.nLength);
+            uLong nCrc = rChunk.nCrc;
+            if (iChunk + 1 == nChunks)
+            {
+                // the zlib trailer ends the last IDAT
+                Npp8u aTrailer[4];
+                png::put32(aTrailer, static_cast<Npp32u>(nAdler));
+                rChunk.oIdat.insert(rChunk.oIdat.end(), aTrailer, aTrailer + 4);
+                png::put32(rChunk.oIdat.data(), static_cast<Npp32u>(rChunk.oIdat.size() - 8));
+                nCrc = crc32(nCrc, aTrailer, 4);
+            }
+            Npp8u aCrc[4];
+            png::put32(aCrc, static_cast<Npp32u>(nCrc));
+            bWritten = bWritten && fwrite(rChunk.oIdat.data(), 1, rChunk.oIdat.size(), pFile) == rChunk.oIdat.size() &&
+                       fwrite(aCrc, 1, 4, pFile) == 4;
+
+            std::lock_guard<std::mutex> oLock(oMutex);
+            rChunk.bReady = false;
+            std::vector<Npp8u>().swap(rChunk.oIdat);
+            ++nStored;
+            bAbort = !bWritten;
+            oChanged.notify_all();
+        }
+
+        for (auto &rThread : aThreads)
+        {
+            rThread.join();
+        }
+
+        bWritten = bWritten && png::writeChunk(pFile, "IEND", 0, 0);
+        return fclose(pFile) == 0 && bWritten;
+    }
+
+} // npp namespace
+
+#endif // NV_UTIL_NPP_PNG_WRITER_H
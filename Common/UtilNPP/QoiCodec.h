@@ -0,0 +1,353 @@
+#ifndef NV_UTIL_NPP_QOI_CODEC_H
+#define NV_UTIL_NPP_QOI_CODEC_H
+
+#include "ImagesCPU.h"
+
+#include <npp.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+namespace npp
+{
+    /// QOI ("Quite OK Image", https://qoiformat.org) lossless codec for
+    /// 3-channel 8-bit images. A pixel is coded as a run of the previous
+    /// pixel, a reference into a 64-entry hash of recent pixels, a small
+    /// difference to the previous pixel or the literal value, so encoding
+    /// and decoding are a single pass without entropy coding. Files are
+    /// a few times faster to write than deflated PNG and somewhat larger.
+    ///
+    /// QOI stores R, G, B; bBgr says the image holds B, G, R in memory
+    /// (as FreeImage does on little-endian hosts).
+    namespace qoi
+    {
+        const Npp8u OP_INDEX = 0x00;
+        const Npp8u OP_DIFF  = 0x40;
+        const Npp8u OP_LUMA  = 0x80;
+        const Npp8u OP_RUN   = 0xc0;
+        const Npp8u OP_RGB   = 0xfe;
+        const Npp8u OP_RGBA  = 0xff;
+        const Npp8u MASK_2   = 0xc0;
+
+        const size_t       HEADER_SIZE  = 14;
+        const size_t       PADDING_SIZE = 8;
+        const unsigned int PIXELS_MAX   = 400000000;
+        const size_t       BUFFER_KEEP  = 64 << 20; ///< largest encode buffer kept per thread (a 4K frame needs 33 MB)
+
+        struct Rgba
+        {
+            Npp8u r, g, b, a;
+        };
+
+        inline
+        bool
+        operator== (const Rgba &rA, const Rgba &rB)
+        {
+            return rA.r == rB.r && rA.g == rB.g && rA.b == rB.b && rA.a == rB.a;
+        }
+
+        inline
+        unsigned int
+        hash(const Rgba &rPixel)
+        {
+            return (rPixel.r * 3 + rPixel.g * 5 + rPixel.b * 7 + rPixel.a * 11) % 64;
+        }
+
+        inline
+        void
+        write32(Npp8u *pDst, Npp32u nValue)
+        {
+            pDst[0] = static_cast<Npp8u>(nValue >> 24);
+            pDst[1] = static_cast<Npp8u>(nValue >> 16);
+            pDst[2] = static_cast<Npp8u>(nValue >> 8);
+            pDst[3] = static_cast<Npp8u>(nValue);
+        }
+
+        inline
+        Npp32u
+        read32(const Npp8u *pSrc)
+        {
+            return static_cast<Npp32u>(pSrc[0]) << 24 | static_cast<Npp32u>(pSrc[1]) << 16 |
+                   static_cast<Npp32u>(pSrc[2]) << 8 | pSrc[3];
+        }
+    } // qoi namespace
+
+    /// Largest encoded size of an nWidth x nHeight image: every pixel a
+    /// 4-byte OP_RGB, plus header and end marker
+    inline
+    size_t
+    qoiMaxSize(unsigned int nWidth, unsigned int nHeight)
+    {
+        return static_cast<size_t>(nWidth) * nHeight * 4 + qoi::HEADER_SIZE + qoi::PADDING_SIZE;
+    }
+
+    /// Encode rSrc into pDst, which must hold qoiMaxSize() bytes.
+    /// Returns the number of bytes written.
+    inline
+    size_t
+    qoiEncode(const ConstImageView_8u_C3 &rSrc, Npp8u *pDst, bool bBgr)
+    {
+        const int iR = bBgr ? 2 : 0;
+        const int iB = bBgr ? 0 : 2;
+        Npp8u *p = pDst;
+
+        p[0] = 'q'; p[1] = 'o'; p[2] = 'i'; p[3] = 'f';
+        qoi::write32(p + 4, rSrc.width());
+        qoi::write32(p + 8, rSrc.height());
+        p[12] = 3;  // channels
+        p[13] = 0;  // sRGB with linear alpha
+        p += qoi::HEADER_SIZE;
+
+        qoi::Rgba aIndex[64] = {};
+        qoi::Rgba oPrevious = {0, 0, 0, 255};
+        unsigned int nRun = 0;
+
+        for (unsigned int iLine = 0; iLine < rSrc.height(); ++iLine)
+        {
+            const Npp8u *pLine = rSrc.data(0, iLine);
+            for (unsigned int iPixel = 0; iPixel < rSrc.width(); ++iPixel, pLine += 3)
+            {
+                const qoi::Rgba oPixel = {pLine[iR], pLine[1], pLine[iB], 255};
+
+                if (oPixel == oPrevious)
+                {
+                    if (++nRun == 62)
+                    {
+                        *p++ = static_cast<Npp8u>(qoi::OP_RUN | (nRun - 1));
+                        nRun = 0;
+                    }
+                    continue;
+                }
+                if (nRun > 0)
+                {
+                    *p++ = static_cast<Npp8u>(qoi::OP_RUN | (nRun - 1));
+                    nRun = 0;
+                }
+
+                const unsigned int iHash = qoi::hash(oPixel);
+                if (aIndex[iHash] == oPixel)
+                {
+                    *p++ = static_cast<Npp8u>(qoi::OP_INDEX | iHash);
+                }
+                else
+                {
+                    aIndex[iHash] = oPixel;
+
+                    const int nDr = static_cast<signed char>(oPixel.r - oPrevious.r);
+                    const int nDg = static_cast<signed char>(oPixel.g - oPrevious.g);
+                    const int nDb = static_cast<signed char>(oPixel.b - oPrevious.b);
+                    const int nDrDg = nDr - nDg;
+                    const int nDbDg = nDb - nDg;
+
+                    if (nDr > -3 && nDr < 2 && nDg > -3 && nDg < 2 && nDb > -3 && nDb < 2)
+                    {
+                        *p++ = static_cast<Npp8u>(qoi::OP_DIFF | (nDr + 2) << 4 | (nDg + 2) << 2 | (nDb + 2));
+                    }
+                    else if (nDrDg > -9 && nDrDg < 8 && nDg > -33 && nDg < 32 && nDbDg > -9 && nDbDg < 8)
+                    {
+                        *p++ = static_cast<Npp8u>(qoi::OP_LUMA | (nDg + 32));
+                        *p++ = static_cast<Npp8u>((nDrDg + 8) << 4 | (nDbDg + 8));
+                    }
+                    else
+                    {
+                        *p++ = qoi::OP_RGB;
+                        *p++ = oPixel.r;
+                        *p++ = oPixel.g;
+                        *p++ = oPixel.b;
+                    }
+                }
+                oPrevious = oPixel;
+            }
+        }
+        if (nRun > 0)
+        {
+            *p++ = static_cast<Npp8u>(qoi::OP_RUN | (nRun - 1));
+        }
+
+        for (size_t i = 0; i < qoi::PADDING_SIZE - 1; ++i)
+        {
+            *p++ = 0;
+        }
+        *p++ = 1;
+
+        return static_cast<size_t>(p - pDst);
+    }
+
+    /// Read the size from a QOI header; false if pData is not a QOI image
+    inline
+    bool
+    qoiReadHeader(const Npp8u *pData, size_t nSize, unsigned int &nWidth, unsigned int &nHeight)
+    {
+        if (nSize < qoi::HEADER_SIZE + qoi::PADDING_SIZE ||
+            pData[0] != 'q' || pData[1] != 'o' || pData[2] != 'i' || pData[3] != 'f' ||
+            (pData[12] != 3 && pData[12] != 4) || pData[13] > 1)
+        {
+            return false;
+        }
+        nWidth  = qoi::read32(pData + 4);
+        nHeight = qoi::read32(pData + 8);
+
+        return nWidth > 0 && nHeight > 0 && nHeight < qoi::PIXELS_MAX / nWidth;
+    }
+
+    /// Decode a QOI image into rDst, which must have the image's size.
+    /// The alpha channel of 4-channel files is dropped. Returns false for
+    /// a malformed or truncated stream.
+    inline
+    bool
+    qoiDecode(const Npp8u *pData, size_t nSize, const ImageView_8u_C3 &rDst, bool bBgr)
+    {
+        unsigned int nWidth, nHeight;
+        if (!qoiReadHeader(pData, nSize, nWidth, nHeight) || nWidth != rDst.width() || nHeight != rDst.height())
+        {
+            return false;
+        }
+
+        const int iR = bBgr ? 2 : 0;
+        const int iB = bBgr ? 0 : 2;
+        // ops are at most 5 bytes and the stream ends in 8 bytes of
+        // padding, so an op starting before it is read without bounds checks
+        const size_t nChunksEnd = nSize - qoi::PADDING_SIZE;
+        size_t p = qoi::HEADER_SIZE;
+
+        qoi::Rgba aIndex[64] = {};
+        qoi::Rgba oPixel = {0, 0, 0, 255};
+        unsigned int nRun = 0;
+
+        for (unsigned int iLine = 0; iLine < nHeight; ++iLine)
+        {
+            Npp8u *pLine = rDst.data(0, iLine);
+            for (unsigned int iPixel = 0; iPixel < nWidth; ++iPixel, pLine += 3)
+            {
+                if (nRun > 0)
+                {
+                    --nRun;
+                }
+                else
+                {
+                    if (p >= nChunksEnd)
+                    {
+                        return false;
+                    }
+
+                    const Npp8u b1 = pData[p++];
+                    if (b1 == qoi::OP_RGB)
+                    {
+                        oPixel.r = pData[p];
+                        oPixel.g = pData[p + 1];
+                        oPixel.b = pData[p + 2];
+                        p += 3;
+                    }
+                    else if (b1 == qoi::OP_RGBA)
+                    {
+                        oPixel.r = pData[p];
+                        oPixel.g = pData[p + 1];
+                        oPixel.b = pData[p + 2];
+                        oPixel.a = pData[p + 3];
+                        p += 4;
+                    }
+                    else if ((b1 & qoi::MASK_2) == qoi::OP_INDEX)
+                    {
+                        oPixel = aIndex[b1];
+                    }
+                    else if ((b1 & qoi::MASK_2) == qoi::OP_DIFF)
+                    {
+                        oPixel.r += ((b1 >> 4) & 0x03) - 2;
+                        oPixel.g += ((b1 >> 2) & 0x03) - 2;
+                        oPixel.b += (b1 & 0x03) - 2;
+                    }
+                    else if ((b1 & qoi::MASK_2) == qoi::OP_LUMA)
+                    {
+                        const Npp8u b2 = pData[p++];
+                        const int nDg = (b1 & 0x3f) - 32;
+                        oPixel.r += nDg - 8 + ((b2 >> 4) & 0x0f);
+                        oPixel.g += nDg;
+                        oPixel.b += nDg - 8 + (b2 & 0x0f);
+                    }
+                    else
+                    {
+                        nRun = b1 & 0x3f;
+                    }
+                    aIndex[qoi::hash(oPixel)] = oPixel;
+                }
+
+                pLine[iR] = oPixel.r;
+                pLine[1]  = oPixel.g;
+                pLine[iB] = oPixel.b;
+            }
+        }
+
+        // a last op that ran into the padding means the stream was cut short
+        return p <= nChunksEnd;
+    }
+
+    /// True for file names ending in .qoi, in any case
+    inline
+    bool
+    isQoiFileName(const std::string &rFileName)
+    {
+        const std::string::size_type nLength = rFileName.size();
+        return nLength > 4 && rFileName[nLength - 4] == '.' &&
+               (rFileName[nLength - 3] | 0x20) == 'q' &&
+               (rFileName[nLength - 2] | 0x20) == 'o' &&
+               (rFileName[nLength - 1] | 0x20) == 'i';
+    }
+
+    /// Encode and write rImage as a QOI file. The encode buffer is kept
+    /// per thread, so batch encoders do not fault in a new one per image;
+    /// one grown past qoi::BUFFER_KEEP by an outsized image is released
+    /// again rather than pinned for the thread's lifetime.
+    inline
+    bool
+    saveQoi(const std::string &rFileName, const ConstImageView_8u_C3 &rImage, bool bBgr)
+    {
+        FILE *pFile = fopen(rFileName.c_str(), "wb");
+        if (!pFile)
+        {
+            return false;
+        }
+
+        static thread_local std::vector<Npp8u> oBuffer;
+        if (oBuffer.size() < qoiMaxSize(rImage.width(), rImage.height()))
+        {
+            oBuffer.resize(qoiMaxSize(rImage.width(), rImage.height()));
+        }
+        const size_t nSize = qoiEncode(rImage, oBuffer.data(), bBgr);
+        const bool bWritten = fwrite(oBuffer.data(), 1, nSize, pFile) == nSize;
+        if (oBuffer.size() > qoi::BUFFER_KEEP)
+        {
+            std::vector<Npp8u>().swap(oBuffer);
+        }
+
+        return fclose(pFile) == 0 && bWritten;
+    }
+
+    /// Read a whole file into rData
+    inline
+    bool
+    readFileBytes(const std::string &rFileName, std::vector<Npp8u> &rData)
+    {
+        FILE *pFile = fopen(rFileName.c_str(), "rb");
+        if (!pFile)
+        {
+            return false;
+        }
+
+        bool bRead = fseek(pFile, 0, SEEK_END) == 0;
+        const long nSize = bRead ? ftell(pFile) : -1;
+        bRead = nSize >= 0 && fseek(pFile, 0, SEEK_SET) == 0;
+        if (bRead)
+        {
+            rData.resize(static_cast<size_t>(nSize));
+            bRead = fread(rData.data(), 1, rData.size(), pFile) == rData.size();
+        }
+        fclose(pFile);
+
+        return bRead;
+    }
+
+} // npp namespace
+
+#endif // NV_UTIL_NPP_QOI_CODEC_H
@@ -30,16 +30,27 @@
 #define COMMON_HELPER_IMAGE_H_
 
 #include <assert.h>
+#include <ctype.h>
 #include <exception.h>
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#if !defined(WIN32) && !defined(_WIN32) && !defined(WIN64) && !defined(_WIN64)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #ifndef MIN
 #define MIN(a, b) ((a < b) ? a : b)
 #endif
@@ -133,80 +144,367 @@ struct ConverterToUByte<float> {
 #endif
 #endif
 
-inline bool __loadPPM(const char *file, unsigned char **data, unsigned int *w,
-                      unsigned int *h, unsigned int *channels) {
+//! Header of a binary PNM image (P5 gray or P6 RGB)
+struct PNMInfo {
+  unsigned int width;
+  unsigned int height;
+  unsigned int channels;  //!< 1 for P5, 3 for P6
+  unsigned int maxval;    //!< above 255 a sample takes two bytes
+  size_t offset;          //!< file offset of the first pixel
+
+  unsigned int bytesPerSample() const { return maxval > 255 ? 2 : 1; }
+  size_t rowBytes() const {
+    return static_cast<size_t>(width) * channels * bytesPerSample();
+  }
+  size_t dataBytes() const { return rowBytes() * height; }
+};
+
+namespace helper_image_internal {
+//! largest PNM header accepted, comments included
+const size_t PNMMaxHeaderSize = 1 << 16;
+
+//! Parse a PNM header from the first size bytes of a file. Comments may
+//! appear between any two header fields; one after maxval also ends the
+//! header.
+//! @return 1 if parsed, 0 if more bytes are needed, -1 if not a valid header
+inline int parsePNMHeader(const unsigned char *buf, size_t size,
+                          PNMInfo *info) {
+  if (size < 2) {
+    return 0;
+  }
+  if (buf[0] != 'P' || (buf[1] != '5' && buf[1] != '6')) {
+    return -1;
+  }
+
+  size_t pos = 2;
+  uint64_t fields[3];
+
+  for (int i = 0; i < 3; ++i) {
+    // whitespace and comments before the field
+    while (pos < size && (isspace(buf[pos]) || buf[pos] == '#')) {
+      if (buf[pos] == '#') {
+        while (pos < size && buf[pos] != '\n' && buf[pos] != '\r') {
+          ++pos;
+        }
+      } else {
+        ++pos;
+      }
+    }
+    if (pos == size) {
+      return 0;
+    }
+    if (!isdigit(buf[pos])) {
+      return -1;
+    }
+    fields[i] = 0;
+    while (pos < size && isdigit(buf[pos])) {
+      fields[i] = fields[i] * 10 + (buf[pos++] - '0');
+      if (fields[i] > 0xFFFFFFFFu) {
+        return -1;
+      }
+    }
+    if (pos == size) {
+      return 0;
+    }
+  }
+
+  // a single whitespace byte, or a comment and its line end, before the data
+  if (buf[pos] == '#') {
+    while (pos < size && buf[pos] != '\n') {
+      ++pos;
+    }
+    if (pos == size) {
+      return 0;
+    }
+  } else if (!isspace(buf[pos])) {
+    return -1;
+  }
+
+  if (fields[0] == 0 || fields[1] == 0 || fields[2] == 0 ||
+      fields[2] > 65535) {
+    return -1;
+  }
+  info->channels = buf[1] == '5' ? 1 : 3;
+  info->width = static_cast<unsigned int>(fields[0]);
+  info->height = static_cast<unsigned int>(fields[1]);
+  info->maxval = static_cast<unsigned int>(fields[2]);
+  info->offset = pos + 1;
+  return 1;
+}
+
+//! PNM stores 16-bit samples big-endian
+inline bool hostIsLittleEndian() {
+  const uint16_t one = 1;
+  return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+//! Swap the bytes of count 16-bit samples in place
+inline void swapSamples16(unsigned char *data, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char high = data[2 * i];
+    data[2 * i] = data[2 * i + 1];
+    data[2 * i + 1] = high;
+  }
+}
+
+//! Read and parse the header at the start of an open file
+inline bool readPNMHeader(FILE *fp, PNMInfo *info) {
+  std::vector<unsigned char> header;
+  int parsed = 0;
+
+  while (parsed == 0 && header.size() < PNMMaxHeaderSize) {
+    const size_t have = header.size();
+    header.resize(have + 4096);
+    const size_t got = fread(&header[have], 1, 4096, fp);
+    header.resize(have + got);
+    parsed = parsePNMHeader(header.data(), header.size(), info);
+    if (got == 0) {
+      break;
+    }
+  }
+  return parsed == 1 && fseek(fp, static_cast<long>(info->offset), SEEK_SET) == 0;
+}
+
+//! Read the pixels of an open file positioned at the data, row y to
+//! dst + y * pitch; tight rows are read with a single call
+inline bool readPNMPixels(FILE *fp, const PNMInfo &info, void *dst,
+                          size_t pitch) {
+  unsigned char *rows = static_cast<unsigned char *>(dst);
+  const size_t row_bytes = info.rowBytes();
+
+  if (pitch == row_bytes) {
+    if (fread(rows, 1, info.dataBytes(), fp) != info.dataBytes()) {
+      return false;
+    }
+  } else {
+    for (unsigned int y = 0; y < info.height; ++y) {
+      if (fread(rows + y * pitch, 1, row_bytes, fp) != row_bytes) {
+        return false;
+      }
+    }
+  }
+
+  if (info.bytesPerSample() == 2 && hostIsLittleEndian()) {
+    for (unsigned int y = 0; y < info.height; ++y) {
+      swapSamples16(rows + y * pitch, row_bytes / 2);
+    }
+  }
+  return true;
+}
+}  // namespace helper_image_internal
+
+//////////////////////////////////////////////////////////////////////////////
+//! Read the header of a binary PNM (P5/P6) file, so that the caller can
+//! allocate the buffer sdkLoadPNM reads into
+//! @return bool if the file is a valid PNM image
+//////////////////////////////////////////////////////////////////////////////
+inline bool sdkReadPNMInfo(const char *file, PNMInfo *info) {
   FILE *fp = NULL;
 
   if (FOPEN_FAIL(FOPEN(fp, file, "rb"))) {
-    std::cerr << "__LoadPPM() : Failed to open file: " << file << std::endl;
     return false;
   }
+  const bool result = helper_image_internal::readPNMHeader(fp, info);
+  fclose(fp);
+  return result;
+}
 
-  // check header
-  char header[helper_image_internal::PGMHeaderSize];
+//////////////////////////////////////////////////////////////////////////////
+//! Read a binary PNM file into a caller-provided buffer, row y at
+//! dst + y * pitch. Samples are copied as stored, without conversion;
+//! 16-bit samples (maxval > 255) are returned in host byte order.
+//! @return bool if the file was read and has the size and format in info
+//! @param info  header from sdkReadPNMInfo, checked against the file
+//////////////////////////////////////////////////////////////////////////////
+inline bool sdkLoadPNM(const char *file, const PNMInfo &info, void *dst,
+                       size_t pitch) {
+  FILE *fp = NULL;
 
-  if (fgets(header, helper_image_internal::PGMHeaderSize, fp) == NULL) {
-    std::cerr << "__LoadPPM() : reading PGM header returned NULL" << std::endl;
+  if (FOPEN_FAIL(FOPEN(fp, file, "rb"))) {
+    std::cerr << "sdkLoadPNM() : Failed to open file: " << file << std::endl;
     return false;
   }
 
-  if (strncmp(header, "P5", 2) == 0) {
-    *channels = 1;
-  } else if (strncmp(header, "P6", 2) == 0) {
-    *channels = 3;
-  } else {
-    std::cerr << "__LoadPPM() : File is not a PPM or PGM image" << std::endl;
-    *channels = 0;
+  PNMInfo actual;
+  bool result = helper_image_internal::readPNMHeader(fp, &actual) &&
+                actual.width == info.width && actual.height == info.height &&
+                actual.channels == info.channels &&
+                actual.maxval == info.maxval && pitch >= info.rowBytes() &&
+                helper_image_internal::readPNMPixels(fp, actual, dst, pitch);
+  fclose(fp);
+
+  if (!result) {
+    std::cerr << "sdkLoadPNM() : Failed to read " << file << std::endl;
+  }
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//! Write a binary PNM file (P5 for one channel, P6 for three) from rows at
+//! data + y * pitch. maxval above 255 writes 16-bit samples given in host
+//! byte order.
+//! @return bool if the file was written
+//////////////////////////////////////////////////////////////////////////////
+inline bool sdkSavePNM(const char *file, const void *data, size_t pitch,
+                       unsigned int w, unsigned int h, unsigned int channels,
+                       unsigned int maxval = 255) {
+  if ((channels != 1 && channels != 3) || w == 0 || h == 0 || maxval == 0 ||
+      maxval > 65535) {
+    std::cerr << "sdkSavePNM() : Invalid image format." << std::endl;
     return false;
   }
 
-  // parse header, read maxval, width and height
-  unsigned int width = 0;
-  unsigned int height = 0;
-  unsigned int maxval = 0;
-  unsigned int i = 0;
+  FILE *fp = NULL;
 
-  while (i < 3) {
-    if (fgets(header, helper_image_internal::PGMHeaderSize, fp) == NULL) {
-      std::cerr << "__LoadPPM() : reading PGM header returned NULL"
-                << std::endl;
-      return false;
-    }
+  if (FOPEN_FAIL(FOPEN(fp, file, "wb"))) {
+    std::cerr << "sdkSavePNM() : Opening file failed." << std::endl;
+    return false;
+  }
 
-    if (header[0] == '#') {
-      continue;
-    }
+  PNMInfo info = {w, h, channels, maxval, 0};
+  const size_t row_bytes = info.rowBytes();
+  const unsigned char *rows = static_cast<const unsigned char *>(data);
+  const bool swap =
+      info.bytesPerSample() == 2 && helper_image_internal::hostIsLittleEndian();
+
+  bool result = fprintf(fp, "P%c\n%u %u\n%u\n", channels == 1 ? '5' : '6', w,
+                        h, maxval) > 0;
 
-    if (i == 0) {
-      i += SSCANF(header, "%u %u %u", &width, &height, &maxval);
-    } else if (i == 1) {
-      i += SSCANF(header, "%u %u", &height, &maxval);
-    } else if (i == 2) {
-      i += SSCANF(header, "%u", &maxval);
+  if (pitch == row_bytes && !swap) {
+    result = result && fwrite(rows, 1, info.dataBytes(), fp) == info.dataBytes();
+  } else {
+    std::vector<unsigned char> row(row_bytes);
+
+    for (unsigned int y = 0; y < h && result; ++y) {
+      const unsigned char *src = rows + y * pitch;
+
+      if (swap) {
+        memcpy(row.data(), src, row_bytes);
+        helper_image_internal::swapSamples16(row.data(), row_bytes / 2);
+        src = row.data();
+      }
+      result = fwrite(src, 1, row_bytes, fp) == row_bytes;
     }
   }
 
+  result = fclose(fp) == 0 && result;
+
+  if (!result) {
+    std::cerr << "sdkSavePNM() : Writing data failed." << std::endl;
+  }
+  return result;
+}
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(WIN64) && !defined(_WIN64)
+//! A PNM file mapped read-only into memory
+struct PNMMapping {
+  PNMInfo info;
+  const unsigned char *pixels;  //!< first pixel, samples as stored
+  void *base;
+  size_t size;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//! Map a binary PNM file instead of reading it; rows are tight, at
+//! pixels + y * info.rowBytes(), and 16-bit samples stay big-endian
+//! @return bool if the file was mapped; release it with sdkUnmapPNM
+//////////////////////////////////////////////////////////////////////////////
+inline bool sdkMapPNM(const char *file, PNMMapping *mapping) {
+  const int fd = open(file, O_RDONLY);
+
+  if (fd < 0) {
+    std::cerr << "sdkMapPNM() : Failed to open file: " << file << std::endl;
+    return false;
+  }
+
+  struct stat st;
+  void *base = MAP_FAILED;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    base = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE,
+                fd, 0);
+  }
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    std::cerr << "sdkMapPNM() : Failed to map file: " << file << std::endl;
+    return false;
+  }
+
+  mapping->base = base;
+  mapping->size = static_cast<size_t>(st.st_size);
+  const unsigned char *bytes = static_cast<const unsigned char *>(base);
+
+  if (helper_image_internal::parsePNMHeader(
+          bytes, std::min(mapping->size, helper_image_internal::PNMMaxHeaderSize),
+          &mapping->info) != 1 ||
+      mapping->info.offset + mapping->info.dataBytes() > mapping->size) {
+    std::cerr << "sdkMapPNM() : File is not a valid PPM or PGM image"
+              << std::endl;
+    munmap(base, mapping->size);
+    return false;
+  }
+
+  mapping->pixels = bytes + mapping->info.offset;
+  madvise(base, mapping->size, MADV_SEQUENTIAL);
+  return true;
+}
+
+inline void sdkUnmapPNM(PNMMapping *mapping) {
+  munmap(mapping->base, mapping->size);
+  mapping->base = NULL;
+  mapping->pixels = NULL;
+}
+#endif
+
+inline bool __loadPPM(const char *file, unsigned char **data, unsigned int *w,
+                      unsigned int *h, unsigned int *channels) {
+  FILE *fp = NULL;
+
+  if (FOPEN_FAIL(FOPEN(fp, file, "rb"))) {
+    std::cerr << "__LoadPPM() : Failed to open file: " << file << std::endl;
+    return false;
+  }
+
+  PNMInfo info;
+
+  if (!helper_image_internal::readPNMHeader(fp, &info)) {
+    std::cerr << "__LoadPPM() : File is not a PPM or PGM image" << std::endl;
+    *channels = 0;
+    fclose(fp);
+    return false;
+  }
+
+  if (info.maxval > 255) {
+    std::cerr << "__LoadPPM() : 16-bit image, use sdkLoadPNM" << std::endl;
+    fclose(fp);
+    return false;
+  }
+
+  *channels = info.channels;
+
   // check if given handle for the data is initialized
   if (NULL != *data) {
-    if (*w != width || *h != height) {
+    if (*w != info.width || *h != info.height) {
       std::cerr << "__LoadPPM() : Invalid image dimensions." << std::endl;
+      fclose(fp);
+      return false;
     }
   } else {
-    *data = (unsigned char *)malloc(sizeof(unsigned char) * width * height *
-                                    *channels);
-    *w = width;
-    *h = height;
+    *data = (unsigned char *)malloc(info.dataBytes());
+    *w = info.width;
+    *h = info.height;
   }
 
   // read and close file
-  if (fread(*data, sizeof(unsigned char), width * height * *channels, fp) ==
-      0) {
-    std::cerr << "__LoadPPM() read data returned error." << std::endl;
-  }
-
+  const bool result =
+      helper_image_internal::readPNMPixels(fp, info, *data, info.rowBytes());
   fclose(fp);
 
-  return true;
+  if (!result) {
+    std::cerr << "__LoadPPM() read data returned error." << std::endl;
+  }
+  return result;
 }
 
 template <class T>
@@ -215,6 +513,12 @@ inline bool sdkLoadPGM(const char *file, T **data, unsigned int *w,
   unsigned char *idata = NULL;
   unsigned int channels;
 
+  // bytes need no conversion, read them straight into the caller's buffer
+  if (std::is_same<T, unsigned char>::value) {
+    return __loadPPM(file, reinterpret_cast<unsigned char **>(data), w, h,
+                     &channels);
+  }
+
   if (true != __loadPPM(file, &idata, w, h, &channels)) {
     return false;
   }
@@ -271,43 +575,22 @@ inline bool __savePPM(const char *file, unsigned char *data, unsigned int w,
   assert(w > 0);
   assert(h > 0);
 
-  std::fstream fh(file, std::fstream::out | std::fstream::binary);
-
-  if (fh.bad()) {
-    std::cerr << "__savePPM() : Opening file failed." << std::endl;
-    return false;
-  }
-
-  if (channels == 1) {
-    fh << "P5\n";
-  } else if (channels == 3) {
-    fh << "P6\n";
-  } else {
+  if (channels != 1 && channels != 3) {
     std::cerr << "__savePPM() : Invalid number of channels." << std::endl;
     return false;
   }
 
-  fh << w << "\n" << h << "\n" << 0xff << std::endl;
-
-  for (unsigned int i = 0; (i < (w * h * channels)) && fh.good(); ++i) {
-    fh << data[i];
-  }
-
-  fh.flush();
-
-  if (fh.bad()) {
-    std::cerr << "__savePPM() : Writing data failed." << std::endl;
-    return false;
-  }
-
-  fh.close();
-
-  return true;
+  return sdkSavePNM(file, data, static_cast<size_t>(w) * channels, w, h,
+                    channels);
 }
 
 template <class T>
 inline bool sdkSavePGM(const char *file, T *data, unsigned int w,
                        unsigned int h) {
+  if (std::is_same<T, unsigned char>::value) {
+    return __savePPM(file, reinterpret_cast<unsigned char *>(data), w, h, 1);
+  }
+
   unsigned int size = w * h;
   unsigned char *idata = (unsigned char *)malloc(sizeof(unsigned char) * size);
 
@@ -26,6 +26,7 @@
  */
 
 #include "helper_multiprocess.h"
+#include <cstddef>
 #include <cstdlib>
 #include <string>
 
@@ -60,7 +61,8 @@ int sharedMemoryCreate(const char *name, size_t sz, sharedMemoryInfo *info) {
   }
 
   info->addr = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, info->shmFd, 0);
-  if (info->addr == NULL) {
+  if (info->addr == MAP_FAILED) {
+    info->addr = NULL;
     return errno;
   }
 
@@ -92,7 +94,8 @@ int sharedMemoryOpen(const char *name, size_t sz, sharedMemoryInfo *info) {
   }
 
   info->addr = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, info->shmFd, 0);
-  if (info->addr == NULL) {
+  if (info->addr == MAP_FAILED) {
+    info->addr = NULL;
     return errno;
   }
 
@@ -100,6 +103,18 @@ int sharedMemoryOpen(const char *name, size_t sz, sharedMemoryInfo *info) {
 #endif
 }
 
+int sharedMemoryUnlink(const char *name) {
+#if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64)
+  // the mapping goes away with its last handle
+  return 0;
+#else
+  if (shm_unlink(name) != 0 && errno != ENOENT) {
+    return errno;
+  }
+  return 0;
+#endif
+}
+
 void sharedMemoryClose(sharedMemoryInfo *info) {
 #if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64)
   if (info->addr) {
@@ -139,9 +154,10 @@ int spawnProcess(Process *process, const char *app, char *const *args) {
 #else
   *process = fork();
   if (*process == 0) {
-    if (0 > execvp(app, args)) {
-      return errno;
-    }
+    execvp(app, args);
+    // only reached if exec failed; the child must not return into a copy
+    // of the parent
+    _exit(127);
   } else if (*process < 0) {
     return errno;
   }
@@ -163,8 +179,9 @@ int waitProcess(Process *process) {
     if (0 > waitpid(*process, &status, 0)) {
       return errno;
     }
-  } while (!WIFEXITED(status));
-  return WEXITSTATUS(status);
+  } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+  // a child killed by a signal reports 128 + the signal, as shells do
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
 #endif
 }
 
@@ -332,6 +349,56 @@ int ipcSendDataToServer(ipcHandle *handle, const char *serverName,
   return 0;
 }
 
+int ipcSendDataTo(ipcHandle *handle, const char *name, const void *data,
+                  size_t size) {
+  struct sockaddr_un addr;
+
+  bzero(&addr, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, name, sizeof(addr.sun_path) - 1);
+
+  ssize_t sendResult;
+  do {
+    sendResult = sendto(handle->socket, data, size, 0,
+                        (struct sockaddr *)&addr, sizeof(addr));
+  } while (sendResult < 0 && errno == EINTR);
+  if (sendResult != (ssize_t)size) {
+    return -1;
+  }
+  return 0;
+}
+
+int ipcRecvDataFrom(ipcHandle *handle, void *data, size_t size, char *sender,
+                    size_t senderSize) {
+  struct sockaddr_un addr;
+  socklen_t len = sizeof(addr);
+
+  bzero(&addr, sizeof(addr));
+  ssize_t readResult;
+  do {
+    readResult = recvfrom(handle->socket, data, size, MSG_TRUNC,
+                          (struct sockaddr *)&addr, &len);
+  } while (readResult < 0 && errno == EINTR);
+  if (readResult < 0) {
+    perror("IPC failure: Receiving data over socket failed");
+    return -1;
+  }
+
+  if (sender && senderSize > 0) {
+    // unnamed senders have an empty path
+    size_t pathLen = len > offsetof(struct sockaddr_un, sun_path)
+                         ? len - offsetof(struct sockaddr_un, sun_path)
+                         : 0;
+    pathLen = strnlen(addr.sun_path, pathLen);
+    if (pathLen > senderSize - 1) {
+      pathLen = senderSize - 1;
+    }
+    memcpy(sender, addr.sun_path, pathLen);
+    sender[pathLen] = '\0';
+  }
+  return (int)readResult;
+}
+
 int ipcSendShareableHandle(ipcHandle *handle,
                            const std::vector<ShareableHandle> &shareableHandles,
                            Process process, int data) {
@@ -70,6 +70,10 @@ int sharedMemoryOpen(const char *name, size_t sz, sharedMemoryInfo *info);
 
 void sharedMemoryClose(sharedMemoryInfo *info);
 
+// Remove the name of a shared memory object; mappings stay valid until
+// they are closed
+int sharedMemoryUnlink(const char *name);
+
 
 #if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64)
 typedef PROCESS_INFORMATION Process;
@@ -117,4 +121,17 @@ ipcSendShareableHandles(ipcHandle *handle, const std::vector<ShareableHandle>& s
 int
 ipcCloseShareableHandle(ShareableHandle shHandle);
 
+#if defined(__linux__)
+// Send one datagram to the socket bound to name. Returns 0 on success,
+// -1 on failure.
+int
+ipcSendDataTo(ipcHandle *handle, const char *name, const void *data, size_t size);
+
+// Receive the next datagram and the name of the socket it was sent from.
+// Returns the datagram size, which is larger than size if it was
+// truncated, or -1 on failure.
+int
+ipcRecvDataFrom(ipcHandle *handle, void *data, size_t size, char *sender, size_t senderSize);
+#endif
+
 #endif // HELPER_MULTIPROCESS_H
@@ -1,15 +1,210 @@
 #pragma once 
 
 #include "Config.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <map>
 #include <helper_string.h>
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 class ArgsParser
 {
 private:
     std::map<std::string, FilterType> filterMap_;
+    std::map<std::string, Backend> backendMap_;
+
+    // helper_string's getCmdLineArgument* match flag names by prefix, so
+    // --sigma would also pick up --sigma-spatial=10. These only accept an
+    // exact --name=value and throw if the flag was given without a value.
+    static const char *findArgumentValue(int argc, char *argv[], const char *name)
+    {
+        const char *value = nullptr;
+        const size_t length = strlen(name);
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *arg = argv[i] + stringRemoveDelimiter('-', argv[i]);
+            if (STRNCASECMP(arg, name, length) == 0 && arg[length] == '=')
+            {
+                value = arg + length + 1;
+            }
+        }
+        if (!value)
+        {
+            throw std::runtime_error(std::string("Missing value, use --") + name + "=<value>");
+        }
+        return value;
+    }
+
+    static bool getArgumentString(int argc, char *argv[], const char *name, char **value)
+    {
+        *value = const_cast<char *>(findArgumentValue(argc, argv, name));
+        return true;
+    }
+
+    static int getArgumentInt(int argc, char *argv[], const char *name)
+    {
+        return atoi(findArgumentValue(argc, argv, name));
+    }
+
+    static float getArgumentFloat(int argc, char *argv[], const char *name)
+    {
+        return static_cast<float>(atof(findArgumentValue(argc, argv, name)));
+    }
+
+    static std::string trim(const std::string &text)
+    {
+        const std::string::size_type begin = text.find_first_not_of(" \t");
+        if (begin == std::string::npos)
+        {
+            return std::string();
+        }
+        return text.substr(begin, text.find_last_not_of(" \t") - begin + 1);
+    }
+
+    // name(:key[=value])*, with defaults taken from the command line
+    ProcessingConfig parseStage(const std::string &token, const ProcessingConfig &defaults) const
+    {
+        std::vector<std::string> parts;
+        std::string::size_type begin = 0;
+        for (std::string::size_type colon; (colon = token.find(':', begin)) != std::string::npos; begin = colon + 1)
+        {
+            parts.push_back(trim(token.substr(begin, colon - begin)));
+        }
+        parts.push_back(trim(token.substr(begin)));
+
+        ProcessingConfig config = defaults;
+        config.pipeline.clear();
+
+        auto it = filterMap_.find(parts[0]);
+        if (it == filterMap_.end())
+        {
+            throw std::runtime_error("Unknown filter type in pipeline: " + parts[0]);
+        }
+        config.filterType = it->second;
+
+        for (size_t i = 1; i < parts.size(); ++i)
+        {
+            const std::string::size_type equals = parts[i].find('=');
+            const std::string key = trim(parts[i].substr(0, equals));
+            const std::string value = equals == std::string::npos ? std::string() : trim(parts[i].substr(equals + 1));
+
+            if (key == "exact" && value.empty())
+            {
+                config.bilateralExact = true;
+                continue;
+            }
+            if (value.empty())
+            {
+                throw std::runtime_error("Missing value for " + parts[0] + " parameter " + key);
+            }
+
+            if (key == "sigma")
+            {
+                config.sigma = static_cast<float>(atof(value.c_str()));
+            }
+            else if (key == "radius")
+            {
+                char *end = nullptr;
+                const long radius = strtol(value.c_str(), &end, 10);
+                if (*end != '\0' || radius < 0 || radius > INT_MAX)
+                {
+                    throw std::runtime_error("Radius must be a non-negative integer in pipeline stage: " + token);
+                }
+                config.filterRadius = static_cast<int>(radius);
+            }
+            else if (key == "sigma-spatial")
+            {
+                config.sigmaSpatial = static_cast<float>(atof(value.c_str()));
+            }
+            else if (key == "sigma-range")
+            {
+                config.sigmaRange = static_cast<float>(atof(value.c_str()));
+            }
+            else if (key == "threshold")
+            {
+                config.threshold = atoi(value.c_str());
+            }
+            else if (key == "norm" && (value == "l1" || value == "l2"))
+            {
+                config.magnitudeNorm = value == "l1" ? MagnitudeNorm::L1 : MagnitudeNorm::L2;
+            }
+            else
+            {
+                throw std::runtime_error("Unknown " + parts[0] + " parameter: " + parts[i]);
+            }
+        }
+
+        if (!(config.sigma > 0.0f) || !(config.sigmaSpatial > 0.0f) || !(config.sigmaRange > 0.0f))
+        {
+            throw std::runtime_error("Sigmas must be positive in pipeline stage: " + token);
+        }
+        if (config.threshold < 0 || config.threshold > 255)
+        {
+            throw std::runtime_error("Threshold must be between 0 and 255 in pipeline stage: " + token);
+        }
+        return config;
+    }
+
+    // Parse one chain starting at pos and append its stages, the first
+    // reading the output of stage parent
+    void parseChain(const std::string &spec, size_t &pos, int parent, const ProcessingConfig &defaults,
+                    std::vector<PipelineStage> &stages) const
+    {
+        while (true)
+        {
+            while (pos < spec.size() && (spec[pos] == ' ' || spec[pos] == '\t'))
+            {
+                ++pos;
+            }
+
+            if (pos < spec.size() && spec[pos] == '{')
+            {
+                // fan-out group; it ends the chain
+                do
+                {
+                    ++pos;
+                    parseChain(spec, pos, parent, defaults, stages);
+                } while (pos < spec.size() && spec[pos] == '|');
+
+                if (pos >= spec.size() || spec[pos] != '}')
+                {
+                    throw std::runtime_error("Missing '}' in pipeline: " + spec);
+                }
+                ++pos;
+                while (pos < spec.size() && (spec[pos] == ' ' || spec[pos] == '\t'))
+                {
+                    ++pos;
+                }
+                if (pos < spec.size() && spec[pos] == ',')
+                {
+                    throw std::runtime_error("A {...} group must be the last element of its chain: " + spec);
+                }
+                return;
+            }
+
+            const size_t end = std::min(spec.find_first_of(",|{}", pos), spec.size());
+            const std::string token = trim(spec.substr(pos, end - pos));
+            if (token.empty())
+            {
+                throw std::runtime_error("Empty stage in pipeline: " + spec);
+            }
+
+            stages.push_back({parent, parseStage(token, defaults)});
+            parent = static_cast<int>(stages.size()) - 1;
+            pos = end;
+
+            if (pos >= spec.size() || spec[pos] != ',')
+            {
+                return;
+            }
+            ++pos;
+        }
+    }
 
 public:
 
@@ -17,21 +212,156 @@ public:
     {
         filterMap_ = {
             {"sobel", FilterType::SOBEL_HORIZONTAL},
-            {"median", FilterType::MEDIAN}};
+            {"median", FilterType::MEDIAN},
+            {"gaussian", FilterType::GAUSSIAN_SMOOTH},
+            {"bilateral", FilterType::BILATERAL},
+            {"sobel-vert", FilterType::SOBEL_VERTICAL},
+            {"sobel-mag", FilterType::SOBEL_MAGNITUDE},
+            {"scharr-horiz", FilterType::SCHARR_HORIZONTAL},
+            {"scharr-vert", FilterType::SCHARR_VERTICAL},
+            {"scharr-mag", FilterType::SCHARR_MAGNITUDE},
+            {"threshold", FilterType::THRESHOLD}};
+
+        backendMap_ = {
+            {"auto", Backend::AUTO},
+            {"cpu", Backend::CPU},
+            {"npp", Backend::NPP}};
     }
 
     ProcessingConfig parseArguments(int argc, char *argv[])
     {
         ProcessingConfig config;
 
+        char *serveStr = nullptr;
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "serve"))
+        {
+            getArgumentString(argc, argv, "serve", &serveStr);
+            config.serveSocket = serveStr;
+        }
+
+        char *ringStr = nullptr;
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "input-ring"))
+        {
+            getArgumentString(argc, argv, "input-ring", &ringStr);
+            config.inputRing = ringStr;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "output-ring"))
+        {
+            getArgumentString(argc, argv, "output-ring", &ringStr);
+            config.outputRing = ringStr;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "ring-slots"))
+        {
+            config.ringSlots = getArgumentInt(argc, argv, "ring-slots");
+            if (config.ringSlots < 1)
+            {
+                throw std::runtime_error("--ring-slots must be positive");
+            }
+        }
+
+        // Batch inputs and outputs
+        char *batchStr = nullptr;
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "input-dir"))
+        {
+            getArgumentString(argc, argv, "input-dir", &batchStr);
+            config.inputDir = batchStr;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "file-list"))
+        {
+            getArgumentString(argc, argv, "file-list", &batchStr);
+            config.fileList = batchStr;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "glob"))
+        {
+            getArgumentString(argc, argv, "glob", &batchStr);
+            config.glob = batchStr;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "output-dir"))
+        {
+            getArgumentString(argc, argv, "output-dir", &batchStr);
+            config.outputDir = batchStr;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "workers"))
+        {
+            config.workers = getArgumentInt(argc, argv, "workers");
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "decode-threads"))
+        {
+            config.decodeThreads = getArgumentInt(argc, argv, "decode-threads");
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "encode-threads"))
+        {
+            config.encodeThreads = getArgumentInt(argc, argv, "encode-threads");
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "queue-depth"))
+        {
+            config.queueDepth = getArgumentInt(argc, argv, "queue-depth");
+        }
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "shards"))
+        {
+            config.shards = getArgumentInt(argc, argv, "shards");
+            if (config.shards < 1)
+            {
+                throw std::runtime_error("--shards must be positive");
+            }
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "shard-report"))
+        {
+            getArgumentString(argc, argv, "shard-report", &batchStr);
+            config.shardReport = batchStr;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "shard-index"))
+        {
+            config.shardIndex = getArgumentInt(argc, argv, "shard-index");
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "numa-node"))
+        {
+            config.numaNode = getArgumentInt(argc, argv, "numa-node");
+            if (config.numaNode < 0)
+            {
+                throw std::runtime_error("--numa-node must not be negative");
+            }
+        }
+
+        config.numa = checkCmdLineFlag(argc, const_cast<const char **>(argv), "numa");
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "tile-rows"))
+        {
+            config.tileRows = getArgumentInt(argc, argv, "tile-rows");
+            if (config.tileRows <= 0)
+            {
+                throw std::runtime_error("--tile-rows must be positive");
+            }
+        }
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "raw-size"))
+        {
+            char *rawSize = nullptr;
+            getArgumentString(argc, argv, "raw-size", &rawSize);
+            if (std::sscanf(rawSize, "%dx%d", &config.rawWidth, &config.rawHeight) != 2 ||
+                config.rawWidth <= 0 || config.rawHeight <= 0)
+            {
+                throw std::runtime_error("--raw-size must be <width>x<height>");
+            }
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "raw-channels"))
+        {
+            config.rawChannels = getArgumentInt(argc, argv, "raw-channels");
+            if (config.rawChannels != 1 && config.rawChannels != 3)
+            {
+                throw std::runtime_error("--raw-channels must be 1 or 3");
+            }
+        }
+
         // Set default input file
         char *inputImagePath = nullptr;
         if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "input"))
         {
-            getCmdLineArgumentString(argc, const_cast<const char **>(argv), "input", &inputImagePath);
+            getArgumentString(argc, argv, "input", &inputImagePath);
             config.inputFile = inputImagePath;
         }
-        else
+        else if (!config.batchMode() && !config.ringMode() && config.serveSocket.empty())
         {
             inputImagePath = sdkFindFilePath("sloth.png", argv[0]);
             if (inputImagePath)
@@ -48,15 +378,57 @@ public:
         char *outputImagePath = nullptr;
         if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "output"))
         {
-            getCmdLineArgumentString(argc, const_cast<const char **>(argv), "output", &outputImagePath);
+            getArgumentString(argc, argv, "output", &outputImagePath);
             config.outputFile = outputImagePath;
         }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "output-format"))
+        {
+            char *formatStr = nullptr;
+            getArgumentString(argc, argv, "output-format", &formatStr);
+            const std::string format = formatStr;
+            if (format.empty() || format.find_first_of("./") != std::string::npos)
+            {
+                throw std::runtime_error("--output-format must be a file extension such as png or qoi");
+            }
+            config.outputExtension = "." + format;
+        }
+
+        // --fast-encode first, so that explicit levels override it
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "fast-encode"))
+        {
+            config.pngLevel = 1;
+            config.jpegQuality = 75;
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "png-level"))
+        {
+            config.pngLevel = getArgumentInt(argc, argv, "png-level");
+            if (config.pngLevel < 0 || config.pngLevel > 9)
+            {
+                throw std::runtime_error("--png-level must be between 0 and 9");
+            }
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "jpeg-quality"))
+        {
+            config.jpegQuality = getArgumentInt(argc, argv, "jpeg-quality");
+            if (config.jpegQuality < 1 || config.jpegQuality > 100)
+            {
+                throw std::runtime_error("--jpeg-quality must be between 1 and 100");
+            }
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "png-threads"))
+        {
+            config.pngThreads = getArgumentInt(argc, argv, "png-threads");
+            if (config.pngThreads < 0)
+            {
+                throw std::runtime_error("--png-threads must not be negative");
+            }
+        }
 
         // Set filter type
         char *filterTypeStr = nullptr;
         if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "filter"))
         {
-            getCmdLineArgumentString(argc, const_cast<const char **>(argv), "filter", &filterTypeStr);
+            getArgumentString(argc, argv, "filter", &filterTypeStr);
             std::string filterName = filterTypeStr;
 
             auto it = filterMap_.find(filterName);
@@ -78,23 +450,199 @@ public:
 
         if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "radius"))
         {
-            config.filterRadius = getCmdLineArgumentInt(argc, const_cast<const char **>(argv), "radius");
+            config.filterRadius = getArgumentInt(argc, argv, "radius");
+        }
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "sigma"))
+        {
+            config.sigma = getArgumentFloat(argc, argv, "sigma");
+            if (!(config.sigma > 0.0f))
+            {
+                throw std::runtime_error("--sigma must be positive");
+            }
+        }
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "sigma-spatial"))
+        {
+            config.sigmaSpatial = getArgumentFloat(argc, argv, "sigma-spatial");
+            if (!(config.sigmaSpatial > 0.0f))
+            {
+                throw std::runtime_error("--sigma-spatial must be positive");
+            }
+        }
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "sigma-range"))
+        {
+            config.sigmaRange = getArgumentFloat(argc, argv, "sigma-range");
+            if (!(config.sigmaRange > 0.0f))
+            {
+                throw std::runtime_error("--sigma-range must be positive");
+            }
+        }
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "threshold"))
+        {
+            config.threshold = getArgumentInt(argc, argv, "threshold");
+            if (config.threshold < 0 || config.threshold > 255)
+            {
+                throw std::runtime_error("--threshold must be between 0 and 255");
+            }
+        }
+
+        config.bilateralExact = checkCmdLineFlag(argc, const_cast<const char **>(argv), "exact");
+        config.reportPsnr = checkCmdLineFlag(argc, const_cast<const char **>(argv), "psnr");
+
+        char *normStr = nullptr;
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "norm"))
+        {
+            getArgumentString(argc, argv, "norm", &normStr);
+            std::string normName = normStr;
+
+            if (normName == "l1")
+            {
+                config.magnitudeNorm = MagnitudeNorm::L1;
+            }
+            else if (normName == "l2")
+            {
+                config.magnitudeNorm = MagnitudeNorm::L2;
+            }
+            else
+            {
+                throw std::runtime_error("Unknown gradient norm: " + normName);
+            }
+        }
+
+        // Set execution backend
+        char *backendStr = nullptr;
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "backend"))
+        {
+            getArgumentString(argc, argv, "backend", &backendStr);
+            std::string backendName = backendStr;
+
+            auto it = backendMap_.find(backendName);
+            if (it != backendMap_.end())
+            {
+                config.backend = it->second;
+            }
+            else
+            {
+                throw std::runtime_error("Unknown backend: " + backendName);
+            }
+        }
+
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "threads"))
+        {
+            config.threads = getArgumentInt(argc, argv, "threads");
+        }
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "task-rows"))
+        {
+            config.taskRows = getArgumentInt(argc, argv, "task-rows");
+            if (config.taskRows < 0)
+            {
+                throw std::runtime_error("--task-rows must not be negative");
+            }
         }
 
         config.verbose = checkCmdLineFlag(argc, const_cast<const char **>(argv), "verbose");
+        config.fusion = !checkCmdLineFlag(argc, const_cast<const char **>(argv), "no-fusion");
+
+        char *pipelineStr = nullptr;
+        if (checkCmdLineFlag(argc, const_cast<const char **>(argv), "pipeline"))
+        {
+            getArgumentString(argc, argv, "pipeline", &pipelineStr);
+            config.pipeline = pipelineStr;
+        }
 
         return config;
     }
 
+    // Stages of config.pipeline in depth-first order, empty without one.
+    //
+    //   pipeline := element (',' element)*
+    //   element  := stage | '{' pipeline ('|' pipeline)* '}'
+    //   stage    := filter (':' key=value)*
+    //
+    // A {...} group fans out and must be the last element of its chain, so
+    // "gaussian:sigma=2,{sobel|median:radius=3,sobel-mag}" blurs once and
+    // writes a Sobel and a median + Sobel magnitude output. Keys are sigma,
+    // radius, sigma-spatial, sigma-range, threshold, norm and exact;
+    // parameters not given default to the command line values.
+    std::vector<PipelineStage> parsePipeline(const ProcessingConfig &config) const
+    {
+        std::vector<PipelineStage> stages;
+        if (config.pipeline.empty())
+        {
+            return stages;
+        }
+
+        size_t pos = 0;
+        parseChain(config.pipeline, pos, -1, config, stages);
+        if (pos != config.pipeline.size())
+        {
+            throw std::runtime_error("Unexpected '" + config.pipeline.substr(pos, 1) + "' in pipeline: " + config.pipeline);
+        }
+        return stages;
+    }
+
     void printUsage(const char *programName) const
     {
         std::cout << "Usage: " << programName << " [options]\n"
                   << "Options:\n"
-                  << "  --input <file>     Input image file path\n"
-                  << "  --output <file>    Output image file path (optional)\n"
-                  << "  --filter <type>    Filter type: sobel, median\n"
-                  << "  --radius <value>   Filter radius for median filter (default: 6)\n"
-                  << "  --verbose          Enable verbose output\n"
-                  << "  --help             Show this help message\n";
+                  << "  --input=<file>           Input image file path\n"
+                  << "  --output=<file>          Output image file path (optional)\n"
+                  << "  --output-format=<ext>    Extension of generated output names (default: png);\n"
+                  << "                           qoi is a fast lossless format for intermediate files\n"
+                  << "  --png-level=<0-9>        zlib level of PNG outputs (default: 9, smallest)\n"
+                  << "  --jpeg-quality=<1-100>   Quality of JPEG outputs (default: 90)\n"
+                  << "  --fast-encode            PNG level 1 and JPEG quality 75 unless given\n"
+                  << "  --png-threads=<value>    Threads deflating each PNG output, 1 = FreeImage encoder\n"
+                  << "                           (default: all cores from 4 megapixels, 1 in batch mode)\n"
+                  << "  --input-dir=<dir>        Batch mode: process every file in <dir> matching --glob\n"
+                  << "  --glob=<pattern>         File name pattern for --input-dir (default: *)\n"
+                  << "  --file-list=<file>       Batch mode: process the paths listed in <file>, one per line\n"
+                  << "  --output-dir=<dir>       Output directory (default: next to each input)\n"
+                  << "  --workers=<value>        Batch, server and ring mode filter threads (default: all cores)\n"
+                  << "  --decode-threads=<value> Batch mode decode threads (default: workers / 2)\n"
+                  << "  --encode-threads=<value> Encoder pool threads; outputs are encoded concurrently\n"
+                  << "                           (default: workers in batch mode, one per output otherwise)\n"
+                  << "  --queue-depth=<value>    Images queued between stages (default: 2 x workers)\n"
+                  << "  --shards=<value>         Batch mode: split the inputs across <value> child\n"
+                  << "                           processes, one NUMA node each in turn; failed children\n"
+                  << "                           are restarted on their unfinished inputs\n"
+                  << "  --numa-node=<value>      Run on the CPUs of one NUMA node only\n"
+                  << "  --numa                   Pin CPU threads per NUMA node; batch mode decodes, filters\n"
+                  << "                           and encodes each image on one node\n"
+                  << "  --serve=<socket>         Run as a server taking jobs from imageFilterClient over\n"
+                  << "                           a Unix socket, on --workers threads\n"
+                  << "  --input-ring=<name>      Filter the frames published into a shared-memory frame\n"
+                  << "                           ring (FrameRing.h), on --workers threads\n"
+                  << "  --output-ring=<name>     Frame ring the results are published into\n"
+                  << "  --ring-slots=<value>     Slots of the output ring (default: as the input ring)\n"
+                  << "  --tile-rows=<value>      Stream a binary PPM/PGM input in strips of <value> rows\n"
+                  << "                           and write a PPM, for images too large for memory\n"
+                  << "  --raw-size=<W>x<H>       Size of headerless .raw inputs (default: from names\n"
+                  << "                           like frame_1280x720_8u.raw)\n"
+                  << "  --raw-channels=<1|3>     Channels of .raw inputs (default: 1, 3 for *_8u_C3.raw)\n"
+                  << "  --filter=<type>          Filter type: sobel, sobel-vert, sobel-mag, scharr-horiz,\n"
+                  << "                           scharr-vert, scharr-mag, median, gaussian, bilateral,\n"
+                  << "                           threshold\n"
+                  << "  --pipeline=<spec>        Filter chain run in memory, e.g. gaussian:sigma=2,sobel\n"
+                  << "                           or gaussian,{sobel|median:radius=3} to fan out\n"
+                  << "  --no-fusion              Run every pipeline stage as a separate pass\n"
+                  << "  --radius=<value>         Filter radius for median filter (default: 6)\n"
+                  << "  --sigma=<value>          Standard deviation for gaussian filter (default: 5)\n"
+                  << "  --sigma-spatial=<value>  Bilateral spatial sigma in pixels (default: 10)\n"
+                  << "  --sigma-range=<value>    Bilateral range sigma in gray levels (default: 20)\n"
+                  << "  --threshold=<value>      Threshold filter level, 0-255 (default: 128)\n"
+                  << "  --exact                  Use the brute-force bilateral engine\n"
+                  << "  --psnr                   Report bilateral grid PSNR against the exact engine\n"
+                  << "  --norm=<l1|l2>           Norm for the *-mag filters (default: l2)\n"
+                  << "  --backend=<name>         Execution backend: cpu, npp, auto (default: auto)\n"
+                  << "  --threads=<value>        CPU backend threads, shared by all images (default: all\n"
+                  << "                           cores; batch mode filters each image on one unless given)\n"
+                  << "  --task-rows=<value>      Rows per CPU work-stealing task (default: about four\n"
+                  << "                           tasks per thread)\n"
+                  << "  --verbose                Enable verbose output\n"
+                  << "  --help                   Show this help message\n";
     }
 };
\ No newline at end of file
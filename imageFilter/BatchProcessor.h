@@ -0,0 +1,527 @@
+#pragma once
+
+#include "BoundedQueue.h"
+#include "Config.h"
+#include "EncoderPool.h"
+#include "FilterGraph.h"
+#include "ImageProcessor.h"
+#include "NumaTopology.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+// Runs one filter over many images in a single process, as a three-stage
+// pipeline:
+//
+//   decode threads -> [filter queue] -> filter workers -> [encode queue] -> encoder pool
+//
+// so that decoding image N+1 and encoding image N-1 overlap with filtering
+// image N. Every output of an image is a separate encoder pool task, so
+// the outputs of a fan-out pipeline are encoded concurrently too. Images
+// travel in jobs drawn from a fixed pool; a decoder waits for a free job
+// and a full queue blocks its producer, so the number of images in memory
+// stays bounded however long the batch is. A job is recycled once its last
+// output is written. Every filter worker owns a FilterGraph for the filter
+// or --pipeline, and with it its engines and intermediate buffers; the
+// engines split each image into tiles on the shared TaskScheduler. With
+// --numa the pipeline is split into one lane per NUMA node (see Lane).
+class BatchProcessor
+{
+public:
+    // Called once per input as soon as it is done, from a pipeline thread,
+    // with an empty error if every output was written
+    typedef std::function<void(const std::string &inputFile, const std::string &error)> ImageCallback;
+
+    // Totals of the last run()
+    struct Summary
+    {
+        size_t images;
+        size_t failed;
+        double seconds;
+        double busySeconds[3]; // decode, filter, encode
+    };
+
+private:
+    struct Failure
+    {
+        std::string inputFile;
+        std::string message;
+    };
+
+    struct Job
+    {
+        size_t index;
+        InputImage src;
+        std::vector<npp::ImageCPU_8u_C3> outputs;
+
+        // encoder pool bookkeeping: outputs not yet written, and the
+        // encode time and first error of those that are
+        std::atomic<size_t> pendingOutputs;
+        std::mutex encodeMutex;
+        double encodeSeconds;
+        std::string encodeError;
+    };
+
+    typedef std::unique_ptr<Job> JobPtr;
+
+    // A decode -> filter -> encode pipeline with its own jobs, queue and
+    // encoder pool. With --numa there is one per NUMA node and its threads
+    // are pinned to the node, so an image's buffers are first touched on
+    // the node that decodes, filters and encodes it, and recycled there.
+    struct Lane
+    {
+        int node; // -1 = not pinned
+        int decoders;
+        int workers;
+        int encoders;
+        int queueDepth;
+        std::vector<std::unique_ptr<FilterGraph>> graphs;
+        BoundedQueue<JobPtr> freeJobs;
+        BoundedQueue<JobPtr> filterQueue;
+        std::unique_ptr<EncoderPool> encoderPool;
+
+        Lane(int node, int decoders, int workers, int encoders, int queueDepth)
+            : node(node), decoders(decoders), workers(workers), encoders(encoders), queueDepth(queueDepth),
+              freeJobs(jobCount(decoders, workers, encoders, queueDepth)), filterQueue(queueDepth)
+        {
+            for (size_t i = 0; i < jobCount(decoders, workers, encoders, queueDepth); ++i)
+            {
+                JobPtr job(new Job());
+                freeJobs.push(job);
+            }
+        }
+
+        // enough jobs to keep every thread and queue slot busy, no more
+        static size_t jobCount(int decoders, int workers, int encoders, int queueDepth)
+        {
+            return decoders + workers + encoders + 2 * static_cast<size_t>(queueDepth);
+        }
+    };
+
+    ProcessingConfig config_;
+    std::vector<PipelineStage> stages_;
+    int workers_;
+    int decodeThreads_;
+    int encodeThreads_;
+    int queueDepth_;
+
+    std::mutex failuresMutex_;
+    std::vector<Failure> failures_;
+    ImageCallback onImageDone_;
+    Summary summary_;
+
+    void recordFailure(const std::string &inputFile, const std::string &message)
+    {
+        {
+            std::lock_guard<std::mutex> lock(failuresMutex_);
+            failures_.push_back({inputFile, message});
+        }
+        if (onImageDone_)
+        {
+            onImageDone_(inputFile, message);
+        }
+    }
+
+    // Run one stage of one image; exceptions become recorded failures
+    template <typename Func>
+    bool runStage(const std::string &inputFile, Func &&func)
+    {
+        std::string message;
+        try
+        {
+            func();
+            return true;
+        }
+        catch (const npp::Exception &e)
+        {
+            message = e.toString();
+        }
+        catch (const std::exception &e)
+        {
+            message = e.what();
+        }
+        catch (...)
+        {
+            message = "unknown error";
+        }
+
+        recordFailure(inputFile, message);
+        return false;
+    }
+
+    // Run count threads of body and call onLastExit once all have returned
+    template <typename Body, typename Exit>
+    static void startStage(std::vector<std::thread> &threads, int count, Body body, Exit onLastExit)
+    {
+        std::shared_ptr<std::atomic<int>> running(new std::atomic<int>(count));
+        for (int i = 0; i < count; ++i)
+        {
+            threads.emplace_back([body, onLastExit, running, i]() mutable {
+                body(i);
+                if (--*running == 0)
+                {
+                    onLastExit();
+                }
+            });
+        }
+    }
+
+    // Part i of total split into parts, at least 1
+    static int share(int total, int parts, int i)
+    {
+        return std::max(1, total / parts + (i < total % parts ? 1 : 0));
+    }
+
+    static bool isRegularFile(const std::string &path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+    }
+
+    static std::string joinPath(const std::string &dir, const std::string &name)
+    {
+        if (dir.empty() || name.empty() || name[0] == '/')
+        {
+            return name;
+        }
+        return dir.back() == '/' ? dir + name : dir + "/" + name;
+    }
+
+    // Files in --input-dir matching --glob, sorted so runs are reproducible
+    std::vector<std::string> listInputDir() const
+    {
+        DIR *dir = opendir(config_.inputDir.c_str());
+        if (!dir)
+        {
+            throw std::runtime_error("Cannot open input directory: " + config_.inputDir);
+        }
+
+        std::vector<std::string> files;
+        while (dirent *entry = readdir(dir))
+        {
+            const std::string name = entry->d_name;
+            if (name[0] == '.' || fnmatch(config_.glob.c_str(), name.c_str(), 0) != 0)
+            {
+                continue;
+            }
+            const std::string path = joinPath(config_.inputDir, name);
+            if (isRegularFile(path))
+            {
+                files.push_back(path);
+            }
+        }
+        closedir(dir);
+
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // One path per line; blank lines and lines starting with '#' are
+    // skipped, relative paths are taken relative to --input-dir if given
+    std::vector<std::string> readFileList() const
+    {
+        std::ifstream list(config_.fileList);
+        if (!list)
+        {
+            throw std::runtime_error("Cannot open file list: " + config_.fileList);
+        }
+
+        std::vector<std::string> files;
+        std::string line;
+        while (std::getline(list, line))
+        {
+            const std::string::size_type begin = line.find_first_not_of(" \t\r");
+            if (begin == std::string::npos || line[begin] == '#')
+            {
+                continue;
+            }
+            const std::string::size_type end = line.find_last_not_of(" \t\r");
+            files.push_back(joinPath(config_.inputDir, line.substr(begin, end - begin + 1)));
+        }
+        return files;
+    }
+
+public:
+    // stages is the parsed --pipeline, or empty to run config's filter
+    BatchProcessor(const ProcessingConfig &config, const std::vector<PipelineStage> &stages)
+        : config_(config), stages_(stages), workers_(resolveThreadCount(config.workers)),
+          decodeThreads_(config.decodeThreads > 0 ? config.decodeThreads : std::max(1, workers_ / 2)),
+          encodeThreads_(config.encodeThreads > 0 ? config.encodeThreads : workers_),
+          queueDepth_(config.queueDepth > 0 ? config.queueDepth : 2 * workers_), summary_()
+    {
+        // images are still split into tiles on the shared scheduler: a
+        // worker runs queued tiles while it waits for its own, and the pool
+        // threads take over the tiles of the last images once workers run
+        // out of inputs
+        if (config_.pngThreads == 0)
+        {
+            config_.pngThreads = 1;
+        }
+
+        if (stages_.empty())
+        {
+            stages_.push_back({-1, config_});
+        }
+    }
+
+    void setImageCallback(const ImageCallback &callback)
+    {
+        onImageDone_ = callback;
+    }
+
+    const Summary &summary() const
+    {
+        return summary_;
+    }
+
+    std::vector<std::string> inputFiles() const
+    {
+        return config_.fileList.empty() ? listInputDir() : readFileList();
+    }
+
+    // Process every input; returns the number of images that failed
+    int run()
+    {
+        const std::vector<std::string> files = inputFiles();
+        if (files.empty())
+        {
+            throw std::runtime_error("No input files found");
+        }
+
+        const int count = static_cast<int>(std::min<size_t>(files.size(), 1 << 30));
+        const int workers = std::min(workers_, count);
+        const int decoders = std::min(decodeThreads_, count);
+        const int encoders = std::min(encodeThreads_, count);
+
+        // one lane per NUMA node with --numa, each with its share of the
+        // threads and queue depth, otherwise a single unpinned lane
+        const std::vector<NumaNode> nodes = config_.numa ? allowedNumaNodes() : std::vector<NumaNode>();
+        const int laneCount = nodes.empty() ? 1 : std::min(static_cast<int>(nodes.size()), workers);
+        std::vector<std::unique_ptr<Lane>> lanes;
+        for (int i = 0; i < laneCount; ++i)
+        {
+            lanes.emplace_back(new Lane(nodes.empty() ? -1 : nodes[i].id, share(decoders, laneCount, i),
+                                        share(workers, laneCount, i), share(encoders, laneCount, i),
+                                        share(queueDepth_, laneCount, i)));
+        }
+
+        // graphs are created up front so configuration errors surface here
+        // rather than inside a worker
+        for (auto &lane : lanes)
+        {
+            for (int i = 0; i < lane->workers; ++i)
+            {
+                lane->graphs.emplace_back(new FilterGraph(stages_));
+            }
+        }
+
+        if (config_.verbose)
+        {
+            std::cout << "Batch of " << files.size() << " images: " << decoders << " decode, "
+                      << workers << " filter, " << encoders << " encode threads, queue depth "
+                      << queueDepth_ << std::endl;
+            for (const auto &lane : lanes)
+            {
+                if (lane->node >= 0)
+                {
+                    std::cout << "  NUMA node " << lane->node << ": " << lane->decoders << " decode, "
+                              << lane->workers << " filter, " << lane->encoders << " encode threads" << std::endl;
+                }
+            }
+        }
+
+        std::atomic<size_t> next(0);
+        std::mutex busyMutex;
+        double busySeconds[3] = {0.0, 0.0, 0.0};
+        size_t encodedImages = 0;
+        double maxEncodeSeconds = 0.0;
+
+        // time spent in a stage's work, excluding queue waits
+        auto timed = [](double &seconds, const std::function<void()> &func) {
+            const auto start = std::chrono::steady_clock::now();
+            func();
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+        auto addBusy = [&](int stage, double seconds) {
+            std::lock_guard<std::mutex> lock(busyMutex);
+            busySeconds[stage] += seconds;
+        };
+
+        // called by the encoder pool for every output; the last output of an
+        // image records the image's encode time and recycles its job
+        auto encoded = [&](Lane &lane, Job *pJob, const std::string &outputFile, double seconds,
+                           const std::string &error) {
+            if (config_.verbose && error.empty())
+            {
+                std::lock_guard<std::mutex> lock(busyMutex);
+                std::cout << "Saved " << outputFile << " (" << seconds * 1000.0 << " ms)" << std::endl;
+            }
+            {
+                std::lock_guard<std::mutex> lock(pJob->encodeMutex);
+                pJob->encodeSeconds += seconds;
+                if (pJob->encodeError.empty())
+                {
+                    pJob->encodeError = error;
+                }
+            }
+            if (--pJob->pendingOutputs > 0)
+            {
+                return;
+            }
+
+            JobPtr job(pJob);
+            if (job->encodeError.empty())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(busyMutex);
+                    busySeconds[2] += job->encodeSeconds;
+                    maxEncodeSeconds = std::max(maxEncodeSeconds, job->encodeSeconds);
+                    ++encodedImages;
+                }
+                if (onImageDone_)
+                {
+                    onImageDone_(files[job->index], std::string());
+                }
+            }
+            else
+            {
+                recordFailure(files[job->index], job->encodeError);
+            }
+            lane.freeJobs.push(job);
+        };
+
+        for (auto &lane : lanes)
+        {
+            lane->encoderPool.reset(new EncoderPool(lane->encoders, ImageProcessor::encodeOptions(config_),
+                                                    static_cast<size_t>(lane->queueDepth) *
+                                                        lane->graphs[0]->outputCount(),
+                                                    lane->node));
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+
+        for (size_t l = 0; l < lanes.size(); ++l)
+        {
+
+            startStage(threads, lanes[l]->decoders, [&, l](int) {
+                Lane &lane = *lanes[l];
+                tryPinToNumaNode(lane.node);
+                double seconds = 0.0;
+                JobPtr job;
+                for (size_t i = next++; i < files.size(); i = next++)
+                {
+                    lane.freeJobs.pop(job);
+                    job->index = i;
+                    bool decoded = false;
+                    timed(seconds, [&]() {
+                        decoded = runStage(files[i], [&]() { job->src.load(files[i], config_); });
+                    });
+                    if (decoded)
+                    {
+                        lane.filterQueue.push(job);
+                    }
+                    else
+                    {
+                        lane.freeJobs.push(job);
+                    }
+                }
+                addBusy(0, seconds);
+            }, [&, l]() { lanes[l]->filterQueue.close(); });
+
+            startStage(threads, lanes[l]->workers, [&, l](int worker) {
+                Lane &lane = *lanes[l];
+                tryPinToNumaNode(lane.node);
+                double seconds = 0.0;
+                JobPtr job;
+                while (lane.filterQueue.pop(job))
+                {
+                    bool filtered = false;
+                    timed(seconds, [&]() {
+                        filtered = runStage(files[job->index],
+                                            [&]() { lane.graphs[worker]->run(job->src.view(), job->outputs); });
+                    });
+                    if (filtered)
+                    {
+                        // from here on the job belongs to its outputs' encodes
+                        Job *pJob = job.release();
+                        pJob->pendingOutputs = pJob->outputs.size();
+                        pJob->encodeSeconds = 0.0;
+                        pJob->encodeError.clear();
+                        for (size_t k = 0; k < pJob->outputs.size(); ++k)
+                        {
+                            const std::string outputFile = lane.graphs[0]->outputFilename(files[pJob->index], k);
+                            lane.encoderPool->submit(outputFile, pJob->outputs[k],
+                                                     [&encoded, &lane, pJob, outputFile](double seconds,
+                                                                                         const std::string &error) {
+                                                         encoded(lane, pJob, outputFile, seconds, error);
+                                                     });
+                        }
+                    }
+                    else
+                    {
+                        lane.freeJobs.push(job);
+                    }
+                }
+                addBusy(1, seconds);
+            }, []() {});
+        }
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        int encoderThreads = 0;
+        for (auto &lane : lanes)
+        {
+            lane->encoderPool->wait();
+            encoderThreads += lane->encoderPool->threads();
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const size_t succeeded = files.size() - failures_.size();
+        summary_.images = files.size();
+        summary_.failed = failures_.size();
+        summary_.seconds = elapsed.count();
+        std::copy(busySeconds, busySeconds + 3, summary_.busySeconds);
+
+        std::cout << "Processed " << succeeded << " of " << files.size() << " images in "
+                  << elapsed.count() << " s (" << succeeded / elapsed.count() << " images/sec), "
+                  << failures_.size() << " failed" << std::endl;
+        std::cout << "Stage busy time: decode " << busySeconds[0] << " s, filter " << busySeconds[1]
+                  << " s, encode " << busySeconds[2] << " s" << std::endl;
+        if (encodedImages > 0)
+        {
+            std::cout << "Encode time per image: mean " << busySeconds[2] * 1000.0 / encodedImages << " ms, max "
+                      << maxEncodeSeconds * 1000.0 << " ms (" << encoderThreads << " encoder threads)"
+                      << std::endl;
+        }
+        if (config_.verbose)
+        {
+            const npp::ImagePoolStats pool = npp::ImagePool::instance().stats();
+            std::cout << "Image pool: " << pool.nHits << " hits, " << pool.nMisses << " misses, "
+                      << pool.nCachedBytes / double(1 << 20) << " MB cached" << std::endl;
+        }
+        for (const Failure &failure : failures_)
+        {
+            std::cerr << "  failed: " << failure.inputFile << ": " << failure.message << std::endl;
+        }
+
+        return static_cast<int>(failures_.size());
+    }
+};
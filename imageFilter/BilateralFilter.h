@@ -0,0 +1,308 @@
+#pragma once
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <npp.h>
+
+// Bilateral filter engines for 8-bit images with interleaved channels.
+// Each channel is filtered independently with the weight
+//     exp(-(dx^2 + dy^2) / (2 sigmaSpatial^2)) * exp(-dv^2 / (2 sigmaRange^2))
+// and borders are replicated.
+//
+// EXACT evaluates the sum directly over a window of radius
+// ceil(2 sigmaSpatial), so its cost grows with sigmaSpatial^2.
+//
+// GRID is the bilateral grid of Paris and Durand ("A Fast Approximation of
+// the Bilateral Filter using a Signal Processing Approach", 2006; Chen et
+// al. 2007). Pixels are splatted trilinearly into a 3D grid (x, y, value)
+// sampled every sigmaSpatial pixels and sigmaRange levels, the grid is
+// blurred with a [1 4 6 4 1] / 16 kernel (a Gaussian of one cell) along
+// each axis, and the result is sliced back out trilinearly. Grid size
+// shrinks as sigmaSpatial grows, so the cost per pixel is roughly constant.
+// For small sigmaSpatial the grid approaches the image size times the range
+// cells, so AUTO only picks it from kBilateralGridMinSigma upwards.
+
+enum class BilateralEngine
+{
+    AUTO,
+    EXACT,
+    GRID
+};
+
+const float kBilateralGridMinSigma = 3.0f;
+
+inline BilateralEngine selectBilateralEngine(float sigmaSpatial, BilateralEngine requested = BilateralEngine::AUTO)
+{
+    if (requested != BilateralEngine::AUTO)
+    {
+        return requested;
+    }
+    return sigmaSpatial < kBilateralGridMinSigma ? BilateralEngine::EXACT : BilateralEngine::GRID;
+}
+
+class BilateralFilter
+{
+private:
+    float sigmaSpatial_;
+    float sigmaRange_;
+
+    static int clampIndex(int value, int size)
+    {
+        return value < 0 ? 0 : (value >= size ? size - 1 : value);
+    }
+
+    static Npp8u roundTo8u(float value)
+    {
+        const int rounded = static_cast<int>(value + 0.5f);
+        return static_cast<Npp8u>(rounded < 0 ? 0 : (rounded > 255 ? 255 : rounded));
+    }
+
+    // Grid cells are (weighted value sum, weight) pairs, laid out [y][x][z]
+    struct Grid
+    {
+        int width;
+        int height;
+        int depth;
+        std::vector<float> cells;
+
+        float *at(int x, int y, int z)
+        {
+            return &cells[((static_cast<size_t>(y) * width + x) * depth + z) * 2];
+        }
+    };
+
+    // cells of padding on each side so the blur and the +1 neighbour of the
+    // trilinear weights never leave the grid
+    static const int kGridPadding = 2;
+
+    // Blur count cells spaced stride floats apart with [1 4 6 4 1] / 16;
+    // the padding cells are zero, i.e. the grid is zero-extended.
+    static void blurLine(float *pCells, int count, size_t stride, std::vector<float> &line)
+    {
+        line.assign(static_cast<size_t>(count + 4) * 2, 0.0f);
+        for (int i = 0; i < count; ++i)
+        {
+            line[(i + 2) * 2] = pCells[i * stride];
+            line[(i + 2) * 2 + 1] = pCells[i * stride + 1];
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            const float *p = &line[i * 2];
+            pCells[i * stride] = (p[0] + 4.0f * p[2] + 6.0f * p[4] + 4.0f * p[6] + p[8]) * (1.0f / 16.0f);
+            pCells[i * stride + 1] = (p[1] + 4.0f * p[3] + 6.0f * p[5] + 4.0f * p[7] + p[9]) * (1.0f / 16.0f);
+        }
+    }
+
+    // Trilinear weights of a grid position; returns the base cell index
+    static int splitCoordinate(float position, float &fraction)
+    {
+        const int base = static_cast<int>(position);
+        fraction = position - base;
+        return base;
+    }
+
+    template <int N>
+    static void splatRow(Grid &grid, const Npp8u *pRow, int c, int y, int width,
+                         float spatialScale, float rangeScale)
+    {
+        float fy;
+        const int gy = splitCoordinate(y * spatialScale, fy) + kGridPadding;
+        for (int x = 0; x < width; ++x)
+        {
+            const float value = pRow[x * N + c];
+            float fx;
+            float fz;
+            const int gx = splitCoordinate(x * spatialScale, fx) + kGridPadding;
+            const int gz = splitCoordinate(value * rangeScale, fz) + kGridPadding;
+
+            for (int k = 0; k < 8; ++k)
+            {
+                const int dx = k & 1;
+                const int dy = (k >> 1) & 1;
+                const int dz = (k >> 2) & 1;
+                const float w = (dx ? fx : 1.0f - fx) * (dy ? fy : 1.0f - fy) * (dz ? fz : 1.0f - fz);
+                float *pCell = grid.at(gx + dx, gy + dy, gz + dz);
+                pCell[0] += w * value;
+                pCell[1] += w;
+            }
+        }
+    }
+
+    template <int N>
+    static void sliceRow(Grid &grid, const Npp8u *pRow, Npp8u *pOut, int c, int y, int width,
+                         float spatialScale, float rangeScale)
+    {
+        float fy;
+        const int gy = splitCoordinate(y * spatialScale, fy) + kGridPadding;
+        for (int x = 0; x < width; ++x)
+        {
+            const int value = pRow[x * N + c];
+            float fx;
+            float fz;
+            const int gx = splitCoordinate(x * spatialScale, fx) + kGridPadding;
+            const int gz = splitCoordinate(value * rangeScale, fz) + kGridPadding;
+
+            float sum = 0.0f;
+            float weight = 0.0f;
+            for (int k = 0; k < 8; ++k)
+            {
+                const int dx = k & 1;
+                const int dy = (k >> 1) & 1;
+                const int dz = (k >> 2) & 1;
+                const float w = (dx ? fx : 1.0f - fx) * (dy ? fy : 1.0f - fy) * (dz ? fz : 1.0f - fz);
+                const float *pCell = grid.at(gx + dx, gy + dy, gz + dz);
+                sum += w * pCell[0];
+                weight += w * pCell[1];
+            }
+            pOut[x * N + c] = weight > 0.0f ? roundTo8u(sum / weight) : static_cast<Npp8u>(value);
+        }
+    }
+
+public:
+    BilateralFilter(float sigmaSpatial, float sigmaRange)
+        : sigmaSpatial_(sigmaSpatial), sigmaRange_(sigmaRange)
+    {
+    }
+
+    // Brute-force rows [rowBegin, rowEnd); pDst addresses output row rowBegin
+    template <int N>
+    void exactRows(const Npp8u *pSrc, int nSrcPitch, Npp8u *pDst, int nDstPitch,
+                   int width, int height, int rowBegin, int rowEnd) const
+    {
+        const int radius = std::max(1, static_cast<int>(std::ceil(2.0f * sigmaSpatial_)));
+        const int side = 2 * radius + 1;
+
+        std::vector<float> spatial(side * side);
+        for (int dy = -radius; dy <= radius; ++dy)
+        {
+            for (int dx = -radius; dx <= radius; ++dx)
+            {
+                spatial[(dy + radius) * side + dx + radius] =
+                    std::exp(-(dx * dx + dy * dy) / (2.0f * sigmaSpatial_ * sigmaSpatial_));
+            }
+        }
+
+        float range[256];
+        for (int d = 0; d < 256; ++d)
+        {
+            range[d] = std::exp(-(d * d) / (2.0f * sigmaRange_ * sigmaRange_));
+        }
+
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            Npp8u *pOut = pDst + (y - rowBegin) * nDstPitch;
+            for (int x = 0; x < width; ++x)
+            {
+                for (int c = 0; c < N; ++c)
+                {
+                    const int center = pSrc[y * nSrcPitch + x * N + c];
+                    float sum = 0.0f;
+                    float weight = 0.0f;
+                    for (int dy = -radius; dy <= radius; ++dy)
+                    {
+                        const Npp8u *pRow = pSrc + clampIndex(y + dy, height) * nSrcPitch;
+                        const float *pSpatial = &spatial[(dy + radius) * side + radius];
+                        for (int dx = -radius; dx <= radius; ++dx)
+                        {
+                            const int value = pRow[clampIndex(x + dx, width) * N + c];
+                            const float w = pSpatial[dx] * range[std::abs(value - center)];
+                            sum += w * value;
+                            weight += w;
+                        }
+                    }
+                    pOut[x * N + c] = roundTo8u(sum / weight);
+                }
+            }
+        }
+    }
+
+    // Whole-image bilateral grid; the stages are split across threads
+    template <int N>
+    void gridFilter(const Npp8u *pSrc, int nSrcPitch, Npp8u *pDst, int nDstPitch,
+                    int width, int height, int threads) const
+    {
+        const float spatialScale = 1.0f / sigmaSpatial_;
+        const float rangeScale = 1.0f / sigmaRange_;
+
+        Grid grid;
+        grid.width = static_cast<int>((width - 1) * spatialScale) + 1 + 2 * kGridPadding;
+        grid.height = static_cast<int>((height - 1) * spatialScale) + 1 + 2 * kGridPadding;
+        grid.depth = static_cast<int>(255 * rangeScale) + 1 + 2 * kGridPadding;
+
+        for (int c = 0; c < N; ++c)
+        {
+            grid.cells.assign(static_cast<size_t>(grid.width) * grid.height * grid.depth * 2, 0.0f);
+
+            // Splat. A pixel row touches two grid rows, so the rows are cut
+            // into bands of whole grid rows that are splatted in two phases
+            // (even bands, then odd bands) and never write the same cells
+            // concurrently.
+            const int gridRows = grid.height - 2 * kGridPadding;
+            const int bandRows = std::max(2, (gridRows + 2 * threads - 1) / (2 * threads));
+            const int bands = (gridRows + bandRows - 1) / bandRows;
+            std::vector<int> bandStart(bands + 1, height);
+            for (int y = height - 1; y >= 0; --y)
+            {
+                float fraction;
+                bandStart[splitCoordinate(y * spatialScale, fraction) / bandRows] = y;
+            }
+            for (int band = bands - 1; band >= 0; --band)
+            {
+                bandStart[band] = std::min(bandStart[band], bandStart[band + 1]);
+            }
+
+            for (int phase = 0; phase < 2; ++phase)
+            {
+                parallelForRows((bands - phase + 1) / 2, threads, [&](int first, int last) {
+                    for (int b = first; b < last; ++b)
+                    {
+                        const int band = 2 * b + phase;
+                        for (int y = bandStart[band]; y < bandStart[band + 1]; ++y)
+                        {
+                            splatRow<N>(grid, pSrc + y * nSrcPitch, c, y, width, spatialScale, rangeScale);
+                        }
+                    }
+                });
+            }
+
+            // blur along z, x and y
+            parallelForRows(grid.height, threads, [&](int gyBegin, int gyEnd) {
+                std::vector<float> line;
+                for (int gy = gyBegin; gy < gyEnd; ++gy)
+                {
+                    for (int gx = 0; gx < grid.width; ++gx)
+                    {
+                        blurLine(grid.at(gx, gy, 0), grid.depth, 2, line);
+                    }
+                    for (int gz = 0; gz < grid.depth; ++gz)
+                    {
+                        blurLine(grid.at(0, gy, gz), grid.width, static_cast<size_t>(grid.depth) * 2, line);
+                    }
+                }
+            });
+            parallelForRows(grid.width, threads, [&](int gxBegin, int gxEnd) {
+                std::vector<float> line;
+                for (int gx = gxBegin; gx < gxEnd; ++gx)
+                {
+                    for (int gz = 0; gz < grid.depth; ++gz)
+                    {
+                        blurLine(grid.at(gx, 0, gz), grid.height, static_cast<size_t>(grid.width) * grid.depth * 2, line);
+                    }
+                }
+            });
+
+            // slice
+            parallelForRows(height, threads, [&](int rowBegin, int rowEnd) {
+                for (int y = rowBegin; y < rowEnd; ++y)
+                {
+                    sliceRow<N>(grid, pSrc + y * nSrcPitch, pDst + y * nDstPitch, c, y, width,
+                                spatialScale, rangeScale);
+                }
+            });
+        }
+    }
+};
@@ -8,9 +8,28 @@ enum class FilterType
     MEDIAN,
     GAUSSIAN_SMOOTH,
     BILATERAL,
+    SOBEL_VERTICAL,
+    SOBEL_MAGNITUDE,
+    SCHARR_HORIZONTAL,
+    SCHARR_VERTICAL,
+    SCHARR_MAGNITUDE,
+    THRESHOLD,
     UNKNOWN
 };
 
+enum class MagnitudeNorm
+{
+    L1,
+    L2
+};
+
+enum class Backend
+{
+    AUTO,
+    CPU,
+    NPP
+};
+
 struct ProcessingConfig
 {
     std::string inputFile;
@@ -20,5 +39,97 @@ struct ProcessingConfig
     int filterRadius = 6;
     float sigmaSpatial = 10.0f;
     float sigmaRange = 20.0f;
+    int threshold = 128;         // THRESHOLD: values above it become 255, the rest 0
+    bool bilateralExact = false; // brute force instead of the bilateral grid
+    bool reportPsnr = false;     // compare the bilateral grid with the exact engine
+    MagnitudeNorm magnitudeNorm = MagnitudeNorm::L2;
+    Backend backend = Backend::AUTO;
+    int threads = 0;  // 0 = one per allowed CPU
+    int taskRows = 0; // rows per scheduler task, 0 = about four tasks per thread
     bool verbose = false;
-};
\ No newline at end of file
+    bool fusion = true; // fuse adjacent --pipeline stages into single passes
+
+    // Batch mode: the inputs come from a directory and/or a list file
+    std::string inputDir;
+    std::string outputDir;
+    std::string glob = "*";
+    std::string fileList;
+    int workers = 0;       // filter threads, 0 = one per allowed CPU
+    int decodeThreads = 0; // 0 = half the workers
+    int encodeThreads = 0; // 0 = as many as workers
+    int queueDepth = 0;    // images between stages, 0 = twice the workers
+
+    // Headerless .raw inputs; 0 = take the geometry from the file name
+    int rawWidth = 0;
+    int rawHeight = 0;
+    int rawChannels = 0;
+
+    // Tiled mode: stream the image in strips of this many rows, 0 = off
+    int tileRows = 0;
+
+    // Extension of generated output names (--output-format); .qoi files
+    // are written by the built-in QOI encoder
+    std::string outputExtension = ".png";
+
+    // Encoder effort: zlib level for PNG outputs (0-9) and JPEG quality
+    // (1-100); --fast-encode lowers both unless they are given
+    int pngLevel = 9;
+    int jpegQuality = 90;
+
+    // Threads deflating one PNG output: 1 = FreeImage's encoder, 0 = every
+    // core for outputs of 4 megapixels and more (1 in batch mode)
+    int pngThreads = 0;
+
+    // Filter chain, e.g. "gaussian:sigma=2,sobel"; see ArgsParser::parsePipeline
+    std::string pipeline;
+
+    // --serve mode: Unix socket the job server listens on; set in the
+    // configs of the jobs it runs too
+    std::string serveSocket;
+
+    // Shared-memory mode: frames come from one FrameRing and results go to
+    // another; ringSlots sizes the output ring, 0 = as the input ring
+    std::string inputRing;
+    std::string outputRing;
+    int ringSlots = 0;
+
+    // Sharded batch mode: split the batch across this many child
+    // processes, each pinned to a NUMA node (ShardProcessor.h); 0 = off.
+    // The children get the socket they report progress to and their shard.
+    int shards = 0;
+    std::string shardReport;
+    int shardIndex = 0;
+
+    // Pin the process to the CPUs of this NUMA node, -1 = don't
+    int numaNode = -1;
+
+    // NUMA-aware placement (--numa): batch mode runs a pipeline per node
+    // and the scheduler pins its threads per node
+    bool numa = false;
+
+    bool batchMode() const
+    {
+        return !inputDir.empty() || !fileList.empty();
+    }
+
+    bool ringMode() const
+    {
+        return !inputRing.empty() || !outputRing.empty();
+    }
+
+    // Whether other images share this process and its CUDA context, which
+    // an error must then leave alone
+    bool sharedProcess() const
+    {
+        return batchMode() || ringMode() || !serveSocket.empty();
+    }
+};
+
+// One filter of a --pipeline. Stages are stored in depth-first order and
+// each reads the output of stage parent, or the decoded input if parent
+// is -1; a stage with several children fans out.
+struct PipelineStage
+{
+    int parent;
+    ProcessingConfig config;
+};
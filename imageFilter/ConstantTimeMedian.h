@@ -0,0 +1,174 @@
+#pragma once
+
+#include "Threshold.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <npp.h>
+
+// Constant-time median filter for 8-bit images (Perreault & Hebert, "Median
+// Filtering in Constant Time", 2007).
+//
+// Every image column keeps a histogram of the maskHeight pixels above it;
+// sliding down one row only removes one pixel from and adds one pixel to
+// each column histogram. The kernel histogram is the sum of maskWidth
+// column histograms and is slid along the row by subtracting the column
+// that leaves and adding the column that enters. Histograms are split into
+// 16 coarse and 256 fine bins; the kernel's fine bins are only brought up
+// to date for the coarse bucket that contains the median, so the work per
+// pixel does not depend on the mask size.
+//
+// Window placement and border handling match CpuFilterEngine's median:
+// the mask is positioned by (anchorX, anchorY) and out-of-image pixels are
+// replicated from the nearest edge. Replication is done by clamping column
+// and row indices, so an edge column histogram is simply counted multiple
+// times. pDst addresses output row rowBegin; epilogue is applied to every
+// finished output row.
+template <int N, typename Epilogue = NoRowEpilogue>
+void constantTimeMedianRows(const Npp8u *pSrc, int nSrcPitch, Npp8u *pDst, int nDstPitch,
+                            int width, int height, int maskWidth, int maskHeight,
+                            int anchorX, int anchorY, int rowBegin, int rowEnd,
+                            Epilogue epilogue = Epilogue())
+{
+    auto clampIndex = [](int value, int size) {
+        return value < 0 ? 0 : (value >= size ? size - 1 : value);
+    };
+
+    const int rank = (maskWidth * maskHeight) / 2;
+
+    // column histograms, one set per channel: [channel][column][bin]
+    std::vector<uint16_t> colCoarse(static_cast<size_t>(N) * width * 16, 0);
+    std::vector<uint16_t> colFine(static_cast<size_t>(N) * width * 256, 0);
+
+    auto updateColumns = [&](const Npp8u *pRow, int delta) {
+        for (int x = 0; x < width; ++x)
+        {
+            for (int c = 0; c < N; ++c)
+            {
+                const int v = pRow[x * N + c];
+                const size_t column = static_cast<size_t>(c) * width + x;
+                colCoarse[column * 16 + (v >> 4)] += delta;
+                colFine[column * 256 + v] += delta;
+            }
+        }
+    };
+
+    for (int k = 0; k < maskHeight; ++k)
+    {
+        updateColumns(pSrc + clampIndex(rowBegin - anchorY + k, height) * nSrcPitch, 1);
+    }
+
+    uint16_t kernelCoarse[16];
+    uint16_t kernelFine[16][16];
+    int lastUpdated[16];
+
+    for (int y = rowBegin; y < rowEnd; ++y)
+    {
+        if (y > rowBegin)
+        {
+            const int rowOut = clampIndex(y - 1 - anchorY, height);
+            const int rowIn = clampIndex(y - anchorY + maskHeight - 1, height);
+            if (rowOut != rowIn)
+            {
+                updateColumns(pSrc + rowOut * nSrcPitch, -1);
+                updateColumns(pSrc + rowIn * nSrcPitch, 1);
+            }
+        }
+
+        Npp8u *pOut = pDst + (y - rowBegin) * nDstPitch;
+
+        for (int c = 0; c < N; ++c)
+        {
+            const uint16_t *pCoarse = &colCoarse[static_cast<size_t>(c) * width * 16];
+            const uint16_t *pFine = &colFine[static_cast<size_t>(c) * width * 256];
+
+            std::memset(kernelCoarse, 0, sizeof(kernelCoarse));
+            for (int dx = 0; dx < maskWidth; ++dx)
+            {
+                const uint16_t *pColumn = pCoarse + clampIndex(dx - anchorX, width) * 16;
+                for (int b = 0; b < 16; ++b)
+                {
+                    kernelCoarse[b] += pColumn[b];
+                }
+            }
+            std::fill(lastUpdated, lastUpdated + 16, INT_MIN / 2);
+
+            for (int x = 0; x < width; ++x)
+            {
+                if (x > 0)
+                {
+                    const int colOut = clampIndex(x - 1 - anchorX, width);
+                    const int colIn = clampIndex(x - anchorX + maskWidth - 1, width);
+                    if (colOut != colIn)
+                    {
+                        const uint16_t *pOutColumn = pCoarse + colOut * 16;
+                        const uint16_t *pInColumn = pCoarse + colIn * 16;
+                        for (int b = 0; b < 16; ++b)
+                        {
+                            kernelCoarse[b] += pInColumn[b] - pOutColumn[b];
+                        }
+                    }
+                }
+
+                // locate the coarse bucket holding the median
+                int count = 0;
+                int bucket = 0;
+                while (count + kernelCoarse[bucket] <= rank)
+                {
+                    count += kernelCoarse[bucket];
+                    ++bucket;
+                }
+
+                // bring that bucket's fine bins up to date with column x,
+                // either by sliding or by rebuilding when that is cheaper
+                uint16_t *pKernelFine = kernelFine[bucket];
+                const int behind = x - lastUpdated[bucket];
+                if (behind >= (maskWidth + 1) / 2)
+                {
+                    std::memset(pKernelFine, 0, 16 * sizeof(uint16_t));
+                    for (int dx = 0; dx < maskWidth; ++dx)
+                    {
+                        const uint16_t *pColumn = pFine + clampIndex(x - anchorX + dx, width) * 256 + bucket * 16;
+                        for (int b = 0; b < 16; ++b)
+                        {
+                            pKernelFine[b] += pColumn[b];
+                        }
+                    }
+                }
+                else
+                {
+                    for (int t = lastUpdated[bucket] + 1; t <= x; ++t)
+                    {
+                        const int colOut = clampIndex(t - 1 - anchorX, width);
+                        const int colIn = clampIndex(t - anchorX + maskWidth - 1, width);
+                        if (colOut == colIn)
+                        {
+                            continue;
+                        }
+                        const uint16_t *pOutColumn = pFine + colOut * 256 + bucket * 16;
+                        const uint16_t *pInColumn = pFine + colIn * 256 + bucket * 16;
+                        for (int b = 0; b < 16; ++b)
+                        {
+                            pKernelFine[b] += pInColumn[b] - pOutColumn[b];
+                        }
+                    }
+                }
+                lastUpdated[bucket] = x;
+
+                int bin = 0;
+                while (count + pKernelFine[bin] <= rank)
+                {
+                    count += pKernelFine[bin];
+                    ++bin;
+                }
+
+                pOut[x * N + c] = static_cast<Npp8u>(bucket * 16 + bin);
+            }
+        }
+        epilogue(pOut, width * N);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// Runtime CPU feature detection for the SIMD kernels. Kernels are compiled
+// with per-function target attributes, so the binary runs on any x86-64 CPU
+// and only the paths the host supports are ever called.
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGEFILTER_X86_SIMD 1
+#include <immintrin.h>
+#define IMAGEFILTER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define IMAGEFILTER_X86_SIMD 0
+#define IMAGEFILTER_TARGET(isa)
+#endif
+
+enum class SimdLevel
+{
+    SCALAR,
+    SSE41,
+    AVX2
+};
+
+inline SimdLevel detectSimdLevel()
+{
+#if IMAGEFILTER_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        return SimdLevel::SSE41;
+    }
+#endif
+    return SimdLevel::SCALAR;
+}
+
+// Highest SIMD level supported by this CPU, detected once.
+inline SimdLevel simdLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+inline const char *simdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::SSE41:
+        return "SSE4.1";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,396 @@
+#pragma once
+
+#include "BilateralFilter.h"
+#include "ConstantTimeMedian.h"
+#include "GaussianFilter.h"
+#include "ParallelFor.h"
+#include "PlanarLayout.h"
+#include "SobelKernels.h"
+#include "Threshold.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <ImagesCPU.h>
+
+enum class MedianEngine
+{
+    AUTO,
+    HUANG,         // sliding histogram, O(maskHeight) per pixel
+    CONSTANT_TIME  // per-column histograms, O(1) per pixel
+};
+
+// Multithreaded CPU implementations of the imageFilter filters. Results
+// follow the border semantics of the NPP calls used by the NPP backend so
+// that both backends can be used interchangeably.
+class CpuFilterEngine
+{
+private:
+    int threads_;
+
+    static int clampIndex(int value, int size)
+    {
+        return value < 0 ? 0 : (value >= size ? size - 1 : value);
+    }
+
+    // Median over a maskWidth x maskHeight window positioned by anchor, the
+    // same window placement as nppiFilterMedian_8u_C*R. NPP leaves pixels
+    // outside the source undefined; here they are replicated from the edge.
+    // Each row keeps one 256-bin histogram per channel that is slid along
+    // the row (Huang's algorithm), so the cost per pixel is O(maskHeight).
+    // pDst addresses output row rowBegin.
+    template <int N, typename Epilogue>
+    static void medianRows(const Npp8u *pSrc, int nSrcPitch, Npp8u *pDst, int nDstPitch,
+                           int width, int height, int maskWidth, int maskHeight,
+                           int anchorX, int anchorY, int rowBegin, int rowEnd, Epilogue epilogue)
+    {
+        const int rank = (maskWidth * maskHeight) / 2;
+        std::vector<int> histogram(256 * N);
+        std::vector<const Npp8u *> rows(maskHeight);
+
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            for (int k = 0; k < maskHeight; ++k)
+            {
+                rows[k] = pSrc + clampIndex(y - anchorY + k, height) * nSrcPitch;
+            }
+
+            std::fill(histogram.begin(), histogram.end(), 0);
+            for (int dx = 0; dx < maskWidth; ++dx)
+            {
+                const int xs = clampIndex(dx - anchorX, width) * N;
+                for (int k = 0; k < maskHeight; ++k)
+                {
+                    for (int c = 0; c < N; ++c)
+                    {
+                        ++histogram[c * 256 + rows[k][xs + c]];
+                    }
+                }
+            }
+
+            Npp8u *pOut = pDst + (y - rowBegin) * nDstPitch;
+            for (int x = 0; x < width; ++x)
+            {
+                if (x > 0)
+                {
+                    const int xOut = clampIndex(x - 1 - anchorX, width) * N;
+                    const int xIn = clampIndex(x - anchorX + maskWidth - 1, width) * N;
+                    for (int k = 0; k < maskHeight; ++k)
+                    {
+                        for (int c = 0; c < N; ++c)
+                        {
+                            --histogram[c * 256 + rows[k][xOut + c]];
+                            ++histogram[c * 256 + rows[k][xIn + c]];
+                        }
+                    }
+                }
+
+                for (int c = 0; c < N; ++c)
+                {
+                    const int *pBins = &histogram[c * 256];
+                    int count = 0;
+                    int value = 0;
+                    while ((count += pBins[value]) <= rank)
+                    {
+                        ++value;
+                    }
+                    pOut[x * N + c] = static_cast<Npp8u>(value);
+                }
+            }
+            epilogue(pOut, width * N);
+        }
+    }
+
+    // Sources and destinations may be images or views (npp::ImageView) of
+    // any part of one, and a destination view may be a temporary; the
+    // destination must already have the source's size
+    template <class SrcImage, class DstImage>
+    static void checkSizes(const SrcImage &src, const DstImage &dst)
+    {
+        if (dst.width() != src.width() || dst.height() != src.height())
+        {
+            throw std::runtime_error("Destination size differs from the source");
+        }
+    }
+
+    template <class SrcImage, class DstImage>
+    static void checkShapes(const SrcImage &src, const DstImage &dst)
+    {
+        static_assert(SrcImage::gnChannels == DstImage::gnChannels, "Source and destination channel counts differ");
+        checkSizes(src, dst);
+    }
+
+public:
+    explicit CpuFilterEngine(int threads = 0) : threads_(resolveThreadCount(threads)) {}
+
+    int threads() const
+    {
+        return threads_;
+    }
+
+    // Sobel or Scharr gradient; see SobelKernels.h for the modes
+    template <class SrcImage, class DstImage, typename Epilogue = NoRowEpilogue>
+    void gradient(const SrcImage &src, DstImage &&dst, GradientOperator op, GradientMode mode,
+                  Epilogue epilogue = Epilogue()) const
+    {
+        checkShapes(src, dst);
+        const int width = static_cast<int>(src.width());
+        const int height = static_cast<int>(src.height());
+        const SimdLevel level = simdLevel();
+
+        parallelForRows(height, threads_, [&](int rowBegin, int rowEnd) {
+            gradientRows(src.data(), src.pitch(), dst.data(0, rowBegin), dst.pitch(),
+                         width, height, SrcImage::gnChannels, rowBegin, rowEnd, op, mode, level, epilogue);
+        });
+    }
+
+    // Gaussian smoothing followed by a gradient in a single pass. Each band
+    // of rows keeps the three most recent smoothed rows in a ring and feeds
+    // them straight to the gradient kernel, so the smoothed image is never
+    // written out. The smoothing is the separable engine's, and the result
+    // is bit-exact with gaussian() followed by gradient() whenever gaussian()
+    // picks that engine.
+    template <class SrcImage, class DstImage, typename Epilogue = NoRowEpilogue>
+    void gaussianGradient(const SrcImage &src, DstImage &&dst, float sigma, GradientOperator op, GradientMode mode,
+                          Epilogue epilogue = Epilogue()) const
+    {
+        checkShapes(src, dst);
+        if (!(sigma > 0.0f))
+        {
+            throw std::runtime_error("Gaussian sigma must be positive");
+        }
+
+        const int width = static_cast<int>(src.width());
+        const int height = static_cast<int>(src.height());
+        const int channels = SrcImage::gnChannels;
+        const size_t rowBytes = static_cast<size_t>(width) * channels;
+        const SeparableGaussian gaussian(sigma);
+        const SimdLevel level = simdLevel();
+
+        parallelForRows(height, threads_, [&](int rowBegin, int rowEnd) {
+            std::vector<float> scratch(gaussian.scratchSize(width, channels));
+            std::vector<const Npp8u *> taps(gaussian.taps());
+            std::vector<Npp8u> ring(3 * rowBytes);
+
+            // smoothed row y, borders replicated, lands in ring slot
+            // (y - rowBegin + 1) % 3; rows outside the image repeat the edge
+            auto smoothRow = [&](int y) {
+                const int ys = clampIndex(y, height);
+                for (int k = 0; k < gaussian.taps(); ++k)
+                {
+                    taps[k] = src.data(0, clampIndex(ys + k - gaussian.radius(), height));
+                }
+                Npp8u *pRow = &ring[((y - rowBegin + 1) % 3) * rowBytes];
+                gaussian.filterRow(taps.data(), pRow, width, channels, scratch.data(), level);
+                return pRow;
+            };
+
+            const Npp8u *pAbove = smoothRow(rowBegin - 1);
+            const Npp8u *pCur = smoothRow(rowBegin);
+            for (int y = rowBegin; y < rowEnd; ++y)
+            {
+                const Npp8u *pBelow = smoothRow(y + 1);
+                Npp8u *pOut = dst.data(0, y);
+                gradientRow(pAbove, pCur, pBelow, pOut, width, channels, op, mode, level);
+                epilogue(pOut, static_cast<int>(rowBytes));
+                pAbove = pCur;
+                pCur = pBelow;
+            }
+        });
+    }
+
+    // Matches nppiFilterSobelHorizBorder_8u_C*R with NPP_BORDER_REPLICATE
+    template <class SrcImage, class DstImage>
+    void sobelHorizontal(const SrcImage &src, DstImage &&dst) const
+    {
+        gradient(src, dst, GradientOperator::SOBEL, GradientMode::HORIZONTAL);
+    }
+
+    template <class SrcImage, class DstImage, typename Epilogue = NoRowEpilogue>
+    void median(const SrcImage &src, DstImage &&dst, const NppiSize &maskSize, const NppiPoint &anchor,
+                MedianEngine engine = MedianEngine::AUTO, Epilogue epilogue = Epilogue()) const
+    {
+        checkShapes(src, dst);
+        if (maskSize.width <= 0 || maskSize.height <= 0)
+        {
+            throw std::runtime_error("Median mask size must be positive");
+        }
+
+        const int width = static_cast<int>(src.width());
+        const int height = static_cast<int>(src.height());
+        const int maskArea = maskSize.width * maskSize.height;
+
+        // the constant-time engine is faster for every mask the app can
+        // request (see bench/medianBench), but it counts in 16 bits
+        if (engine == MedianEngine::AUTO)
+        {
+            engine = maskArea <= 0xFFFF ? MedianEngine::CONSTANT_TIME : MedianEngine::HUANG;
+        }
+
+        parallelForRows(height, threads_, [&](int rowBegin, int rowEnd) {
+            if (engine == MedianEngine::CONSTANT_TIME)
+            {
+                constantTimeMedianRows<SrcImage::gnChannels>(
+                    src.data(), src.pitch(), dst.data(0, rowBegin), dst.pitch(), width, height,
+                    maskSize.width, maskSize.height, anchor.x, anchor.y, rowBegin, rowEnd, epilogue);
+            }
+            else
+            {
+                medianRows<SrcImage::gnChannels>(
+                    src.data(), src.pitch(), dst.data(0, rowBegin), dst.pitch(), width, height,
+                    maskSize.width, maskSize.height, anchor.x, anchor.y, rowBegin, rowEnd, epilogue);
+            }
+        });
+    }
+
+    template <class SrcImage, class DstImage>
+    void gaussian(const SrcImage &src, DstImage &&dst, float sigma,
+                  GaussianEngine engine = GaussianEngine::AUTO) const
+    {
+        checkShapes(src, dst);
+        if (!(sigma > 0.0f))
+        {
+            throw std::runtime_error("Gaussian sigma must be positive");
+        }
+
+        const int width = static_cast<int>(src.width());
+        const int height = static_cast<int>(src.height());
+        const int channels = SrcImage::gnChannels;
+
+        if (selectGaussianEngine(sigma, engine) == GaussianEngine::SEPARABLE)
+        {
+            const SeparableGaussian gaussian(sigma);
+            parallelForRows(height, threads_, [&](int rowBegin, int rowEnd) {
+                gaussian.filterRows(src.data(), src.pitch(), dst.data(0, rowBegin), dst.pitch(),
+                                    width, height, channels, rowBegin, rowEnd);
+            });
+            return;
+        }
+
+        const RecursiveGaussian gaussian(sigma);
+        const size_t rowStride = static_cast<size_t>(width) * channels;
+        std::vector<float> image(rowStride * (height + gaussian.paddedExtra()));
+
+        parallelForRows(height, threads_, [&](int rowBegin, int rowEnd) {
+            gaussian.horizontalRows(src.data(), src.pitch(), image.data(), rowStride,
+                                    width, channels, rowBegin, rowEnd);
+        });
+        // the vertical pass is split across column bands instead of rows
+        parallelForRows(static_cast<int>(rowStride), threads_, [&](int columnBegin, int columnEnd) {
+            gaussian.verticalColumns(image.data(), rowStride, dst.data(), dst.pitch(),
+                                     height, columnBegin, columnEnd);
+        });
+    }
+
+    // Binary threshold; see Threshold.h
+    template <class SrcImage, class DstImage>
+    void threshold(const SrcImage &src, DstImage &&dst, int level) const
+    {
+        checkShapes(src, dst);
+        const int width = static_cast<int>(src.width());
+        const int height = static_cast<int>(src.height());
+
+        parallelForRows(height, threads_, [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; ++y)
+            {
+                thresholdRow(src.data(0, y), dst.data(0, y), width * SrcImage::gnChannels, level);
+            }
+        });
+    }
+
+    // Edge-preserving smoothing; see BilateralFilter.h for the engines
+    template <class SrcImage, class DstImage>
+    void bilateral(const SrcImage &src, DstImage &&dst, float sigmaSpatial, float sigmaRange,
+                   BilateralEngine engine = BilateralEngine::AUTO) const
+    {
+        checkShapes(src, dst);
+        if (!(sigmaSpatial > 0.0f) || !(sigmaRange > 0.0f))
+        {
+            throw std::runtime_error("Bilateral sigmas must be positive");
+        }
+
+        const int width = static_cast<int>(src.width());
+        const int height = static_cast<int>(src.height());
+        const BilateralFilter bilateral(sigmaSpatial, sigmaRange);
+
+        if (selectBilateralEngine(sigmaSpatial, engine) == BilateralEngine::GRID)
+        {
+            bilateral.gridFilter<SrcImage::gnChannels>(src.data(), src.pitch(), dst.data(), dst.pitch(),
+                                                    width, height, threads_);
+            return;
+        }
+
+        parallelForRows(height, threads_, [&](int rowBegin, int rowEnd) {
+            bilateral.exactRows<SrcImage::gnChannels>(src.data(), src.pitch(), dst.data(0, rowBegin), dst.pitch(),
+                                                   width, height, rowBegin, rowEnd);
+        });
+    }
+
+    // Packed C3 image or view into a planar image of the same size
+    template <class SrcImage>
+    void deinterleave(const SrcImage &src, npp::ImageCPU_8u_P3 &dst) const
+    {
+        static_assert(SrcImage::gnChannels == 3, "Deinterleaving needs a three-channel source");
+        checkSizes(src, dst);
+        const int width = static_cast<int>(src.width());
+        const SimdLevel level = simdLevel();
+
+        parallelForRows(static_cast<int>(src.height()), threads_, [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; ++y)
+            {
+                Npp8u *const planes[3] = {dst.data(0, 0, y), dst.data(1, 0, y), dst.data(2, 0, y)};
+                deinterleaveRow(src.data(0, y), planes, width, level);
+            }
+        });
+    }
+
+    // Planar image into a packed C3 image or view of the same size
+    template <class DstImage>
+    void interleave(const npp::ImageCPU_8u_P3 &src, DstImage &&dst) const
+    {
+        static_assert(std::remove_reference<DstImage>::type::gnChannels == 3,
+                      "Interleaving needs a three-channel destination");
+        checkSizes(src, dst);
+        const int width = static_cast<int>(src.width());
+        const SimdLevel level = simdLevel();
+
+        parallelForRows(static_cast<int>(src.height()), threads_, [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; ++y)
+            {
+                const Npp8u *const planes[3] = {src.data(0, 0, y), src.data(1, 0, y), src.data(2, 0, y)};
+                interleaveRow(planes, dst.data(0, y), width, level);
+            }
+        });
+    }
+
+    // Per-channel filters on planar images run the single-channel kernels
+    // plane by plane; the results match the packed filters exactly
+    void median(const npp::ImageCPU_8u_P3 &src, npp::ImageCPU_8u_P3 &dst, const NppiSize &maskSize,
+                const NppiPoint &anchor, MedianEngine engine = MedianEngine::AUTO) const
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            median(src.plane(c), dst.plane(c), maskSize, anchor, engine);
+        }
+    }
+
+    void gaussian(const npp::ImageCPU_8u_P3 &src, npp::ImageCPU_8u_P3 &dst, float sigma,
+                  GaussianEngine engine = GaussianEngine::AUTO) const
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            gaussian(src.plane(c), dst.plane(c), sigma, engine);
+        }
+    }
+
+    void threshold(const npp::ImageCPU_8u_P3 &src, npp::ImageCPU_8u_P3 &dst, int level) const
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            threshold(src.plane(c), dst.plane(c), level);
+        }
+    }
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "BoundedQueue.h"
+#include "ImageProcessor.h"
+#include "NumaTopology.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ImagesCPU.h>
+
+// Dedicated threads that encode and write output images, so that the
+// outputs of a fan-out pipeline or of consecutive batch images are encoded
+// concurrently instead of one after the other. submit() queues an output
+// and returns; done is then called on the encoding thread with the time
+// the encode took and an error message, empty on success. The queue is
+// bounded, so submit() blocks while it is full. The image must stay alive
+// and unchanged until its done has been called. Outputs are encoded with
+// the pool's options unless submitted with their own, so that one pool
+// can serve jobs with different encoder settings. A pool can be pinned to
+// a NUMA node, to encode the images filtered there.
+class EncoderPool
+{
+public:
+    typedef std::function<void(double seconds, const std::string &error)> Done;
+
+private:
+    struct Task
+    {
+        std::string outputFile;
+        const npp::ImageCPU_8u_C3 *image;
+        npp::EncodeOptions options;
+        Done done;
+    };
+
+    npp::EncodeOptions options_;
+    BoundedQueue<Task> queue_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    size_t pending_;
+
+    void work(int node)
+    {
+        tryPinToNumaNode(node);
+        Task task;
+        while (queue_.pop(task))
+        {
+            std::string error;
+            const auto start = std::chrono::steady_clock::now();
+            try
+            {
+                ImageProcessor::encodeImage(task.outputFile, *task.image, task.options);
+            }
+            catch (const npp::Exception &e)
+            {
+                error = e.toString();
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            if (task.done)
+            {
+                task.done(elapsed.count(), error);
+            }
+            task = Task();
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0)
+            {
+                idle_.notify_all();
+            }
+        }
+    }
+
+public:
+    // queueDepth outputs wait for a thread before submit() blocks, 0 = one
+    // per thread; node is the NUMA node to run on, -1 = any
+    EncoderPool(int threads, const npp::EncodeOptions &options, size_t queueDepth = 0, int node = -1)
+        : options_(options), queue_(queueDepth > 0 ? queueDepth : static_cast<size_t>(std::max(threads, 1))),
+          pending_(0)
+    {
+        for (int i = 0; i < std::max(threads, 1); ++i)
+        {
+            threads_.emplace_back([this, node]() { work(node); });
+        }
+    }
+
+    EncoderPool(const EncoderPool &) = delete;
+    EncoderPool &operator=(const EncoderPool &) = delete;
+
+    // Finishes the queued outputs
+    ~EncoderPool()
+    {
+        queue_.close();
+        for (auto &thread : threads_)
+        {
+            thread.join();
+        }
+    }
+
+    void submit(const std::string &outputFile, const npp::ImageCPU_8u_C3 &image, Done done)
+    {
+        submit(outputFile, image, options_, std::move(done));
+    }
+
+    void submit(const std::string &outputFile, const npp::ImageCPU_8u_C3 &image,
+                const npp::EncodeOptions &options, Done done)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_;
+        }
+        Task task = {outputFile, &image, options, std::move(done)};
+        queue_.push(task);
+    }
+
+    // Block until every submitted output has been written
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+    int threads() const
+    {
+        return static_cast<int>(threads_.size());
+    }
+};
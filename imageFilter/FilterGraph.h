@@ -0,0 +1,368 @@
+#pragma once
+
+#include "Config.h"
+#include "EncoderPool.h"
+#include "ImageProcessor.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ImagesCPU.h>
+
+// Runs a --pipeline (a chain of filters, possibly fanning out into several
+// branches) on a decoded image entirely in memory. Intermediate results
+// ping-pong between two buffers per fan-out level, allocated once and
+// reused for every image of the same size; the last stage of each branch
+// writes straight into its output image. Only the decoded input and the
+// outputs ever touch disk. Adjacent stages with a fused kernel run as one
+// pass unless --no-fusion is given, and stages that prefer planar pixels
+// (see ImageProcessor::preferredLayout) pass planar images between them,
+// converting only where the layout changes.
+class FilterGraph
+{
+private:
+    // A node runs one stage, or several stages fused into one pass (see
+    // ImageProcessor::fusableStages); fused stages never see their
+    // intermediate images.
+    struct Node
+    {
+        int parent;
+        int buffer;         // intermediate buffer written, -1 for a leaf
+        int output;         // output index for a leaf, -1 otherwise
+        std::string suffix; // file name suffix of the path ending here
+        std::string name;
+        ImageLayout layout; // layout the node runs in and writes its buffer in
+        std::vector<std::unique_ptr<ImageProcessor>> processors;
+        std::vector<const ImageProcessor *> fused; // processors after the first
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<npp::ImageCPU_8u_C3> buffers_;
+    std::vector<npp::ImageCPU_8u_P3> planarBuffers_;
+    std::vector<int> leaves_;
+    ProcessingConfig inputConfig_; // raw input geometry and encoder settings for processImage
+    bool verbose_;
+    std::unique_ptr<EncoderPool> encoders_; // started by the first processImage without a pool
+
+    // Layout conversions where a planar node follows a packed one or the
+    // other way round, and the pixels each was converted from; branches of
+    // a fan-out that need the same conversion share it
+    npp::ImageCPU_8u_C3 packedInput_;
+    npp::ImageCPU_8u_P3 planarInput_;
+    npp::ImageCPU_8u_P3 planarOutput_;
+    const void *packedInputOf_;
+    const void *planarInputOf_;
+
+    const npp::ImageCPU_8u_C3 &packedInput(const ImageProcessor &processor, const npp::ImageCPU_8u_P3 &src)
+    {
+        if (packedInputOf_ != &src)
+        {
+            processor.interleave(src, packedInput_);
+            packedInputOf_ = &src;
+        }
+        return packedInput_;
+    }
+
+    const npp::ImageCPU_8u_P3 &planarInput(const ImageProcessor &processor, const npp::ConstImageView_8u_C3 &src)
+    {
+        if (planarInputOf_ != src.data())
+        {
+            processor.deinterleave(src, planarInput_);
+            planarInputOf_ = src.data();
+        }
+        return planarInput_;
+    }
+
+    // Run every node; a leaf writes into its image of outputs, or into
+    // direct if given
+    void runNodes(const npp::ConstImageView_8u_C3 &src, std::vector<npp::ImageCPU_8u_C3> &outputs,
+                  const npp::ImageView_8u_C3 *direct)
+    {
+        packedInputOf_ = nullptr;
+        planarInputOf_ = nullptr;
+
+        for (Node &node : nodes_)
+        {
+            ImageProcessor &processor = *node.processors[0];
+            const int in = node.parent >= 0 ? nodes_[node.parent].buffer : -1;
+            const bool planarIn = node.parent >= 0 && nodes_[node.parent].layout == ImageLayout::PLANAR;
+
+            const auto start = std::chrono::steady_clock::now();
+            if (node.layout == ImageLayout::PACKED)
+            {
+                npp::ConstImageView_8u_C3 input = src;
+                if (in >= 0)
+                {
+                    input = planarIn ? packedInput(processor, planarBuffers_[in]) : buffers_[in];
+                }
+                if (node.output >= 0 && direct != nullptr)
+                {
+                    processor.filterImageFused(node.fused, input, *direct);
+                }
+                else
+                {
+                    npp::ImageCPU_8u_C3 &output = node.output >= 0 ? outputs[node.output] : buffers_[node.buffer];
+                    processor.filterImageFused(node.fused, input, output);
+                }
+            }
+            else
+            {
+                const npp::ImageCPU_8u_P3 &input =
+                    planarIn ? planarBuffers_[in]
+                             : planarInput(processor, in < 0 ? src : npp::ConstImageView_8u_C3(buffers_[in]));
+                if (node.output >= 0)
+                {
+                    processor.filterImage(input, planarOutput_);
+                    if (direct != nullptr)
+                    {
+                        processor.interleave(planarOutput_, *direct);
+                    }
+                    else
+                    {
+                        processor.interleave(planarOutput_, outputs[node.output]);
+                    }
+                }
+                else
+                {
+                    processor.filterImage(input, planarBuffers_[node.buffer]);
+                }
+            }
+
+            // a rewritten buffer invalidates the conversion made from it
+            if (node.buffer >= 0 && (packedInputOf_ == &planarBuffers_[node.buffer] ||
+                                     planarInputOf_ == buffers_[node.buffer].data()))
+            {
+                packedInputOf_ = nullptr;
+                planarInputOf_ = nullptr;
+            }
+
+            if (verbose_)
+            {
+                const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                std::cout << "  " << node.name << (node.fused.empty() ? "" : " (fused)")
+                          << (node.layout == ImageLayout::PLANAR ? " (planar)" : "") << ": "
+                          << elapsed.count() << " ms" << std::endl;
+            }
+        }
+    }
+
+public:
+    FilterGraph(const std::vector<PipelineStage> &stages, bool verbose = false)
+        : inputConfig_(stages.empty() ? ProcessingConfig() : stages[0].config), verbose_(verbose), packedInputOf_(nullptr), planarInputOf_(nullptr)
+    {
+        if (stages.empty())
+        {
+            throw std::runtime_error("Empty filter pipeline");
+        }
+
+        std::vector<int> children(stages.size(), 0);
+        for (size_t i = 0; i < stages.size(); ++i)
+        {
+            if (stages[i].parent >= static_cast<int>(i))
+            {
+                throw std::runtime_error("Pipeline stages must follow their parent");
+            }
+            if (stages[i].parent >= 0)
+            {
+                ++children[stages[i].parent];
+            }
+        }
+
+        // Group stages into nodes: a stage absorbs the following stages it
+        // can fuse with, as long as each is the only child of the previous
+        std::vector<int> nodeOf(stages.size(), -1);
+        std::vector<int> nodeChildren;
+        for (size_t i = 0; i < stages.size(); ++i)
+        {
+            Node node;
+            node.parent = stages[i].parent >= 0 ? nodeOf[stages[i].parent] : -1;
+            node.processors.emplace_back(new ImageProcessor(stages[i].config));
+
+            std::vector<std::unique_ptr<ImageProcessor>> chain;
+            std::vector<const ImageProcessor *> next;
+            for (size_t j = i; next.size() < 2 && children[j] == 1 && j + 1 < stages.size() &&
+                               stages[j + 1].parent == static_cast<int>(j); ++j)
+            {
+                chain.emplace_back(new ImageProcessor(stages[j + 1].config));
+                next.push_back(chain.back().get());
+            }
+            const size_t fused = node.processors[0]->fusableStages(next);
+
+            nodeOf[i] = static_cast<int>(nodes_.size());
+            node.suffix = (node.parent >= 0 ? nodes_[node.parent].suffix : std::string()) +
+                          node.processors[0]->filterSuffix();
+            node.name = node.processors[0]->filterName();
+            for (size_t k = 0; k < fused; ++k)
+            {
+                node.fused.push_back(chain[k].get());
+                node.suffix += chain[k]->filterSuffix();
+                node.name += std::string(" + ") + chain[k]->filterName();
+                node.processors.push_back(std::move(chain[k]));
+                nodeOf[++i] = static_cast<int>(nodes_.size());
+            }
+
+            nodeChildren.push_back(children[i]);
+            nodes_.push_back(std::move(node));
+        }
+
+        // A node's input stays alive while its own chain continues, so a
+        // chain alternates between the two buffers of its level. Branches
+        // of a fan-out move one level down and leave the shared input, on
+        // the level above, untouched.
+        std::vector<int> level(nodes_.size(), 0);
+        std::vector<int> position(nodes_.size(), 0);
+        int levels = 1;
+
+        for (size_t n = 0; n < nodes_.size(); ++n)
+        {
+            Node &node = nodes_[n];
+            if (node.parent >= 0)
+            {
+                const bool fanOut = nodeChildren[node.parent] > 1;
+                level[n] = level[node.parent] + (fanOut ? 1 : 0);
+                position[n] = fanOut ? 0 : position[node.parent] + 1;
+            }
+            levels = std::max(levels, level[n] + 1);
+
+            const ImageLayout inputLayout = node.parent >= 0 ? nodes_[node.parent].layout : ImageLayout::PACKED;
+            node.layout = node.fused.empty() ? node.processors[0]->preferredLayout(inputLayout) : ImageLayout::PACKED;
+
+            if (nodeChildren[n] == 0)
+            {
+                node.buffer = -1;
+                node.output = static_cast<int>(leaves_.size());
+                leaves_.push_back(static_cast<int>(n));
+            }
+            else
+            {
+                node.buffer = 2 * level[n] + position[n] % 2;
+                node.output = -1;
+            }
+        }
+
+        if (leaves_.size() > 1 && !stages[0].config.outputFile.empty())
+        {
+            throw std::runtime_error("--output names a single file, use --output-dir with a fan-out pipeline");
+        }
+
+        buffers_.resize(2 * levels);
+        planarBuffers_.resize(2 * levels);
+    }
+
+    size_t outputCount() const
+    {
+        return leaves_.size();
+    }
+
+    size_t bufferCount() const
+    {
+        return buffers_.size();
+    }
+
+    // Passes over the image: stages fused into one pass count once
+    size_t passCount() const
+    {
+        return nodes_.size();
+    }
+
+    // Halo rows the deepest branch needs: the halos of a chain add up
+    int haloRows() const
+    {
+        std::vector<int> halo(nodes_.size(), 0);
+        int result = 0;
+        for (size_t n = 0; n < nodes_.size(); ++n)
+        {
+            halo[n] = nodes_[n].parent >= 0 ? halo[nodes_[n].parent] : 0;
+            for (const auto &processor : nodes_[n].processors)
+            {
+                halo[n] += processor->haloRows();
+            }
+            result = std::max(result, halo[n]);
+        }
+        return result;
+    }
+
+    // File name of output k for inputFile: the input name with the
+    // suffixes of every stage on the branch, e.g. sloth_smooth_sobel.png
+    std::string outputFilename(const std::string &inputFile, size_t k) const
+    {
+        const Node &leaf = nodes_[leaves_[k]];
+        return leaf.processors[0]->outputFilename(inputFile, leaf.suffix);
+    }
+
+    // Run every stage on src, an image or any view of one; outputs is
+    // resized to outputCount() and existing images of the right size are
+    // reused
+    void run(const npp::ConstImageView_8u_C3 &src, std::vector<npp::ImageCPU_8u_C3> &outputs)
+    {
+        outputs.resize(leaves_.size());
+        runNodes(src, outputs, nullptr);
+    }
+
+    // Run a graph with a single output on src, writing the result straight
+    // into output, a view of src's size such as a slot of a FrameRing
+    void run(const npp::ConstImageView_8u_C3 &src, const npp::ImageView_8u_C3 &output)
+    {
+        if (leaves_.size() != 1)
+        {
+            throw std::runtime_error("Only a pipeline with a single output can run into a view");
+        }
+        std::vector<npp::ImageCPU_8u_C3> outputs;
+        runNodes(src, outputs, &output);
+    }
+
+    // Decode inputFile, run the graph and encode every output on encoders,
+    // which no other thread may submit to meanwhile; without one the graph
+    // starts its own pool once and keeps it for the following images
+    void processImage(const std::string &inputFile, EncoderPool *encoders = nullptr)
+    {
+        InputImage src;
+        std::vector<npp::ImageCPU_8u_C3> outputs;
+
+        src.load(inputFile, inputConfig_);
+        run(src.view(), outputs);
+
+        // the outputs of a fan-out are encoded concurrently
+        if (encoders == nullptr)
+        {
+            if (!encoders_)
+            {
+                encoders_.reset(new EncoderPool(
+                    std::min(static_cast<int>(leaves_.size()), resolveThreadCount(inputConfig_.encodeThreads)),
+                    ImageProcessor::encodeOptions(inputConfig_), leaves_.size()));
+            }
+            encoders = encoders_.get();
+        }
+        const npp::EncodeOptions options = ImageProcessor::encodeOptions(inputConfig_);
+        std::mutex mutex;
+        std::string error;
+        for (size_t k = 0; k < outputs.size(); ++k)
+        {
+            const std::string outputFile = outputFilename(inputFile, k);
+            encoders->submit(outputFile, outputs[k], options, [&, outputFile](double seconds, const std::string &message) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (verbose_ && message.empty())
+                {
+                    std::cout << "Saved " << outputFile << " (" << seconds * 1000.0 << " ms)" << std::endl;
+                }
+                if (error.empty())
+                {
+                    error = message;
+                }
+            });
+        }
+        encoders->wait();
+
+        if (!error.empty())
+        {
+            throw std::runtime_error(error);
+        }
+    }
+};
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <ImagesCPU.h>
+#include <helper_multiprocess.h>
+
+// Ring of fixed-size 8-bit RGB frames in POSIX shared memory, for passing
+// frames between processes on one host without encoding them or touching
+// the file system. A producer claims a free slot, writes the pixels
+// straight into it through an ImageView and publishes it; a consumer
+// acquires the next published slot, reads the pixels in place and
+// releases the slot for reuse.
+//
+// Slot handoff is lock-free and works for any number of producers and
+// consumers, in or across processes (a bounded MPMC queue after Vyukov):
+// every slot carries a sequence number that says whether it is free for
+// ring position p (== p), published at p (== p + 1) or still being read,
+// and producers and consumers claim positions with a compare-and-swap on
+// the shared write and read counters. Waiting for a slot spins briefly and
+// then sleeps in short steps. Each frame also carries a 64-bit id set by
+// its producer, e.g. the camera frame number, so consumers can match
+// results to inputs or reorder them. A producer that cannot fill a slot it
+// claimed discards it, and consumers skip it.
+//
+// The process that creates a ring owns its name and removes it when the
+// ring is destroyed; processes that have it open keep their mapping.
+class FrameRing
+{
+public:
+    // A slot held by a producer or a consumer
+    struct Frame
+    {
+        uint64_t position;          // ring sequence number
+        uint64_t id;                // producer's frame id, set by publish()
+        npp::ImageView_8u_C3 view;  // the pixels, in shared memory
+    };
+
+private:
+    static const uint32_t kMagic = 0x474e5246; // "FRNG"
+    static const uint32_t kVersion = 2;
+    static const size_t kPageSize = 4096;
+
+    struct Header
+    {
+        std::atomic<uint32_t> magic; // stored last by the creator
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t pitch;
+        uint32_t slots;
+        uint64_t slotBytes;
+        uint64_t totalBytes;
+        std::atomic<uint32_t> closed;
+        alignas(64) std::atomic<uint64_t> writePosition;
+        alignas(64) std::atomic<uint64_t> readPosition;
+    };
+
+    struct alignas(64) SlotControl
+    {
+        std::atomic<uint64_t> sequence;
+        uint64_t id;
+        uint32_t dropped; // set by discard(), readers skip the slot
+    };
+
+    // address-free across processes only if lock-free; the C++11 macro
+    // covers long long, which every target makes 64 bits like uint64_t
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && sizeof(long long) == sizeof(uint64_t),
+                  "FrameRing needs lock-free 64-bit atomics");
+
+    std::string name_;
+    bool owner_;
+    sharedMemoryInfo memory_;
+    Header *header_;
+    SlotControl *control_;
+    Npp8u *data_;
+
+    static size_t roundUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static size_t controlOffset()
+    {
+        return roundUp(sizeof(Header), 64);
+    }
+
+    static size_t dataOffset(uint32_t slots)
+    {
+        return roundUp(controlOffset() + slots * sizeof(SlotControl), kPageSize);
+    }
+
+    FrameRing(const std::string &name, bool owner, const sharedMemoryInfo &memory)
+        : name_(name), owner_(owner), memory_(memory), header_(static_cast<Header *>(memory.addr)),
+          control_(reinterpret_cast<SlotControl *>(static_cast<char *>(memory.addr) + controlOffset())),
+          data_(static_cast<Npp8u *>(memory.addr) + dataOffset(header_->slots))
+    {
+    }
+
+    SlotControl &slot(uint64_t position) const
+    {
+        return control_[position % header_->slots];
+    }
+
+    Frame frame(uint64_t position) const
+    {
+        Npp8u *pixels = data_ + (position % header_->slots) * header_->slotBytes;
+        return {position, slot(position).id,
+                npp::ImageView_8u_C3(pixels, static_cast<int>(header_->pitch), header_->width, header_->height)};
+    }
+
+    // Spin, then yield, then sleep in 50 us steps
+    static void backoff(unsigned int &attempt)
+    {
+        if (attempt < 64)
+        {
+            ++attempt;
+        }
+        else if (attempt < 128)
+        {
+            ++attempt;
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+public:
+    // Create the ring name (a POSIX shared memory name such as "/camera0")
+    // with slots frames of width x height, replacing a stale ring of that
+    // name
+    static std::unique_ptr<FrameRing> create(const std::string &name, unsigned int width, unsigned int height,
+                                             unsigned int slots)
+    {
+        if (width == 0 || height == 0 || slots == 0)
+        {
+            throw std::runtime_error("Frame ring " + name + " needs a size and at least one slot");
+        }
+        const size_t pitch = roundUp(static_cast<size_t>(width) * 3, 64);
+        const size_t slotBytes = roundUp(pitch * height, kPageSize);
+        const size_t totalBytes = dataOffset(slots) + slotBytes * slots;
+
+        sharedMemoryUnlink(name.c_str());
+        sharedMemoryInfo memory = sharedMemoryInfo();
+        if (sharedMemoryCreate(name.c_str(), totalBytes, &memory) != 0)
+        {
+            sharedMemoryClose(&memory);
+            throw std::runtime_error("Cannot create frame ring " + name);
+        }
+
+        Header *header = new (memory.addr) Header();
+        header->version = kVersion;
+        header->width = width;
+        header->height = height;
+        header->pitch = static_cast<uint32_t>(pitch);
+        header->slots = slots;
+        header->slotBytes = slotBytes;
+        header->totalBytes = totalBytes;
+        header->closed.store(0);
+        header->writePosition.store(0);
+        header->readPosition.store(0);
+        SlotControl *control = reinterpret_cast<SlotControl *>(static_cast<char *>(memory.addr) + controlOffset());
+        for (uint32_t i = 0; i < slots; ++i)
+        {
+            new (&control[i]) SlotControl();
+            control[i].sequence.store(i);
+            control[i].id = 0;
+            control[i].dropped = 0;
+        }
+        header->magic.store(kMagic, std::memory_order_release);
+
+        return std::unique_ptr<FrameRing>(new FrameRing(name, true, memory));
+    }
+
+    // Open a ring another process created
+    static std::unique_ptr<FrameRing> open(const std::string &name)
+    {
+        sharedMemoryInfo memory = sharedMemoryInfo();
+        if (sharedMemoryOpen(name.c_str(), sizeof(Header), &memory) != 0)
+        {
+            sharedMemoryClose(&memory);
+            throw std::runtime_error("Cannot open frame ring " + name);
+        }
+        const Header *header = static_cast<const Header *>(memory.addr);
+        const bool valid = header->magic.load(std::memory_order_acquire) == kMagic && header->version == kVersion;
+        const size_t totalBytes = valid ? header->totalBytes : 0;
+        sharedMemoryClose(&memory);
+        if (!valid)
+        {
+            throw std::runtime_error("Not a frame ring, or not initialised yet: " + name);
+        }
+
+        memory = sharedMemoryInfo();
+        if (sharedMemoryOpen(name.c_str(), totalBytes, &memory) != 0)
+        {
+            sharedMemoryClose(&memory);
+            throw std::runtime_error("Cannot open frame ring " + name);
+        }
+        return std::unique_ptr<FrameRing>(new FrameRing(name, false, memory));
+    }
+
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+
+    ~FrameRing()
+    {
+        sharedMemoryClose(&memory_);
+        if (owner_)
+        {
+            sharedMemoryUnlink(name_.c_str());
+        }
+    }
+
+    unsigned int width() const
+    {
+        return header_->width;
+    }
+
+    unsigned int height() const
+    {
+        return header_->height;
+    }
+
+    unsigned int slots() const
+    {
+        return header_->slots;
+    }
+
+    // Claim the next free slot for writing. With wait, blocks while the
+    // ring is full; returns false if it is full and !wait, or closed.
+    bool acquireWrite(Frame &result, bool wait = true)
+    {
+        unsigned int attempt = 0;
+        uint64_t position = header_->writePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (header_->closed.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+            const uint64_t sequence = slot(position).sequence.load(std::memory_order_acquire);
+            const int64_t diff = static_cast<int64_t>(sequence - position);
+            if (diff == 0)
+            {
+                if (header_->writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    result = frame(position);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // the slot from the previous lap is still being read
+                if (!wait)
+                {
+                    return false;
+                }
+                backoff(attempt);
+                position = header_->writePosition.load(std::memory_order_relaxed);
+            }
+            else
+            {
+                position = header_->writePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Hand a written slot to the consumers
+    void publish(const Frame &written, uint64_t id)
+    {
+        SlotControl &control = slot(written.position);
+        control.id = id;
+        control.dropped = 0;
+        control.sequence.store(written.position + 1, std::memory_order_release);
+    }
+
+    // Give back a slot claimed with acquireWrite without publishing a frame
+    // in it, e.g. after the producer failed to fill it
+    void discard(const Frame &written)
+    {
+        SlotControl &control = slot(written.position);
+        control.dropped = 1;
+        control.sequence.store(written.position + 1, std::memory_order_release);
+    }
+
+    // Take the next published slot, waiting for one; returns false once
+    // the ring is closed and every published frame has been taken, or
+    // while waiting once cancel is set
+    bool acquireRead(Frame &result, const std::atomic<bool> *cancel = nullptr)
+    {
+        unsigned int attempt = 0;
+        uint64_t position = header_->readPosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const uint64_t sequence = slot(position).sequence.load(std::memory_order_acquire);
+            const int64_t diff = static_cast<int64_t>(sequence - (position + 1));
+            if (diff == 0)
+            {
+                if (header_->readPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    if (slot(position).dropped)
+                    {
+                        slot(position).sequence.store(position + header_->slots, std::memory_order_release);
+                        position = header_->readPosition.load(std::memory_order_relaxed);
+                        continue;
+                    }
+                    result = frame(position);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                if ((header_->closed.load(std::memory_order_acquire) &&
+                     header_->writePosition.load(std::memory_order_relaxed) <= position) ||
+                    (cancel != nullptr && cancel->load(std::memory_order_relaxed)))
+                {
+                    return false;
+                }
+                backoff(attempt);
+                position = header_->readPosition.load(std::memory_order_relaxed);
+            }
+            else
+            {
+                position = header_->readPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Give a slot taken with acquireRead back to the producers
+    void release(const Frame &read)
+    {
+        slot(read.position).sequence.store(read.position + header_->slots, std::memory_order_release);
+    }
+
+    // No more frames: producers stop claiming slots and consumers stop once
+    // the published frames are drained. Call after the last publish().
+    void close()
+    {
+        header_->closed.store(1, std::memory_order_release);
+    }
+
+    bool closed() const
+    {
+        return header_->closed.load(std::memory_order_acquire) != 0;
+    }
+};
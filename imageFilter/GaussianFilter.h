@@ -0,0 +1,392 @@
+#pragma once
+
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <npp.h>
+
+// Gaussian smoothing engines for 8-bit images with interleaved channels.
+// Borders are replicated in both engines.
+//
+// SeparableGaussian convolves with a sampled kernel of radius ceil(3 sigma),
+// first down the columns into a float row and then along that row. Its cost
+// grows linearly with sigma, so it is used for small sigma.
+//
+// RecursiveGaussian is the third-order IIR approximation of Young and van
+// Vliet ("Recursive implementation of the Gaussian filter", 1995), run
+// causally and anti-causally in each direction. Its cost per pixel is
+// independent of sigma.
+
+enum class GaussianEngine
+{
+    AUTO,
+    SEPARABLE,
+    RECURSIVE
+};
+
+// Sigma at and above which AUTO switches to the recursive engine. Below it
+// the separable kernel is short enough to be cheaper (the two cost the same
+// near sigma = 10 on a 1080p C3 frame with AVX2), and the recursive
+// approximation is least accurate for small sigma.
+const float kRecursiveGaussianMinSigma = 8.0f;
+
+inline GaussianEngine selectGaussianEngine(float sigma, GaussianEngine requested = GaussianEngine::AUTO)
+{
+    if (requested != GaussianEngine::AUTO)
+    {
+        return requested;
+    }
+    return sigma >= kRecursiveGaussianMinSigma ? GaussianEngine::RECURSIVE : GaussianEngine::SEPARABLE;
+}
+
+namespace gaussian_detail
+{
+    inline Npp8u roundTo8u(float value)
+    {
+        const int rounded = static_cast<int>(std::nearbyint(value));
+        return static_cast<Npp8u>(rounded < 0 ? 0 : (rounded > 255 ? 255 : rounded));
+    }
+
+#if IMAGEFILTER_X86_SIMD
+    // Weighted sum of taps 8-bit rows into acc[begin, end); returns the
+    // first index not processed.
+    IMAGEFILTER_TARGET("avx2")
+    inline int columnAvx2(const Npp8u *const *rows, const float *weights, int taps,
+                          float *acc, int begin, int end)
+    {
+        int i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < taps; ++k)
+            {
+                const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(rows[k] + i));
+                const __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(values, _mm256_set1_ps(weights[k])));
+            }
+            _mm256_storeu_ps(acc + i, sum);
+        }
+        return i;
+    }
+
+    // Weighted sum along a padded float row into out[begin, end); returns
+    // the first index not processed.
+    IMAGEFILTER_TARGET("avx2")
+    inline int rowAvx2(const float *padded, int stride, const float *weights, int taps,
+                       Npp8u *out, int begin, int end)
+    {
+        int i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < taps; ++k)
+            {
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(padded + i + k * stride),
+                                                       _mm256_set1_ps(weights[k])));
+            }
+            const __m256i rounded = _mm256_cvtps_epi32(sum);
+            const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(rounded),
+                                                   _mm256_extracti128_si256(rounded, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(words, words));
+        }
+        return i;
+    }
+
+    IMAGEFILTER_TARGET("sse4.1")
+    inline int columnSse41(const Npp8u *const *rows, const float *weights, int taps,
+                           float *acc, int begin, int end)
+    {
+        int i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps; ++k)
+            {
+                int word;
+                std::memcpy(&word, rows[k] + i, sizeof(word));
+                const __m128 values = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(word)));
+                sum = _mm_add_ps(sum, _mm_mul_ps(values, _mm_set1_ps(weights[k])));
+            }
+            _mm_storeu_ps(acc + i, sum);
+        }
+        return i;
+    }
+
+    IMAGEFILTER_TARGET("sse4.1")
+    inline int rowSse41(const float *padded, int stride, const float *weights, int taps,
+                        Npp8u *out, int begin, int end)
+    {
+        int i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps; ++k)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(padded + i + k * stride),
+                                                 _mm_set1_ps(weights[k])));
+            }
+            const __m128i words = _mm_packus_epi32(_mm_cvtps_epi32(sum), _mm_setzero_si128());
+            const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+            std::memcpy(out + i, &packed, sizeof(packed));
+        }
+        return i;
+    }
+#endif
+} // namespace gaussian_detail
+
+class SeparableGaussian
+{
+private:
+    int radius_;
+    std::vector<float> weights_;
+
+public:
+    explicit SeparableGaussian(float sigma)
+        : radius_(std::max(1, static_cast<int>(std::ceil(3.0f * sigma)))), weights_(2 * radius_ + 1)
+    {
+        float sum = 0.0f;
+        for (int k = -radius_; k <= radius_; ++k)
+        {
+            const float w = std::exp(-0.5f * k * k / (sigma * sigma));
+            weights_[k + radius_] = w;
+            sum += w;
+        }
+        for (float &w : weights_)
+        {
+            w /= sum;
+        }
+    }
+
+    int radius() const
+    {
+        return radius_;
+    }
+
+    int taps() const
+    {
+        return 2 * radius_ + 1;
+    }
+
+    // Size in floats of the scratch buffer filterRow needs
+    size_t scratchSize(int width, int channels) const
+    {
+        return static_cast<size_t>(width + 2 * radius_) * channels;
+    }
+
+    // One output row from taps() source rows (rows[radius()] is the centre
+    // row; callers clamp the others to implement the vertical border).
+    void filterRow(const Npp8u *const *rows, Npp8u *pOut, int width, int channels,
+                   float *scratch, SimdLevel level = simdLevel()) const
+    {
+        const int rowBytes = width * channels;
+        const int taps = this->taps();
+        const float *weights = weights_.data();
+        float *acc = scratch + radius_ * channels;
+
+        // vertical pass into the middle of the padded scratch row
+        int i = 0;
+#if IMAGEFILTER_X86_SIMD
+        if (level == SimdLevel::AVX2)
+        {
+            i = gaussian_detail::columnAvx2(rows, weights, taps, acc, i, rowBytes);
+        }
+        if (level >= SimdLevel::SSE41)
+        {
+            i = gaussian_detail::columnSse41(rows, weights, taps, acc, i, rowBytes);
+        }
+#endif
+        for (; i < rowBytes; ++i)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < taps; ++k)
+            {
+                sum += rows[k][i] * weights[k];
+            }
+            acc[i] = sum;
+        }
+
+        // replicate the edge pixels into the padding
+        for (int p = 1; p <= radius_; ++p)
+        {
+            for (int c = 0; c < channels; ++c)
+            {
+                acc[-p * channels + c] = acc[c];
+                acc[rowBytes - channels + p * channels + c] = acc[rowBytes - channels + c];
+            }
+        }
+
+        // horizontal pass
+        i = 0;
+#if IMAGEFILTER_X86_SIMD
+        if (level == SimdLevel::AVX2)
+        {
+            i = gaussian_detail::rowAvx2(scratch, channels, weights, taps, pOut, i, rowBytes);
+        }
+        if (level >= SimdLevel::SSE41)
+        {
+            i = gaussian_detail::rowSse41(scratch, channels, weights, taps, pOut, i, rowBytes);
+        }
+#endif
+        for (; i < rowBytes; ++i)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < taps; ++k)
+            {
+                sum += scratch[i + k * channels] * weights[k];
+            }
+            pOut[i] = gaussian_detail::roundTo8u(sum);
+        }
+    }
+
+    // Rows [rowBegin, rowEnd) of a full image; pDst addresses row rowBegin.
+    void filterRows(const Npp8u *pSrc, int nSrcPitch, Npp8u *pDst, int nDstPitch,
+                    int width, int height, int channels, int rowBegin, int rowEnd) const
+    {
+        std::vector<float> scratch(scratchSize(width, channels));
+        std::vector<const Npp8u *> rows(taps());
+
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            for (int k = 0; k < taps(); ++k)
+            {
+                const int ys = std::min(std::max(y + k - radius_, 0), height - 1);
+                rows[k] = pSrc + ys * nSrcPitch;
+            }
+            filterRow(rows.data(), pDst + (y - rowBegin) * nDstPitch, width, channels, scratch.data());
+        }
+    }
+};
+
+class RecursiveGaussian
+{
+private:
+    // normalised coefficients: y[n] = B x[n] + a1 y[n-1] + a2 y[n-2] + a3 y[n-3]
+    float b_;
+    float a1_;
+    float a2_;
+    float a3_;
+    int padding_;
+
+public:
+    explicit RecursiveGaussian(float sigma)
+    {
+        const float q = sigma >= 2.5f ? 0.98711f * sigma - 0.96330f
+                                      : 3.97156f - 4.14554f * std::sqrt(1.0f - 0.26891f * sigma);
+        const float q2 = q * q;
+        const float q3 = q2 * q;
+        const float b0 = 1.57825f + 2.44413f * q + 1.4281f * q2 + 0.422205f * q3;
+        const float b1 = 2.44413f * q + 2.85619f * q2 + 1.26661f * q3;
+        const float b2 = -(1.4281f * q2 + 1.26661f * q3);
+        const float b3 = 0.422205f * q3;
+
+        a1_ = b1 / b0;
+        a2_ = b2 / b0;
+        a3_ = b3 / b0;
+        b_ = 1.0f - (a1_ + a2_ + a3_);
+
+        // Replicated border samples the causal pass runs over past the end,
+        // so that the anti-causal pass starts close to its steady state.
+        // This is a per-line cost, not a per-pixel one.
+        padding_ = static_cast<int>(std::ceil(3.0f * sigma));
+    }
+
+    // Samples a padded signal needs in addition to its count
+    int paddedExtra() const
+    {
+        return 3 + padding_ + 3;
+    }
+
+    // Filter a signal in place, causally then anti-causally. The signal has
+    // count samples of lanes contiguous floats each, stride floats apart,
+    // starting at sample 3 of data; the 3 samples before and paddedExtra()-3
+    // samples after it are scratch space for the replicated borders.
+    void filterPadded(float *data, int count, size_t stride, int lanes) const
+    {
+        float *x = data + 3 * stride;
+        const float *pFirst = x;
+        const float *pLast = x + (count - 1) * stride;
+
+        // a constant signal is its own steady state, so the replicated
+        // borders double as filter history
+        for (int p = 1; p <= 3; ++p)
+        {
+            std::copy(pFirst, pFirst + lanes, x - p * stride);
+        }
+        for (int p = 0; p < padding_ + 3; ++p)
+        {
+            std::copy(pLast, pLast + lanes, x + (count + p) * stride);
+        }
+
+        const float b = b_;
+        const float a1 = a1_;
+        const float a2 = a2_;
+        const float a3 = a3_;
+
+        for (int n = 0; n < count + padding_; ++n)
+        {
+            float *cur = x + n * stride;
+            const float *p1 = cur - stride;
+            const float *p2 = cur - 2 * stride;
+            const float *p3 = cur - 3 * stride;
+            for (int j = 0; j < lanes; ++j)
+            {
+                cur[j] = b * cur[j] + a1 * p1[j] + a2 * p2[j] + a3 * p3[j];
+            }
+        }
+
+        for (int n = count + padding_ - 1; n >= 0; --n)
+        {
+            float *cur = x + n * stride;
+            const float *n1 = cur + stride;
+            const float *n2 = cur + 2 * stride;
+            const float *n3 = cur + 3 * stride;
+            for (int j = 0; j < lanes; ++j)
+            {
+                cur[j] = b * cur[j] + a1 * n1[j] + a2 * n2[j] + a3 * n3[j];
+            }
+        }
+    }
+
+    // Horizontal pass for rows [rowBegin, rowEnd): 8-bit source rows into
+    // rows 3 + y of the padded float image (rowStride floats per row).
+    void horizontalRows(const Npp8u *pSrc, int nSrcPitch, float *pImage, size_t rowStride,
+                        int width, int channels, int rowBegin, int rowEnd) const
+    {
+        std::vector<float> line(static_cast<size_t>(width + paddedExtra()) * channels);
+
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            const Npp8u *pRow = pSrc + y * nSrcPitch;
+            float *pSignal = line.data() + 3 * channels;
+            for (int i = 0; i < width * channels; ++i)
+            {
+                pSignal[i] = pRow[i];
+            }
+
+            filterPadded(line.data(), width, channels, channels);
+            std::copy(pSignal, pSignal + width * channels, pImage + (3 + y) * rowStride);
+        }
+    }
+
+    // Vertical pass over the float columns [columnBegin, columnEnd) of a
+    // padded image of height rows, then rounded into the 8-bit destination.
+    void verticalColumns(float *pImage, size_t rowStride, Npp8u *pDst, int nDstPitch,
+                         int height, int columnBegin, int columnEnd) const
+    {
+        filterPadded(pImage + columnBegin, height, rowStride, columnEnd - columnBegin);
+
+        for (int y = 0; y < height; ++y)
+        {
+            const float *pRow = pImage + (3 + y) * rowStride;
+            Npp8u *pOut = pDst + y * nDstPitch;
+            for (int i = columnBegin; i < columnEnd; ++i)
+            {
+                pOut[i] = gaussian_detail::roundTo8u(pRow[i]);
+            }
+        }
+    }
+};
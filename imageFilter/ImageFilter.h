@@ -4,7 +4,19 @@
 #include <iostream>
 #include <helper_string.h>
 #include <helper_cuda.h>
+#include "BatchProcessor.h"
+#include "FilterGraph.h"
 #include "ImageProcessor.h"
+#if defined(__linux__)
+#include "JobServer.h"
+#endif
+#include "NumaTopology.h"
+#include "RingProcessor.h"
+#if defined(__linux__)
+#include "ShardProcessor.h"
+#endif
+#include "TaskScheduler.h"
+#include "TiledProcessor.h"
 
 #include <cuda_runtime.h>
 #include <npp.h>
@@ -15,6 +27,14 @@ class ImageFilter
 private:
     ArgsParser parser_;
 
+    static void printSchedulerStats()
+    {
+        const TaskScheduler::Stats stats = TaskScheduler::instance().stats();
+        std::cout << "Task scheduler: " << TaskScheduler::instance().threads() << " threads, " << stats.tasks
+                  << " tasks, " << stats.steals << " steals (" << stats.remoteSteals << " across NUMA nodes), "
+                  << stats.idle << " idle waits" << std::endl;
+    }
+
 public:
     int run(int argc, char *argv[])
     {
@@ -33,6 +53,129 @@ public:
             // Parse command line arguments
             ProcessingConfig config = parser_.parseArguments(argc, argv);
 
+            const std::vector<PipelineStage> stages = parser_.parsePipeline(config);
+
+            // the children do the work, so this process starts no pool
+            if (config.shards > 0)
+            {
+                if (!config.batchMode())
+                {
+                    throw std::runtime_error("--shards splits a batch from --input-dir or --file-list");
+                }
+#if defined(__linux__)
+                ShardProcessor shards(config, stages, argc, argv);
+                return shards.run() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+                throw std::runtime_error("--shards needs Unix datagram sockets, which are only supported on Linux");
+#endif
+            }
+
+            // before any thread starts, so that they all inherit it
+            if (config.numaNode >= 0)
+            {
+                pinToNumaNode(config.numaNode);
+            }
+
+            // one scheduler for every CPU engine, whatever the mode
+            TaskScheduler::instance().configure(config.threads, config.taskRows, config.numa);
+
+            if (!config.serveSocket.empty())
+            {
+                if (config.batchMode() || config.ringMode() || config.tileRows > 0)
+                {
+                    throw std::runtime_error("--serve takes single-image jobs from clients");
+                }
+#if defined(__linux__)
+                JobServer server(config, argc, argv);
+                server.run();
+                if (config.verbose)
+                {
+                    printSchedulerStats();
+                }
+                return EXIT_SUCCESS;
+#else
+                throw std::runtime_error("--serve needs Unix datagram sockets, which are only supported on Linux");
+#endif
+            }
+
+            if (config.ringMode())
+            {
+                if (config.batchMode() || config.tileRows > 0)
+                {
+                    throw std::runtime_error("Shared-memory mode takes its frames from --input-ring");
+                }
+                RingProcessor ring(config, stages);
+                ring.run();
+                if (config.verbose)
+                {
+                    printSchedulerStats();
+                }
+                return EXIT_SUCCESS;
+            }
+
+            if (config.tileRows > 0)
+            {
+                if (config.batchMode())
+                {
+                    throw std::runtime_error("--tile-rows processes a single --input");
+                }
+                TiledProcessor tiled(config, stages);
+                tiled.run();
+                if (config.verbose)
+                {
+                    printSchedulerStats();
+                }
+                return EXIT_SUCCESS;
+            }
+
+            if (config.batchMode())
+            {
+                BatchProcessor batch(config, stages);
+#if defined(__linux__)
+                std::unique_ptr<ShardReporter> reporter;
+                if (!config.shardReport.empty())
+                {
+                    reporter.reset(new ShardReporter(config));
+                    ShardReporter *pReporter = reporter.get();
+                    batch.setImageCallback([pReporter](const std::string &inputFile, const std::string &error) {
+                        pReporter->imageDone(inputFile, error);
+                    });
+                }
+                const int failures = batch.run();
+                if (reporter)
+                {
+                    reporter->finished(batch.summary());
+                }
+#else
+                // --shard-report is only passed to the children of --shards
+                const int failures = batch.run();
+#endif
+                if (config.verbose)
+                {
+                    printSchedulerStats();
+                }
+                return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+
+            if (!stages.empty())
+            {
+                if (config.verbose)
+                {
+                    std::cout << "Processing " << config.inputFile << " with pipeline "
+                              << config.pipeline << std::endl;
+                }
+
+                FilterGraph graph(stages, config.verbose);
+                graph.processImage(config.inputFile);
+                if (config.verbose)
+                {
+                    printSchedulerStats();
+                }
+
+                std::cout << "Image processing completed successfully!" << std::endl;
+                return EXIT_SUCCESS;
+            }
+
             if (config.verbose)
             {
                 std::cout << "Processing " << config.inputFile << " with filter type "
@@ -42,6 +185,10 @@ public:
             // Create processor and run
             ImageProcessor processor(config);
             processor.processImage();
+            if (config.verbose)
+            {
+                printSchedulerStats();
+            }
 
             std::cout << "Image processing completed successfully!" << std::endl;
             return EXIT_SUCCESS;
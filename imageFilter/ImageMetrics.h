@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+// Peak signal-to-noise ratio in dB between two 8-bit images of the same
+// size, over all channels. Identical images give +infinity.
+template <class Image>
+double psnr(const Image &a, const Image &b)
+{
+    if (a.width() != b.width() || a.height() != b.height())
+    {
+        throw std::runtime_error("PSNR needs images of the same size");
+    }
+
+    const unsigned int rowSize = a.width() * Image::gnChannels;
+    double squaredError = 0.0;
+    for (unsigned int y = 0; y < a.height(); ++y)
+    {
+        const auto *pA = a.data(0, y);
+        const auto *pB = b.data(0, y);
+        for (unsigned int i = 0; i < rowSize; ++i)
+        {
+            const double diff = static_cast<double>(pA[i]) - pB[i];
+            squaredError += diff * diff;
+        }
+    }
+
+    if (squaredError == 0.0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    const double mse = squaredError / (static_cast<double>(rowSize) * a.height());
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
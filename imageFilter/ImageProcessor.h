@@ -1,11 +1,16 @@
 #pragma once
 
 #include "Config.h"
+#include "CpuFilterEngine.h"
+#include "ImageMetrics.h"
+#include "InputImage.h"
 //#include "NPPDeviceBuffer.h"
 
+#include <chrono>
 #include <string>
 #include <functional>
 #include <cmath>
+#include <vector>
 
 #include <ImagesNPP.h>
 #include <npp.h>
@@ -16,6 +21,51 @@ class ImageProcessor
 {
 private:
     ProcessingConfig config_;
+    Backend backend_;
+    CpuFilterEngine cpuEngine_;
+
+    // Host images reused across processImage calls, so a processor that
+    // handles a batch of same-sized images only allocates once. The input
+    // is filtered straight from the decoder's buffer or the raw mapping.
+    InputImage input_;
+    npp::ImageCPU_8u_C3 hostDst_;
+    npp::ImageCPU_8u_P3 planarSrc_;
+    npp::ImageCPU_8u_P3 planarDst_;
+
+    // Filters with an NPP implementation; everything else is CPU only
+    static bool nppSupports(FilterType filterType)
+    {
+        return filterType == FilterType::SOBEL_HORIZONTAL ||
+               filterType == FilterType::SOBEL_VERTICAL ||
+               filterType == FilterType::MEDIAN;
+    }
+
+    // Resolve AUTO to NPP when a CUDA device is present and the filter has
+    // an NPP implementation, CPU otherwise
+    static Backend resolveBackend(const ProcessingConfig &config)
+    {
+        if (config.backend == Backend::NPP && !nppSupports(config.filterType))
+        {
+            throw std::runtime_error("Filter is not available on the NPP backend, use --backend=cpu");
+        }
+        if (config.backend != Backend::AUTO)
+        {
+            return config.backend;
+        }
+        if (!nppSupports(config.filterType))
+        {
+            return Backend::CPU;
+        }
+
+        int deviceCount = 0;
+        if (cudaGetDeviceCount(&deviceCount) != cudaSuccess)
+        {
+            // clear the sticky error left by a missing driver
+            cudaGetLastError();
+            return Backend::CPU;
+        }
+        return deviceCount > 0 ? Backend::NPP : Backend::CPU;
+    }
 
     // Helper methods
     // bool validateInputFile(const std::string &filename) const;
@@ -36,13 +86,20 @@ private:
 
         std::string result = inputFile;
         std::string::size_type dot = result.rfind('.');
+        std::string::size_type slash = result.rfind('/');
 
-        if (dot != std::string::npos)
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
         {
             result = result.substr(0, dot);
         }
 
-        result += suffix + ".png";
+        // batch runs write next to the input unless an output directory is given
+        if (!config_.outputDir.empty())
+        {
+            result = config_.outputDir + "/" + (slash == std::string::npos ? result : result.substr(slash + 1));
+        }
+
+        result += suffix + config_.outputExtension;
         return result;
     }
 
@@ -59,78 +116,589 @@ private:
     template <typename Func>
     void executeWithErrorHandling(Func &&func, const std::string &operationName) const;
 
-    // Common image processing template method
+    // Run an NPP filter on a host image: upload, filter, download
     template <typename FilterFunc>
-    void processImageWithFilter(const std::string &suffix,
-                                const std::string &operationName,
-                                FilterFunc &&filterOperation);
+    void filterOnDevice(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst,
+                        FilterFunc &&filterOperation);
+
+    GradientMode magnitudeMode() const
+    {
+        return config_.magnitudeNorm == MagnitudeNorm::L1 ? GradientMode::MAGNITUDE_L1 : GradientMode::MAGNITUDE_L2;
+    }
+
+    // Operator and mode of the gradient filters; false for other filters
+    bool gradientKernel(GradientOperator &op, GradientMode &mode) const
+    {
+        switch (config_.filterType)
+        {
+        case FilterType::SOBEL_HORIZONTAL:
+            op = GradientOperator::SOBEL;
+            mode = GradientMode::HORIZONTAL;
+            return true;
+        case FilterType::SOBEL_VERTICAL:
+            op = GradientOperator::SOBEL;
+            mode = GradientMode::VERTICAL;
+            return true;
+        case FilterType::SOBEL_MAGNITUDE:
+            op = GradientOperator::SOBEL;
+            mode = magnitudeMode();
+            return true;
+        case FilterType::SCHARR_HORIZONTAL:
+            op = GradientOperator::SCHARR;
+            mode = GradientMode::HORIZONTAL;
+            return true;
+        case FilterType::SCHARR_VERTICAL:
+            op = GradientOperator::SCHARR;
+            mode = GradientMode::VERTICAL;
+            return true;
+        case FilterType::SCHARR_MAGNITUDE:
+            op = GradientOperator::SCHARR;
+            mode = magnitudeMode();
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    NppiSize medianMaskSize() const
+    {
+        return {2 * config_.filterRadius + 5, 2 * config_.filterRadius + 5};
+    }
 
 public:
-    ImageProcessor(const ProcessingConfig &config) : config_(config) {}
+    ImageProcessor(const ProcessingConfig &config)
+        : config_(config), backend_(resolveBackend(config)), cpuEngine_(config.threads) {}
 
-    // Filter methods
+    Backend backend() const
+    {
+        return backend_;
+    }
 
-    void applySobelFilter()
+    // Filter methods; each filters a decoded host image into dst, a view of
+    // the same size
+
+    void applySobelFilter(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
     {
-        processImageWithFilter("_sobel", "Sobel Filter",
-                               [this](const npp::ImageNPP_8u_C3 &deviceSrc,
-                                      npp::ImageNPP_8u_C3 &deviceDst,
-                                      const NppiSize &filterROI,
-                                      const NppiSize &srcSize) {
-                                   const NppiPoint srcOffset = {0, 0};
+        if (backend_ == Backend::CPU)
+        {
+            cpuEngine_.sobelHorizontal(hostSrc, hostDst);
+            return;
+        }
+
+        filterOnDevice(hostSrc, hostDst,
+                       [this](const npp::ImageNPP_8u_C3 &deviceSrc,
+                              npp::ImageNPP_8u_C3 &deviceDst,
+                              const NppiSize &filterROI,
+                              const NppiSize &srcSize) {
+                           const NppiPoint srcOffset = {0, 0};
 
-                                   checkNppStatus(nppiFilterSobelHorizBorder_8u_C3R(
-                                       deviceSrc.data(), deviceSrc.pitch(), srcSize, srcOffset,
-                                       deviceDst.data(), deviceDst.pitch(), filterROI,
-                                       NppiBorderType::NPP_BORDER_REPLICATE));
-                               });
+                           checkNppStatus(nppiFilterSobelHorizBorder_8u_C3R(
+                               deviceSrc.data(), deviceSrc.pitch(), srcSize, srcOffset,
+                               deviceDst.data(), deviceDst.pitch(), filterROI,
+                               NppiBorderType::NPP_BORDER_REPLICATE));
+                       });
     }
 
-    void applyMedianFilter()
+    void applySobelVerticalFilter(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
     {
-        processImageWithFilter("_median", "Median Filter",
-                               [this](const npp::ImageNPP_8u_C3 &deviceSrc,
-                                      npp::ImageNPP_8u_C3 &deviceDst,
-                                      const NppiSize &filterROI,
-                                      const NppiSize &srcSize) {
-                                   const NppiPoint anchor = {0, 0};
-                                   const NppiSize maskSize  = {2 * config_.filterRadius + 5,
-                                                              2 * config_.filterRadius + 5};
+        if (backend_ == Backend::CPU)
+        {
+            cpuEngine_.gradient(hostSrc, hostDst, GradientOperator::SOBEL, GradientMode::VERTICAL);
+            return;
+        }
 
-                                   // Allocate device buffer
-                                   int bufferSize;
-                                   Npp8u *deviceBuffer;
-                                   checkNppStatus(nppiMinMaxGetBufferHostSize_8u_C3R(srcSize, &bufferSize));
-                                   cudaMalloc((void **)&deviceBuffer, bufferSize);
+        filterOnDevice(hostSrc, hostDst,
+                       [this](const npp::ImageNPP_8u_C3 &deviceSrc,
+                              npp::ImageNPP_8u_C3 &deviceDst,
+                              const NppiSize &filterROI,
+                              const NppiSize &srcSize) {
+                           const NppiPoint srcOffset = {0, 0};
 
-                                   checkNppStatus(nppiFilterMedian_8u_C3R(
-                                       deviceSrc.data(), deviceSrc.pitch(),
-                                       deviceDst.data(), deviceDst.pitch(),
-                                       filterROI, maskSize, anchor, deviceBuffer));
-                               });
+                           checkNppStatus(nppiFilterSobelVertBorder_8u_C3R(
+                               deviceSrc.data(), deviceSrc.pitch(), srcSize, srcOffset,
+                               deviceDst.data(), deviceDst.pitch(), filterROI,
+                               NppiBorderType::NPP_BORDER_REPLICATE));
+                       });
     }
 
+    // CPU-only gradient filters (Sobel/Scharr, single direction or magnitude)
+    void applyGradientFilter(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst,
+                             GradientOperator op, GradientMode mode)
+    {
+        cpuEngine_.gradient(hostSrc, hostDst, op, mode);
+    }
 
-    // Main processing method
-    void processImage()
+    void applyGaussianFilter(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
     {
-        if (!validateInputFile(config_.inputFile))
+        if (config_.verbose)
         {
-            throw std::runtime_error("Cannot open input file: " + config_.inputFile);
+            const bool recursive = selectGaussianEngine(config_.sigma) == GaussianEngine::RECURSIVE;
+            std::cout << "Gaussian sigma " << config_.sigma << " using "
+                      << (recursive ? "recursive" : "separable") << " engine" << std::endl;
+        }
+        cpuEngine_.gaussian(hostSrc, hostDst, config_.sigma);
+    }
+
+    void applyBilateralFilter(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
+    {
+        const BilateralEngine engine = config_.bilateralExact
+                                           ? BilateralEngine::EXACT
+                                           : selectBilateralEngine(config_.sigmaSpatial);
+        if (config_.verbose)
+        {
+            std::cout << "Bilateral sigma spatial " << config_.sigmaSpatial
+                      << ", range " << config_.sigmaRange << " using "
+                      << (engine == BilateralEngine::GRID ? "grid" : "exact")
+                      << " engine" << std::endl;
+        }
+        cpuEngine_.bilateral(hostSrc, hostDst, config_.sigmaSpatial, config_.sigmaRange, engine);
+
+        if (config_.reportPsnr && engine == BilateralEngine::GRID)
+        {
+            npp::ImageCPU_8u_C3 exact(hostSrc.size());
+            cpuEngine_.bilateral(hostSrc, exact, config_.sigmaSpatial,
+                                 config_.sigmaRange, BilateralEngine::EXACT);
+            std::cout << "Bilateral grid PSNR against exact: "
+                      << psnr(npp::ConstImageView_8u_C3(hostDst), npp::ConstImageView_8u_C3(exact)) << " dB"
+                      << std::endl;
+        }
+    }
+
+    void applyMedianFilter(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
+    {
+        if (backend_ == Backend::CPU)
+        {
+            const NppiPoint anchor = {0, 0};
+            cpuEngine_.median(hostSrc, hostDst, medianMaskSize(), anchor);
+            return;
+        }
+
+        filterOnDevice(hostSrc, hostDst,
+                       [this](const npp::ImageNPP_8u_C3 &deviceSrc,
+                              npp::ImageNPP_8u_C3 &deviceDst,
+                              const NppiSize &filterROI,
+                              const NppiSize &srcSize) {
+                           const NppiPoint anchor = {0, 0};
+                           const NppiSize maskSize = medianMaskSize();
+
+                           // Allocate device buffer
+                           int bufferSize;
+                           Npp8u *deviceBuffer;
+                           checkNppStatus(nppiMinMaxGetBufferHostSize_8u_C3R(srcSize, &bufferSize));
+                           cudaMalloc((void **)&deviceBuffer, bufferSize);
+
+                           const NppStatus status = nppiFilterMedian_8u_C3R(
+                               deviceSrc.data(), deviceSrc.pitch(),
+                               deviceDst.data(), deviceDst.pitch(),
+                               filterROI, maskSize, anchor, deviceBuffer);
+                           cudaFree(deviceBuffer);
+                           checkNppStatus(status);
+                       });
+    }
+
+    // Rows of context above and below a strip the filter needs so that
+    // filtering the strip on its own gives the same rows as filtering the
+    // whole image. The recursive Gaussian and the bilateral grid have no
+    // hard support limit; their halo covers the range where the response
+    // has decayed below rounding, and the grid is laid out relative to the
+    // strip, so seams can differ from a whole-image run by a level or two.
+    int haloRows() const
+    {
+        switch (config_.filterType)
+        {
+        case FilterType::MEDIAN:
+            return medianMaskSize().height - 1;
+        case FilterType::GAUSSIAN_SMOOTH:
+            return selectGaussianEngine(config_.sigma) == GaussianEngine::SEPARABLE
+                       ? SeparableGaussian(config_.sigma).radius()
+                       : static_cast<int>(std::ceil(6.0f * config_.sigma));
+        case FilterType::BILATERAL:
+            return config_.bilateralExact || selectBilateralEngine(config_.sigmaSpatial) == BilateralEngine::EXACT
+                       ? std::max(1, static_cast<int>(std::ceil(2.0f * config_.sigmaSpatial)))
+                       : static_cast<int>(std::ceil(4.0f * config_.sigmaSpatial));
+        case FilterType::THRESHOLD:
+            return 0;
+        default:
+            return 1; // 3x3 gradients
+        }
+    }
+
+    void applyThresholdFilter(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
+    {
+        cpuEngine_.threshold(hostSrc, hostDst, config_.threshold);
+    }
+
+    // Layout this stage runs in when its input arrives in inputLayout: the
+    // CPU median is faster on planes (see PlanarLayout.h), the threshold
+    // runs in either layout and everything else needs packed pixels. Fused
+    // stages always run packed.
+    ImageLayout preferredLayout(ImageLayout inputLayout) const
+    {
+        if (backend_ != Backend::CPU)
+        {
+            return ImageLayout::PACKED;
+        }
+        switch (config_.filterType)
+        {
+        case FilterType::MEDIAN:
+            return ImageLayout::PLANAR;
+        case FilterType::THRESHOLD:
+            return inputLayout;
+        default:
+            return ImageLayout::PACKED;
+        }
+    }
+
+    // Filter planar images; only for stages whose preferredLayout can be
+    // PLANAR. dst is reallocated only if its size differs from src
+    void filterImage(const npp::ImageCPU_8u_P3 &planarSrc, npp::ImageCPU_8u_P3 &planarDst)
+    {
+        if (planarDst.size() != planarSrc.size())
+        {
+            planarDst = npp::ImageCPU_8u_P3(planarSrc.size());
+        }
+
+        const NppiPoint anchor = {0, 0};
+        switch (config_.filterType)
+        {
+        case FilterType::MEDIAN:
+            cpuEngine_.median(planarSrc, planarDst, medianMaskSize(), anchor);
+            break;
+        case FilterType::THRESHOLD:
+            cpuEngine_.threshold(planarSrc, planarDst, config_.threshold);
+            break;
+        default:
+            throw std::runtime_error("Filter has no planar implementation");
+        }
+    }
+
+    // Packed to planar and back, reusing dst when it has the right size
+    void deinterleave(const npp::ConstImageView_8u_C3 &src, npp::ImageCPU_8u_P3 &dst) const
+    {
+        if (dst.size() != src.size())
+        {
+            dst = npp::ImageCPU_8u_P3(src.size());
+        }
+        cpuEngine_.deinterleave(src, dst);
+    }
+
+    void interleave(const npp::ImageCPU_8u_P3 &src, npp::ImageCPU_8u_C3 &dst) const
+    {
+        if (dst.size() != src.size())
+        {
+            dst = npp::ImageCPU_8u_C3(src.size());
+        }
+        cpuEngine_.interleave(src, dst);
+    }
+
+    void interleave(const npp::ImageCPU_8u_P3 &src, const npp::ImageView_8u_C3 &dst) const
+    {
+        cpuEngine_.interleave(src, dst);
+    }
+
+    // Number of the stages in next (each the only input of the one after)
+    // that can run in a single pass with this one, keeping the intermediate
+    // rows in cache:
+    //     gaussian -> gradient [-> threshold]
+    //     median -> threshold
+    //     gradient -> threshold
+    // The fused kernels are bit-exact with running the stages one by one.
+    // Only the CPU backend fuses; --no-fusion turns it off.
+    size_t fusableStages(const std::vector<const ImageProcessor *> &next) const
+    {
+        if (!config_.fusion || next.empty() || backend_ != Backend::CPU || next[0]->backend_ != Backend::CPU)
+        {
+            return 0;
+        }
+
+        const bool thresholdFollows = next.size() > 1 && next[1]->config_.filterType == FilterType::THRESHOLD;
+        GradientOperator op = GradientOperator::SOBEL;
+        GradientMode mode = GradientMode::HORIZONTAL;
+
+        // the recursive engine is not row-local, so it cannot feed the
+        // gradient a row at a time
+        if (config_.filterType == FilterType::GAUSSIAN_SMOOTH &&
+            selectGaussianEngine(config_.sigma) == GaussianEngine::SEPARABLE &&
+            next[0]->gradientKernel(op, mode))
+        {
+            return thresholdFollows ? 2 : 1;
+        }
+        if ((config_.filterType == FilterType::MEDIAN || gradientKernel(op, mode)) &&
+            next[0]->config_.filterType == FilterType::THRESHOLD)
+        {
+            return 1;
+        }
+        return 0;
+    }
+
+    // Run this stage and the first fusableStages(next) stages of next as
+    // one pass
+    void filterImageFused(const std::vector<const ImageProcessor *> &next,
+                          const npp::ConstImageView_8u_C3 &hostSrc, npp::ImageCPU_8u_C3 &hostDst)
+    {
+        if (hostDst.size() != hostSrc.size())
+        {
+            hostDst = npp::ImageCPU_8u_C3(hostSrc.size());
+        }
+        filterImageFused(next, hostSrc, hostDst.view());
+    }
+
+    // The same into a view of src's size
+    void filterImageFused(const std::vector<const ImageProcessor *> &next,
+                          const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
+    {
+        const size_t fused = fusableStages(next);
+        if (fused == 0)
+        {
+            filterImage(hostSrc, hostDst);
+            return;
+        }
+
+        const ThresholdEpilogue threshold = {next[fused - 1]->config_.threshold};
+        GradientOperator op = GradientOperator::SOBEL;
+        GradientMode mode = GradientMode::HORIZONTAL;
+
+        if (config_.filterType == FilterType::GAUSSIAN_SMOOTH)
+        {
+            if (!next[0]->gradientKernel(op, mode))
+            {
+                throw std::runtime_error("Fused Gaussian stage is not followed by a gradient filter");
+            }
+            if (fused == 2)
+            {
+                cpuEngine_.gaussianGradient(hostSrc, hostDst, config_.sigma, op, mode, threshold);
+            }
+            else
+            {
+                cpuEngine_.gaussianGradient(hostSrc, hostDst, config_.sigma, op, mode);
+            }
+        }
+        else if (config_.filterType == FilterType::MEDIAN)
+        {
+            const NppiPoint anchor = {0, 0};
+            cpuEngine_.median(hostSrc, hostDst, medianMaskSize(), anchor, MedianEngine::AUTO, threshold);
+        }
+        else
+        {
+            if (!gradientKernel(op, mode))
+            {
+                throw std::runtime_error("Filter cannot be fused with the threshold stage");
+            }
+            cpuEngine_.gradient(hostSrc, hostDst, op, mode, threshold);
+        }
+    }
+
+    // Output file name suffix and display name of the configured filter
+    const char *filterSuffix() const
+    {
+        switch (config_.filterType)
+        {
+        case FilterType::SOBEL_HORIZONTAL:
+            return "_sobel";
+        case FilterType::SOBEL_VERTICAL:
+            return "_sobel_vert";
+        case FilterType::SOBEL_MAGNITUDE:
+            return "_sobel_mag";
+        case FilterType::SCHARR_HORIZONTAL:
+            return "_scharr_horiz";
+        case FilterType::SCHARR_VERTICAL:
+            return "_scharr_vert";
+        case FilterType::SCHARR_MAGNITUDE:
+            return "_scharr_mag";
+        case FilterType::MEDIAN:
+            return "_median";
+        case FilterType::GAUSSIAN_SMOOTH:
+            return "_smooth";
+        case FilterType::BILATERAL:
+            return "_bilateral";
+        case FilterType::THRESHOLD:
+            return "_threshold";
+        default:
+            throw std::runtime_error("Unknown or unsupported filter type");
+        }
+    }
+
+    const char *filterName() const
+    {
+        switch (config_.filterType)
+        {
+        case FilterType::SOBEL_HORIZONTAL:
+            return "Sobel Filter";
+        case FilterType::SOBEL_VERTICAL:
+            return "Sobel Vertical Filter";
+        case FilterType::SOBEL_MAGNITUDE:
+            return "Sobel Magnitude Filter";
+        case FilterType::SCHARR_HORIZONTAL:
+            return "Scharr Horizontal Filter";
+        case FilterType::SCHARR_VERTICAL:
+            return "Scharr Vertical Filter";
+        case FilterType::SCHARR_MAGNITUDE:
+            return "Scharr Magnitude Filter";
+        case FilterType::MEDIAN:
+            return "Median Filter";
+        case FilterType::GAUSSIAN_SMOOTH:
+            return "Gaussian Filter";
+        case FilterType::BILATERAL:
+            return "Bilateral Filter";
+        case FilterType::THRESHOLD:
+            return "Threshold Filter";
+        default:
+            throw std::runtime_error("Unknown or unsupported filter type");
+        }
+    }
+
+    std::string outputFilename(const std::string &inputFile) const
+    {
+        return generateOutputFilename(inputFile, filterSuffix());
+    }
+
+    std::string outputFilename(const std::string &inputFile, const std::string &suffix) const
+    {
+        return generateOutputFilename(inputFile, suffix);
+    }
+
+    // Decode an image file into a top-down host image
+    static void decodeImage(const std::string &inputFile, npp::ImageCPU_8u_C3 &image)
+    {
+        npp::loadImage8uC3(inputFile, image);
+        if (image.width() == 0 || image.height() == 0)
+        {
+            throw std::runtime_error("Cannot decode input file: " + inputFile);
+        }
+    }
+
+    // Encoder settings (--png-level, --jpeg-quality, --fast-encode,
+    // --png-threads)
+    static npp::EncodeOptions encodeOptions(const ProcessingConfig &config)
+    {
+        npp::EncodeOptions options;
+        options.nPngLevel = config.pngLevel;
+        options.nJpegQuality = config.jpegQuality;
+        options.nPngThreads = config.pngThreads;
+        return options;
+    }
+
+    // Encode an image file; throws if the file cannot be written
+    static void encodeImage(const std::string &outputFile, const npp::ImageCPU_8u_C3 &image,
+                            const npp::EncodeOptions &options = npp::EncodeOptions())
+    {
+        if (!saveImage8uC3(outputFile, image, FIF_UNKNOWN, options))
+        {
+            throw std::runtime_error("Cannot write output file: " + outputFile);
+        }
+    }
+
+    // Filter one decoded image with the configured filter; dst is
+    // reallocated only if its size differs from src
+    void filterImage(const npp::ConstImageView_8u_C3 &hostSrc, npp::ImageCPU_8u_C3 &hostDst)
+    {
+        if (hostDst.size() != hostSrc.size())
+        {
+            hostDst = npp::ImageCPU_8u_C3(hostSrc.size());
+        }
+        filterImage(hostSrc, hostDst.view());
+    }
+
+    // The same into a view of src's size, such as a slot of a FrameRing
+    void filterImage(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst)
+    {
+        if (hostDst.size() != hostSrc.size())
+        {
+            throw std::runtime_error("Filter output size differs from the input's");
         }
 
         switch (config_.filterType)
         {
         case FilterType::SOBEL_HORIZONTAL:
-            applySobelFilter();
+            applySobelFilter(hostSrc, hostDst);
+            break;
+        case FilterType::SOBEL_VERTICAL:
+            applySobelVerticalFilter(hostSrc, hostDst);
+            break;
+        case FilterType::SOBEL_MAGNITUDE:
+            applyGradientFilter(hostSrc, hostDst, GradientOperator::SOBEL, magnitudeMode());
+            break;
+        case FilterType::SCHARR_HORIZONTAL:
+            applyGradientFilter(hostSrc, hostDst, GradientOperator::SCHARR, GradientMode::HORIZONTAL);
+            break;
+        case FilterType::SCHARR_VERTICAL:
+            applyGradientFilter(hostSrc, hostDst, GradientOperator::SCHARR, GradientMode::VERTICAL);
+            break;
+        case FilterType::SCHARR_MAGNITUDE:
+            applyGradientFilter(hostSrc, hostDst, GradientOperator::SCHARR, magnitudeMode());
             break;
         case FilterType::MEDIAN:
-            applyMedianFilter();
+            applyMedianFilter(hostSrc, hostDst);
+            break;
+        case FilterType::GAUSSIAN_SMOOTH:
+            applyGaussianFilter(hostSrc, hostDst);
+            break;
+        case FilterType::BILATERAL:
+            applyBilateralFilter(hostSrc, hostDst);
+            break;
+        case FilterType::THRESHOLD:
+            applyThresholdFilter(hostSrc, hostDst);
             break;
         default:
             throw std::runtime_error("Unknown or unsupported filter type");
         }
     }
+
+    // Process another input file with the same filter and settings
+    void processImage(const std::string &inputFile)
+    {
+        config_.inputFile = inputFile;
+        processImage();
+    }
+
+    // Main processing method: decode, filter and encode config.inputFile
+    void processImage()
+    {
+        if (!validateInputFile(config_.inputFile))
+        {
+            throw std::runtime_error("Cannot open input file: " + config_.inputFile);
+        }
+
+        if (config_.verbose)
+        {
+            std::cout << "Using " << (backend_ == Backend::CPU ? "CPU" : "NPP") << " backend";
+            if (backend_ == Backend::CPU)
+            {
+                std::cout << " with " << cpuEngine_.threads() << " threads, "
+                          << simdLevelName(simdLevel()) << " kernels";
+            }
+            std::cout << std::endl;
+        }
+
+        const std::string operationName = filterName();
+        const std::string outputFile = outputFilename(config_.inputFile);
+
+        executeWithErrorHandling([&]() {
+            input_.load(config_.inputFile, config_);
+            if (preferredLayout(ImageLayout::PACKED) == ImageLayout::PLANAR)
+            {
+                deinterleave(input_.view(), planarSrc_);
+                filterImage(planarSrc_, planarDst_);
+                interleave(planarDst_, hostDst_);
+            }
+            else
+            {
+                filterImage(input_.view(), hostDst_);
+            }
+
+            if (config_.verbose)
+            {
+                std::cout << "Saving " << operationName << " filtered image to: " << outputFile << std::endl;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            encodeImage(outputFile, hostDst_, encodeOptions(config_));
+            if (config_.verbose)
+            {
+                const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                std::cout << "Encoded in " << elapsed.count() << " ms" << std::endl;
+            }
+        }, operationName);
+    }
 };
 
 // Template method implementations (must be in header)
@@ -148,55 +716,66 @@ void ImageProcessor::executeWithErrorHandling(Func &&func, const std::string &op
     catch (const npp::Exception &e)
     {
         std::cerr << "NPP Error in " << operationName << ": " << e << std::endl;
-        cudaDeviceReset();
+        if (backend_ == Backend::NPP && !config_.sharedProcess())
+        {
+            cudaDeviceReset();
+        }
         throw;
     }
     catch (const std::exception &e)
     {
         std::cerr << "Error in " << operationName << ": " << e.what() << std::endl;
-        cudaDeviceReset();
+        if (backend_ == Backend::NPP && !config_.sharedProcess())
+        {
+            cudaDeviceReset();
+        }
         throw;
     }
     catch (...)
     {
         std::cerr << "Unknown error in " << operationName << std::endl;
-        cudaDeviceReset();
+        if (backend_ == Backend::NPP && !config_.sharedProcess())
+        {
+            cudaDeviceReset();
+        }
         throw;
     }
 }
 
 template <typename FilterFunc>
-void ImageProcessor::processImageWithFilter(const std::string &suffix,
-                                            const std::string &operationName,
-                                            FilterFunc &&filterOperation)
+void ImageProcessor::filterOnDevice(const npp::ConstImageView_8u_C3 &hostSrc, const npp::ImageView_8u_C3 &hostDst,
+                                    FilterFunc &&filterOperation)
 {
-    const std::string outputFile = generateOutputFilename(config_.inputFile, suffix);
-
-    executeWithErrorHandling([&]() {
-        // Load source image
-        npp::ImageCPU_8u_C3 hostSrc;
-        npp::loadImage8uC3(config_.inputFile, hostSrc);
-
-        // Upload to device
-        npp::ImageNPP_8u_C3 deviceSrc(hostSrc);
-        npp::ImageNPP_8u_C3 deviceDst(deviceSrc.width(), deviceSrc.height());
-
-        // Set up common filter parameters
-        const NppiSize filterROI = {static_cast<int>(deviceSrc.width()),
-                                    static_cast<int>(deviceSrc.height())};
-        const NppiSize srcSize = filterROI;
+    // Upload to device; cudaMemcpy2D needs a positive pitch, so a bottom-up
+    // decoder buffer goes through a top-down host copy
+    npp::ImageCPU_8u_C3 topDown;
+    npp::ConstImageView_8u_C3 upload = hostSrc;
+    if (hostSrc.pitch() < 0)
+    {
+        topDown = npp::ImageCPU_8u_C3(hostSrc.size());
+        npp::copyPixels(hostSrc, topDown.view());
+        upload = topDown;
+    }
+    npp::ImageNPP_8u_C3 deviceSrc(upload.width(), upload.height());
+    npp::ImageAllocator<Npp8u, 3>::HostToDeviceCopy2D(deviceSrc.data(), deviceSrc.pitch(), upload.data(),
+                                                      upload.pitch(), upload.width(), upload.height());
+    npp::ImageNPP_8u_C3 deviceDst(deviceSrc.width(), deviceSrc.height());
 
-        // Apply the specific filter operation
-        filterOperation(deviceSrc, deviceDst, filterROI, srcSize);
+    // Set up common filter parameters
+    const NppiSize filterROI = {static_cast<int>(deviceSrc.width()),
+                                static_cast<int>(deviceSrc.height())};
+    const NppiSize srcSize = filterROI;
 
-        // Copy result back to host and save
-        npp::ImageCPU_8u_C3 hostDst(deviceDst.size());
-        deviceDst.copyTo(hostDst.data(), hostDst.pitch());
+    // Apply the specific filter operation
+    filterOperation(deviceSrc, deviceDst, filterROI, srcSize);
 
-        if (config_.verbose)
-        {
-            std::cout << "Saving " << operationName << " filtered image to: " << outputFile << std::endl;
-        }
-        saveImage8uC3(outputFile, hostDst);
-    }, operationName);
-}
\ No newline at end of file
+    // Copy result back to host, through a top-down copy for a bottom-up view
+    if (hostDst.pitch() < 0)
+    {
+        npp::ImageCPU_8u_C3 result(hostDst.size());
+        deviceDst.copyTo(result.data(), result.pitch());
+        npp::copyPixels(result.view(), hostDst);
+        return;
+    }
+    deviceDst.copyTo(hostDst.data(), hostDst.pitch());
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "Config.h"
+#include "PlanarLayout.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <regex>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ImageIO.h>
+#include <ImagesCPU.h>
+
+// Geometry of a headerless 8-bit raw frame: rows of width * channels
+// bytes with no padding
+struct RawFormat
+{
+    unsigned int width;
+    unsigned int height;
+    int channels;
+};
+
+inline bool isRawFile(const std::string &path)
+{
+    const std::string::size_type dot = path.rfind('.');
+    if (dot == std::string::npos)
+    {
+        return false;
+    }
+    std::string extension = path.substr(dot);
+    for (char &c : extension)
+    {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return extension == ".raw";
+}
+
+// --raw-size and --raw-channels win; otherwise the file name gives the
+// geometry, as in Common/data: name_<W>x<H>_8u[_Gray].raw is one channel
+// and name_<W>x<H>_8u_C3.raw three
+inline RawFormat rawFormat(const std::string &path, const ProcessingConfig &config)
+{
+    RawFormat format = {0, 0, 1};
+    const std::string name = path.substr(path.rfind('/') == std::string::npos ? 0 : path.rfind('/') + 1);
+    std::smatch match;
+    if (std::regex_search(name, match, std::regex("_([0-9]+)x([0-9]+)_8u(_C([13]))?")))
+    {
+        format.width = static_cast<unsigned int>(std::stoul(match[1]));
+        format.height = static_cast<unsigned int>(std::stoul(match[2]));
+        format.channels = match[4].matched ? std::stoi(match[4]) : 1;
+    }
+    if (config.rawWidth > 0)
+    {
+        format.width = static_cast<unsigned int>(config.rawWidth);
+        format.height = static_cast<unsigned int>(config.rawHeight);
+    }
+    if (config.rawChannels > 0)
+    {
+        format.channels = config.rawChannels;
+    }
+    if (format.width == 0 || format.height == 0)
+    {
+        throw std::runtime_error("Raw input needs --raw-size=<W>x<H> or a name like frame_<W>x<H>_8u.raw: " + path);
+    }
+    return format;
+}
+
+// A raw file mapped read-only into memory. Pages are read on first touch
+// and the kernel is told the access is sequential, so it reads ahead and
+// drops pages behind; large mappings also ask for huge pages where the
+// file system supports them. The hints are best effort.
+class MappedRawFile
+{
+private:
+    const Npp8u *data_;
+    size_t size_;
+    RawFormat format_;
+
+public:
+    MappedRawFile(const std::string &path, const RawFormat &format) : data_(nullptr), size_(0), format_(format)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open input file: " + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(errno));
+        }
+
+        size_ = static_cast<size_t>(info.st_size);
+        const size_t expected = static_cast<size_t>(format.width) * format.height * format.channels;
+        if (size_ != expected)
+        {
+            close(fd);
+            throw std::runtime_error("Raw file " + path + " has " + std::to_string(size_) + " bytes, " +
+                                     std::to_string(format.width) + "x" + std::to_string(format.height) + "x" +
+                                     std::to_string(format.channels) + " needs " + std::to_string(expected));
+        }
+
+        void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+        }
+        data_ = static_cast<const Npp8u *>(mapping);
+
+        madvise(mapping, size_, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        if (size_ >= (2u << 20))
+        {
+            madvise(mapping, size_, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    MappedRawFile(const MappedRawFile &) = delete;
+    MappedRawFile &operator=(const MappedRawFile &) = delete;
+
+    ~MappedRawFile()
+    {
+        munmap(const_cast<Npp8u *>(data_), size_);
+    }
+
+    const RawFormat &format() const
+    {
+        return format_;
+    }
+
+    // The mapped pixels, without copying; N must be the file's channels
+    template <size_t N>
+    npp::ImageView<const Npp8u, N> view() const
+    {
+        if (static_cast<size_t>(format_.channels) != N)
+        {
+            throw std::runtime_error("Raw file has " + std::to_string(format_.channels) + " channels");
+        }
+        return npp::ImageView<const Npp8u, N>(data_, static_cast<int>(format_.width * N), format_.width,
+                                              format_.height);
+    }
+};
+
+// An input image ready for filtering, whatever its source: a FreeImage
+// file decoded in place, or a raw file mapped into memory. Three-channel
+// raw files are filtered straight from the mapping; one-channel ones are
+// expanded to gray RGB once, since the filters take three channels.
+class InputImage
+{
+private:
+    npp::DecodedImage8uC3 decoded_;
+    std::unique_ptr<MappedRawFile> raw_;
+    npp::ImageCPU_8u_C3 expanded_;
+    npp::ConstImageView_8u_C3 view_;
+
+public:
+    // Throws if the file cannot be read; raw geometry comes from config
+    // or the file name (see rawFormat)
+    void load(const std::string &path, const ProcessingConfig &config)
+    {
+        view_ = npp::ConstImageView_8u_C3();
+        decoded_.reset(0);
+        raw_.reset();
+
+        if (!isRawFile(path))
+        {
+            npp::decodeImage8uC3(path, decoded_);
+            if (decoded_.width() == 0 || decoded_.height() == 0)
+            {
+                throw std::runtime_error("Cannot decode input file: " + path);
+            }
+            view_ = decoded_.view();
+            return;
+        }
+
+        const RawFormat format = rawFormat(path, config);
+        if (format.channels != 1 && format.channels != 3)
+        {
+            throw std::runtime_error("Raw input must have 1 or 3 channels");
+        }
+        raw_.reset(new MappedRawFile(path, format));
+        if (format.channels == 3)
+        {
+            view_ = raw_->view<3>();
+            return;
+        }
+
+        const npp::ImageView<const Npp8u, 1> gray = raw_->view<1>();
+        if (expanded_.size() != gray.size())
+        {
+            expanded_ = npp::ImageCPU_8u_C3(gray.size());
+        }
+        for (unsigned int y = 0; y < gray.height(); ++y)
+        {
+            const Npp8u *const planes[3] = {gray.data(0, y), gray.data(0, y), gray.data(0, y)};
+            interleaveRow(planes, expanded_.data(0, y), static_cast<int>(gray.width()));
+        }
+        raw_.reset();
+        view_ = expanded_;
+    }
+
+    const npp::ConstImageView_8u_C3 &view() const
+    {
+        return view_;
+    }
+
+    unsigned int width() const
+    {
+        return view_.width();
+    }
+
+    unsigned int height() const
+    {
+        return view_.height();
+    }
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Messages between the --serve job server (JobServer.h) and its clients,
+// one Unix datagram each. A job is a list of imageFilter arguments, each
+// followed by a NUL, e.g. "--input=/data/a.png\0--filter=median\0"; paths
+// are resolved in the server's working directory, so clients send them
+// absolute. The server answers "ok <milliseconds>" or "error <message>" to
+// the socket the job came from. A job made of the single argument
+// "shutdown" makes the server finish the queued jobs and exit; it is
+// answered "ok" and a summary once they are done.
+const size_t kMaxJobMessage = 64 * 1024;
+const char *const kShutdownJob = "shutdown";
+
+inline std::string encodeJob(const std::vector<std::string> &args)
+{
+    std::string message;
+    for (const std::string &arg : args)
+    {
+        message.append(arg).push_back('\0');
+    }
+    return message;
+}
+
+inline std::vector<std::string> decodeJob(const char *data, size_t size)
+{
+    std::vector<std::string> args;
+    size_t begin = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (data[i] == '\0')
+        {
+            args.emplace_back(data + begin, i - begin);
+            begin = i + 1;
+        }
+    }
+    if (begin < size)
+    {
+        args.emplace_back(data + begin, size - begin);
+    }
+    return args;
+}
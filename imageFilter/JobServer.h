@@ -0,0 +1,223 @@
+#pragma once
+
+#include "ArgsParser.h"
+#include "BoundedQueue.h"
+#include "Config.h"
+#include "EncoderPool.h"
+#include "FilterGraph.h"
+#include "ImageProcessor.h"
+#include "JobProtocol.h"
+#include "ParallelFor.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <helper_multiprocess.h>
+
+// --serve mode: a long-lived process that runs single-image jobs sent over
+// a Unix datagram socket (JobProtocol.h), so process start-up, FreeImage
+// initialisation and CUDA context creation are paid once instead of per
+// image. The main thread receives jobs and queues them for --workers
+// threads; a full queue stops it receiving, and clients then block in
+// sendto until a worker frees a slot. A job's arguments are parsed after
+// the server's own command line, so server options (backend, encoder
+// settings, ...) are defaults that each job can override.
+class JobServer
+{
+private:
+    struct Job
+    {
+        std::vector<std::string> args;
+        std::string client;
+    };
+
+    ProcessingConfig config_;
+    std::vector<std::string> baseArgs_; // server command line without --serve
+    int workers_;
+    ipcHandle *socket_;
+
+    std::mutex logMutex_;
+    std::atomic<size_t> succeeded_;
+    std::atomic<size_t> failed_;
+
+    // Run one job, encoding its outputs on the worker's encoders unless it
+    // asks for its own --encode-threads; returns its time in ms
+    double runJob(const std::vector<std::string> &jobArgs, EncoderPool &encoders)
+    {
+        bool hasInput = false;
+        for (const std::string &arg : jobArgs)
+        {
+            hasInput = hasInput || arg.compare(0, 8, "--input=") == 0;
+        }
+        if (!hasInput)
+        {
+            throw std::runtime_error("A job needs --input=<file>");
+        }
+
+        std::vector<std::string> args(baseArgs_);
+        args.insert(args.end(), jobArgs.begin(), jobArgs.end());
+        std::vector<char *> argv;
+        for (std::string &arg : args)
+        {
+            argv.push_back(&arg[0]);
+        }
+
+        ArgsParser parser;
+        ProcessingConfig config = parser.parseArguments(static_cast<int>(argv.size()), argv.data());
+        if (config.batchMode() || config.ringMode() || config.tileRows > 0 || !config.serveSocket.empty())
+        {
+            throw std::runtime_error("A job processes a single --input");
+        }
+        config.serveSocket = config_.serveSocket;
+
+        // jobs share the scheduler's threads for their tiles; PNG outputs
+        // are deflated on one thread each, as in batch mode
+        if (config.pngThreads == 0)
+        {
+            config.pngThreads = 1;
+        }
+        const std::vector<PipelineStage> stages = parser.parsePipeline(config);
+
+        const auto start = std::chrono::steady_clock::now();
+        if (!stages.empty())
+        {
+            FilterGraph graph(stages, config.verbose);
+            graph.processImage(config.inputFile,
+                               config.encodeThreads == config_.encodeThreads ? &encoders : nullptr);
+        }
+        else
+        {
+            ImageProcessor processor(config);
+            processor.processImage();
+        }
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    void reply(const std::string &client, const std::string &message)
+    {
+        if (!client.empty() && ipcSendDataTo(socket_, client.c_str(), message.data(), message.size()) != 0)
+        {
+            std::lock_guard<std::mutex> lock(logMutex_);
+            std::cerr << "Cannot reply to " << client << ": " << strerror(errno) << std::endl;
+        }
+    }
+
+    void work(BoundedQueue<Job> &queue)
+    {
+        // started once for every job of this worker; one thread unless
+        // --encode-threads is given, as the workers keep every core busy
+        EncoderPool encoders(config_.encodeThreads > 0 ? config_.encodeThreads : 1,
+                             ImageProcessor::encodeOptions(config_));
+        Job job;
+        while (queue.pop(job))
+        {
+            std::ostringstream message;
+            try
+            {
+                const double milliseconds = runJob(job.args, encoders);
+                message << "ok " << milliseconds;
+                ++succeeded_;
+            }
+            catch (const npp::Exception &e)
+            {
+                message << "error " << e.toString();
+                ++failed_;
+            }
+            catch (const std::exception &e)
+            {
+                message << "error " << e.what();
+                ++failed_;
+            }
+            reply(job.client, message.str());
+
+            if (config_.verbose)
+            {
+                std::lock_guard<std::mutex> lock(logMutex_);
+                std::cout << "Job from " << (job.client.empty() ? "?" : job.client) << ": " << message.str()
+                          << std::endl;
+            }
+        }
+    }
+
+public:
+    JobServer(const ProcessingConfig &config, int argc, char *argv[])
+        : config_(config), workers_(resolveThreadCount(config.workers)), socket_(nullptr), succeeded_(0), failed_(0)
+    {
+        for (int i = 0; i < argc; ++i)
+        {
+            if (i == 0 || strncmp(argv[i], "--serve", 7) != 0)
+            {
+                baseArgs_.push_back(argv[i]);
+            }
+        }
+    }
+
+    JobServer(const JobServer &) = delete;
+    JobServer &operator=(const JobServer &) = delete;
+
+    // Serve until a shutdown job arrives; returns once the queued jobs are
+    // done
+    void run()
+    {
+        if (ipcCreateSocket(socket_, config_.serveSocket.c_str(), std::vector<Process>()) != 0)
+        {
+            throw std::runtime_error("Cannot listen on " + config_.serveSocket);
+        }
+        std::cout << "Serving on " << config_.serveSocket << " with " << workers_ << " workers" << std::endl;
+
+        BoundedQueue<Job> queue(2 * static_cast<size_t>(workers_));
+        std::vector<std::thread> threads;
+        for (int i = 0; i < workers_; ++i)
+        {
+            threads.emplace_back([this, &queue]() { work(queue); });
+        }
+
+        std::vector<char> buffer(kMaxJobMessage);
+        char sender[sizeof(sockaddr_un::sun_path)];
+        std::string stopClient;
+        for (;;)
+        {
+            const int size = ipcRecvDataFrom(socket_, buffer.data(), buffer.size(), sender, sizeof(sender));
+            if (size < 0)
+            {
+                break;
+            }
+            if (static_cast<size_t>(size) > buffer.size())
+            {
+                reply(sender, "error Job larger than " + std::to_string(kMaxJobMessage) + " bytes");
+                continue;
+            }
+
+            Job job = {decodeJob(buffer.data(), size), sender};
+            if (job.args.size() == 1 && job.args[0] == kShutdownJob)
+            {
+                stopClient = job.client;
+                break;
+            }
+            queue.push(job);
+        }
+
+        queue.close();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        std::ostringstream summary;
+        summary << "Served " << succeeded_ + failed_ << " jobs, " << failed_ << " failed";
+        std::cout << summary.str() << std::endl;
+        reply(stopClient, "ok " + summary.str());
+        ipcCloseSocket(socket_);
+        socket_ = nullptr;
+    }
+};
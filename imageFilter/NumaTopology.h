@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#include <ImagesCPU.h>
+
+// NUMA nodes of the host and the CPUs in each, read from
+// /sys/devices/system/node. Hosts without that directory (or non-Linux
+// ones) look like a single node holding every CPU.
+struct NumaNode
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+// Parse a kernel CPU list such as "0-3,8-11"
+inline std::vector<int> parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        if (range.find_first_not_of(" \t\r\n") == std::string::npos)
+        {
+            continue;
+        }
+        const std::string::size_type dash = range.find('-');
+        const int first = std::atoi(range.c_str());
+        const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// The host's nodes with at least one CPU, by id
+inline std::vector<NumaNode> numaNodes()
+{
+    std::vector<NumaNode> nodes;
+#if defined(__linux__)
+    if (DIR *dir = opendir("/sys/devices/system/node"))
+    {
+        while (dirent *entry = readdir(dir))
+        {
+            const std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.find_first_not_of("0123456789", 4) != std::string::npos ||
+                name.size() == 4)
+            {
+                continue;
+            }
+            std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            NumaNode node = {std::atoi(name.c_str() + 4), parseCpuList(list)};
+            if (!node.cpus.empty())
+            {
+                nodes.push_back(node);
+            }
+        }
+        closedir(dir);
+    }
+#endif
+
+    if (nodes.empty())
+    {
+        const unsigned int hw = std::thread::hardware_concurrency();
+        NumaNode node = {0, std::vector<int>()};
+        for (unsigned int cpu = 0; cpu < (hw > 0 ? hw : 1); ++cpu)
+        {
+            node.cpus.push_back(static_cast<int>(cpu));
+        }
+        nodes.push_back(node);
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+    return nodes;
+}
+
+// The nodes as seen by the calling thread: only the CPUs it may run on
+// (after taskset, --numa-node, ...), and only nodes left with one
+inline std::vector<NumaNode> allowedNumaNodes()
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return numaNodes();
+    }
+
+    std::vector<NumaNode> nodes;
+    for (NumaNode node : numaNodes())
+    {
+        node.cpus.erase(std::remove_if(node.cpus.begin(), node.cpus.end(),
+                                       [&](int cpu) { return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed); }),
+                        node.cpus.end());
+        if (!node.cpus.empty())
+        {
+            nodes.push_back(node);
+        }
+    }
+    return nodes;
+#else
+    return numaNodes();
+#endif
+}
+
+// CPUs the calling thread may run on
+inline int allowedCpuCount()
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0)
+    {
+        return CPU_COUNT(&allowed);
+    }
+#endif
+    const unsigned int hw = std::thread::hardware_concurrency();
+    return hw > 0 ? static_cast<int>(hw) : 1;
+}
+
+// Node the calling thread was pinned to, -1 if none
+inline int &currentNumaNode()
+{
+    thread_local int node = -1;
+    return node;
+}
+
+// Restrict the calling thread, and the threads it starts from now on, to
+// the CPUs of node id it may run on. Memory is then first touched, and so
+// placed, on that node under the kernel's default local allocation
+// policy, and the ImagePool hands the thread buffers from that node.
+// Without Linux affinity there is only node 0, and nothing to restrict.
+inline void pinToNumaNode(int id)
+{
+    for (const NumaNode &node : allowedNumaNodes())
+    {
+        if (node.id != id)
+        {
+            continue;
+        }
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : node.cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        {
+            throw std::runtime_error("Cannot pin to the CPUs of NUMA node " + std::to_string(id));
+        }
+#endif
+        currentNumaNode() = id;
+        npp::ImagePool::setThreadNode(id);
+        return;
+    }
+    throw std::runtime_error("No NUMA node " + std::to_string(id) + " among the CPUs this process may use");
+}
+
+// pinToNumaNode for threads that run either way: does nothing for id -1,
+// and leaves the thread where it is if pinning fails
+inline bool tryPinToNumaNode(int id)
+{
+    if (id < 0)
+    {
+        return false;
+    }
+    try
+    {
+        pinToNumaNode(id);
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
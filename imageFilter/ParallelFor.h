@@ -0,0 +1,32 @@
+#pragma once
+
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+// Split the row range [0, height) into contiguous tiles and run
+// func(rowBegin, rowEnd) for each tile as a task on the shared
+// TaskScheduler; the calling thread works on the tiles too and returns when
+// all are done. threads == 1 runs the whole range on the calling thread;
+// otherwise the scheduler's thread count and --task-rows decide the split.
+template <typename Func>
+void parallelForRows(int height, int threads, Func &&func)
+{
+    TaskScheduler &scheduler = TaskScheduler::instance();
+    const int tiles = threads == 1 ? 1 : scheduler.taskCount(height);
+
+    if (tiles <= 1)
+    {
+        func(0, height);
+        return;
+    }
+
+    TaskScheduler::Group group;
+    const int rowsPerTile = (height + tiles - 1) / tiles;
+    for (int rowBegin = 0; rowBegin < height; rowBegin += rowsPerTile)
+    {
+        const int rowEnd = std::min(height, rowBegin + rowsPerTile);
+        scheduler.run(group, [&func, rowBegin, rowEnd]() { func(rowBegin, rowEnd); });
+    }
+    scheduler.wait(group);
+}
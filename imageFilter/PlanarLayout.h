@@ -0,0 +1,221 @@
+#pragma once
+
+#include "CpuFeatures.h"
+
+#include <cstdint>
+
+#include <npp.h>
+
+// Conversion between packed (RGBRGB...) and planar (RRR... GGG... BBB...)
+// three-channel rows. Per-channel filters prefer planar data: their SIMD
+// lanes then hold one channel of consecutive pixels rather than a mix of
+// channels, and the kernels run with N = 1. Pipelines convert only where a
+// planar stage follows a packed one or the other way round (see
+// ImageProcessor::preferredLayout).
+enum class ImageLayout
+{
+    PACKED,
+    PLANAR
+};
+
+namespace layout_detail
+{
+    // pshufb masks for blocks of 16 pixels (48 packed bytes in three
+    // vectors); -1 clears the byte so the three partial results can be ORed
+    struct ShuffleMasks
+    {
+        // deinterleave[c][v]: the bytes of channel c held by packed vector v
+        alignas(16) std::int8_t deinterleave[3][3][16];
+        // interleave[v][c]: the bytes of packed vector v taken from plane c
+        alignas(16) std::int8_t interleave[3][3][16];
+
+        ShuffleMasks()
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                for (int v = 0; v < 3; ++v)
+                {
+                    for (int i = 0; i < 16; ++i)
+                    {
+                        const int packed = 3 * i + c;
+                        deinterleave[c][v][i] = static_cast<std::int8_t>(packed / 16 == v ? packed % 16 : -1);
+                        const int byte = 16 * v + i;
+                        interleave[v][c][i] = static_cast<std::int8_t>(byte % 3 == c ? byte / 3 : -1);
+                    }
+                }
+            }
+        }
+    };
+
+    inline const ShuffleMasks &shuffleMasks()
+    {
+        static const ShuffleMasks masks;
+        return masks;
+    }
+
+#if IMAGEFILTER_X86_SIMD
+    // The SSSE3 and AVX2 paths work on blocks of 16 and 32 pixels and
+    // return the first pixel not processed. AVX2 shuffles within 128-bit
+    // lanes, so each lane handles its own block of 16 pixels.
+    IMAGEFILTER_TARGET("ssse3")
+    inline int deinterleaveSsse3(const Npp8u *pSrc, Npp8u *const *pDst, int width)
+    {
+        const ShuffleMasks &masks = shuffleMasks();
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            const Npp8u *p = pSrc + 3 * x;
+            const __m128i packed[3] = {_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16)),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32))};
+            for (int c = 0; c < 3; ++c)
+            {
+                __m128i plane = _mm_setzero_si128();
+                for (int v = 0; v < 3; ++v)
+                {
+                    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i *>(masks.deinterleave[c][v]));
+                    plane = _mm_or_si128(plane, _mm_shuffle_epi8(packed[v], mask));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(pDst[c] + x), plane);
+            }
+        }
+        return x;
+    }
+
+    IMAGEFILTER_TARGET("ssse3")
+    inline int interleaveSsse3(const Npp8u *const *pSrc, Npp8u *pDst, int width)
+    {
+        const ShuffleMasks &masks = shuffleMasks();
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            const __m128i planes[3] = {_mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc[0] + x)),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc[1] + x)),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(pSrc[2] + x))};
+            for (int v = 0; v < 3; ++v)
+            {
+                __m128i packed = _mm_setzero_si128();
+                for (int c = 0; c < 3; ++c)
+                {
+                    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i *>(masks.interleave[v][c]));
+                    packed = _mm_or_si128(packed, _mm_shuffle_epi8(planes[c], mask));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(pDst + 3 * x + 16 * v), packed);
+            }
+        }
+        return x;
+    }
+
+    // Two blocks of 16 pixels, one per 128-bit lane
+    IMAGEFILTER_TARGET("avx2")
+    inline __m256i loadLanes(const Npp8u *pLow, const Npp8u *pHigh)
+    {
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pLow))),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(pHigh)), 1);
+    }
+
+    IMAGEFILTER_TARGET("avx2")
+    inline __m256i laneMask(const std::int8_t *pMask)
+    {
+        return _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(pMask)));
+    }
+
+    IMAGEFILTER_TARGET("avx2")
+    inline int deinterleaveAvx2(const Npp8u *pSrc, Npp8u *const *pDst, int width)
+    {
+        const ShuffleMasks &masks = shuffleMasks();
+        int x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            const Npp8u *p = pSrc + 3 * x;
+            const __m256i packed[3] = {loadLanes(p, p + 48), loadLanes(p + 16, p + 64), loadLanes(p + 32, p + 80)};
+            for (int c = 0; c < 3; ++c)
+            {
+                __m256i plane = _mm256_setzero_si256();
+                for (int v = 0; v < 3; ++v)
+                {
+                    plane = _mm256_or_si256(plane, _mm256_shuffle_epi8(packed[v], laneMask(masks.deinterleave[c][v])));
+                }
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(pDst[c] + x), plane);
+            }
+        }
+        return x;
+    }
+
+    IMAGEFILTER_TARGET("avx2")
+    inline int interleaveAvx2(const Npp8u *const *pSrc, Npp8u *pDst, int width)
+    {
+        const ShuffleMasks &masks = shuffleMasks();
+        int x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            const __m256i planes[3] = {_mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSrc[0] + x)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSrc[1] + x)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pSrc[2] + x))};
+            Npp8u *p = pDst + 3 * x;
+            for (int v = 0; v < 3; ++v)
+            {
+                __m256i packed = _mm256_setzero_si256();
+                for (int c = 0; c < 3; ++c)
+                {
+                    packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(planes[c], laneMask(masks.interleave[v][c])));
+                }
+                // the low lane holds bytes of pixels x..x+15, the high lane
+                // those of x+16..x+31
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16 * v), _mm256_castsi256_si128(packed));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 48 + 16 * v), _mm256_extracti128_si256(packed, 1));
+            }
+        }
+        return x;
+    }
+#endif
+} // namespace layout_detail
+
+// Packed row pSrc of width pixels into the three planes' rows pDst[0..2].
+// Every SSE4.1 CPU has SSSE3, so SSE41 selects the pshufb path.
+inline void deinterleaveRow(const Npp8u *pSrc, Npp8u *const *pDst, int width, SimdLevel level = simdLevel())
+{
+    int x = 0;
+#if IMAGEFILTER_X86_SIMD
+    if (level == SimdLevel::AVX2)
+    {
+        x = layout_detail::deinterleaveAvx2(pSrc, pDst, width);
+    }
+    else if (level == SimdLevel::SSE41)
+    {
+        x = layout_detail::deinterleaveSsse3(pSrc, pDst, width);
+    }
+#else
+    (void)level;
+#endif
+    for (; x < width; ++x)
+    {
+        pDst[0][x] = pSrc[3 * x];
+        pDst[1][x] = pSrc[3 * x + 1];
+        pDst[2][x] = pSrc[3 * x + 2];
+    }
+}
+
+// The planes' rows pSrc[0..2] into packed row pDst of width pixels
+inline void interleaveRow(const Npp8u *const *pSrc, Npp8u *pDst, int width, SimdLevel level = simdLevel())
+{
+    int x = 0;
+#if IMAGEFILTER_X86_SIMD
+    if (level == SimdLevel::AVX2)
+    {
+        x = layout_detail::interleaveAvx2(pSrc, pDst, width);
+    }
+    else if (level == SimdLevel::SSE41)
+    {
+        x = layout_detail::interleaveSsse3(pSrc, pDst, width);
+    }
+#else
+    (void)level;
+#endif
+    for (; x < width; ++x)
+    {
+        pDst[3 * x] = pSrc[0][x];
+        pDst[3 * x + 1] = pSrc[1][x];
+        pDst[3 * x + 2] = pSrc[2][x];
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Config.h"
+#include "FilterGraph.h"
+#include "FrameRing.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Shared-memory mode (--input-ring, --output-ring): filters the frames a
+// co-located producer publishes into a FrameRing and publishes the
+// results into a second ring, with no encoding, decoding or file I/O.
+// Each of --workers threads takes the next input frame and a free slot of
+// the output ring, filters straight from one shared slot into the other
+// and publishes the result under the id of the input frame; workers
+// finish in any order, so results can be published out of order. A full
+// output ring blocks the workers, which then stop taking input frames. The run ends when the producer closes the input ring and the
+// frames in it are done; the output ring is then closed.
+class RingProcessor
+{
+private:
+    ProcessingConfig config_;
+    std::vector<PipelineStage> stages_;
+    int workers_;
+
+public:
+    // stages is the parsed --pipeline, or empty to run config's filter
+    RingProcessor(const ProcessingConfig &config, const std::vector<PipelineStage> &stages)
+        : config_(config), stages_(stages), workers_(resolveThreadCount(config.workers))
+    {
+        if (config_.inputRing.empty() || config_.outputRing.empty())
+        {
+            throw std::runtime_error("Shared-memory mode needs both --input-ring and --output-ring");
+        }
+
+        // frames are filtered concurrently and their tiles shared through
+        // the scheduler, as in batch mode
+        if (stages_.empty())
+        {
+            stages_.push_back({-1, config_});
+        }
+    }
+
+    void run()
+    {
+        std::unique_ptr<FrameRing> input = FrameRing::open(config_.inputRing);
+        const unsigned int width = input->width();
+        const unsigned int height = input->height();
+
+        std::vector<std::unique_ptr<FilterGraph>> graphs;
+        for (int i = 0; i < workers_; ++i)
+        {
+            graphs.emplace_back(new FilterGraph(stages_));
+        }
+        if (graphs[0]->outputCount() != 1)
+        {
+            throw std::runtime_error("Shared-memory mode publishes a single output per frame");
+        }
+        std::unique_ptr<FrameRing> output = FrameRing::create(
+            config_.outputRing, width, height, config_.ringSlots > 0 ? config_.ringSlots : input->slots());
+
+        if (config_.verbose)
+        {
+            std::cout << "Filtering " << width << "x" << height << " frames from " << config_.inputRing << " ("
+                      << input->slots() << " slots) into " << config_.outputRing << " (" << output->slots()
+                      << " slots) with " << workers_ << " workers" << std::endl;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        std::atomic<size_t> frames(0);
+        std::atomic<bool> failed(false);
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        auto work = [&](int worker) {
+            try
+            {
+                FrameRing::Frame in;
+                while (!failed && input->acquireRead(in, &failed))
+                {
+                    FrameRing::Frame out;
+                    if (!output->acquireWrite(out))
+                    {
+                        input->release(in);
+                        break;
+                    }
+                    try
+                    {
+                        graphs[worker]->run(in.view, out.view);
+                    }
+                    catch (...)
+                    {
+                        input->release(in);
+                        output->discard(out);
+                        throw;
+                    }
+                    input->release(in);
+                    output->publish(out, in.id);
+                    ++frames;
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                // stops the workers waiting for an input frame or an
+                // output slot
+                failed = true;
+                output->close();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < workers_; ++i)
+        {
+            threads.emplace_back(work, i);
+        }
+        work(0);
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        output->close();
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Filtered " << frames << " frames in " << elapsed.count() << " s ("
+                  << frames / elapsed.count() << " frames/sec)" << std::endl;
+    }
+};
@@ -0,0 +1,409 @@
+#pragma once
+
+#include "BatchProcessor.h"
+#include "Config.h"
+#include "NumaTopology.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <helper_multiprocess.h>
+
+// Messages from the children of a sharded batch to their parent, one Unix
+// datagram each, all starting with the child's shard index:
+//
+//   "<shard> done <input>"       an input was written
+//   "<shard> failed <input>"     an input failed; the child logged why
+//   "<shard> stats <seconds> <decode> <filter> <encode>"
+//                                the child's batch is over: its wall time
+//                                and stage busy times, in seconds
+//
+// The parent also sends itself "<shard> exit <status>" when a child exits.
+// A datagram socket delivers a child's messages before the parent can see
+// the child exit, so an exit message always finds the child's progress
+// already counted.
+const size_t kMaxShardMessage = 8192;
+
+// Child side: reports each finished input of the batch, and its totals,
+// to the parent's --shard-report socket
+class ShardReporter
+{
+private:
+    ipcHandle *socket_;
+    std::string parent_;
+    std::string prefix_;
+
+    void send(const std::string &message)
+    {
+        // the parent restarts a child it loses track of, so a lost report
+        // costs work but not correctness
+        ipcSendDataTo(socket_, parent_.c_str(), message.data(), message.size());
+    }
+
+public:
+    explicit ShardReporter(const ProcessingConfig &config)
+        : socket_(nullptr), parent_(config.shardReport), prefix_(std::to_string(config.shardIndex) + " ")
+    {
+        const std::string name = parent_ + "." + std::to_string(getpid());
+        if (ipcCreateSocket(socket_, name.c_str(), std::vector<Process>()) != 0)
+        {
+            throw std::runtime_error("Cannot create a socket to report to " + parent_);
+        }
+    }
+
+    ShardReporter(const ShardReporter &) = delete;
+    ShardReporter &operator=(const ShardReporter &) = delete;
+
+    ~ShardReporter()
+    {
+        ipcCloseSocket(socket_);
+    }
+
+    // Safe to call from several pipeline threads at once
+    void imageDone(const std::string &inputFile, const std::string &error)
+    {
+        send(prefix_ + (error.empty() ? "done " : "failed ") + inputFile);
+    }
+
+    void finished(const BatchProcessor::Summary &summary)
+    {
+        std::ostringstream message;
+        message << prefix_ << "stats " << summary.seconds << " " << summary.busySeconds[0] << " "
+                << summary.busySeconds[1] << " " << summary.busySeconds[2];
+        send(message.str());
+    }
+};
+
+// --shards mode: splits a batch across child processes instead of running
+// it on one process's threads, where allocator and cache contention
+// between sockets limits scaling on large NUMA hosts. The inputs are cut
+// into --shards contiguous runs; each runs in a child started with
+// spawnProcess on this binary in ordinary batch mode, with the same
+// options, its inputs in a --file-list and --numa-node set so that it and
+// its memory stay on one node (shards go to nodes in turn). Without
+// --workers, a child gets an equal share of its node's CPUs.
+//
+// Children report every finished input over a Unix datagram socket, and
+// a thread per child waits for it with waitProcess. A child that dies
+// with inputs unreported is restarted on those inputs, up to
+// kShardRestarts times; after that they count as failed. The parent
+// prints each shard's totals and the batch's.
+class ShardProcessor
+{
+private:
+    static const int kShardRestarts = 2;
+
+    struct Shard
+    {
+        int node;
+        int workers;
+        std::vector<std::string> inputs;
+        std::set<std::string> pending; // inputs not reported yet
+        int restarts;
+        bool running;
+        size_t succeeded;
+        size_t failed;
+        size_t lost; // given up after kShardRestarts
+        double seconds;
+        double busySeconds[3];
+    };
+
+    ProcessingConfig config_;
+    std::vector<PipelineStage> stages_;
+    std::vector<std::string> childArgs_; // command line without the batch inputs
+    std::vector<Shard> shards_;
+    std::string socketName_;
+    ipcHandle *socket_;
+    std::vector<std::thread> waiters_;
+    std::vector<char> buffer_;
+    bool aborting_;
+
+    static bool isShardedArgument(const char *arg)
+    {
+        static const char *const names[] = {"--shards", "--input-dir", "--file-list", "--glob",
+                                            "--numa-node", "--shard-report", "--shard-index"};
+        for (const char *name : names)
+        {
+            const size_t length = strlen(name);
+            if (strncmp(arg, name, length) == 0 && (arg[length] == '=' || arg[length] == '\0'))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string listFile(size_t index) const
+    {
+        return socketName_ + "." + std::to_string(index) + ".list";
+    }
+
+    void launch(size_t index)
+    {
+        Shard &shard = shards_[index];
+        {
+            std::ofstream list(listFile(index));
+            for (const std::string &input : shard.inputs)
+            {
+                if (shard.pending.count(input))
+                {
+                    list << input << "\n";
+                }
+            }
+            if (!list)
+            {
+                throw std::runtime_error("Cannot write " + listFile(index));
+            }
+        }
+
+        std::vector<std::string> args(childArgs_);
+        args.push_back("--file-list=" + listFile(index));
+        args.push_back("--shard-report=" + socketName_);
+        args.push_back("--shard-index=" + std::to_string(index));
+        args.push_back("--numa-node=" + std::to_string(shard.node));
+        if (config_.workers == 0)
+        {
+            args.push_back("--workers=" + std::to_string(shard.workers));
+        }
+        std::vector<char *> argv;
+        for (std::string &arg : args)
+        {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+
+        Process process;
+        if (spawnProcess(&process, "/proc/self/exe", argv.data()) != 0)
+        {
+            throw std::runtime_error("Cannot start shard " + std::to_string(index) + ": " + strerror(errno));
+        }
+        shard.running = true;
+
+        waiters_.emplace_back([this, index, process]() mutable {
+            const std::string message = std::to_string(index) + " exit " + std::to_string(waitProcess(&process));
+            // a child that crashed leaves its report socket behind
+            unlink((socketName_ + "." + std::to_string(process)).c_str());
+            ipcSendDataTo(socket_, socketName_.c_str(), message.data(), message.size());
+        });
+    }
+
+    void exited(size_t index, int status)
+    {
+        Shard &shard = shards_[index];
+        shard.running = false;
+        if (shard.pending.empty() || aborting_)
+        {
+            return;
+        }
+
+        std::cerr << "Shard " << index << " exited with status " << status << " and " << shard.pending.size()
+                  << " inputs unfinished";
+        if (shard.restarts < kShardRestarts)
+        {
+            ++shard.restarts;
+            std::cerr << ", restarting it" << std::endl;
+            launch(index);
+            return;
+        }
+        std::cerr << ", giving up on them" << std::endl;
+        for (const std::string &input : shard.pending)
+        {
+            std::cerr << "  failed: " << input << ": lost with shard " << index << std::endl;
+        }
+        shard.lost += shard.pending.size();
+        shard.pending.clear();
+    }
+
+    void handle(const std::string &message)
+    {
+        std::istringstream stream(message);
+        size_t index = 0;
+        std::string kind;
+        if (!(stream >> index >> kind) || index >= shards_.size())
+        {
+            return;
+        }
+        Shard &shard = shards_[index];
+
+        if (kind == "done" || kind == "failed")
+        {
+            const std::string input = message.substr(static_cast<size_t>(stream.tellg()) + 1);
+            if (shard.pending.erase(input) > 0)
+            {
+                ++(kind == "done" ? shard.succeeded : shard.failed);
+            }
+        }
+        else if (kind == "stats")
+        {
+            double seconds = 0.0;
+            double busy[3] = {0.0, 0.0, 0.0};
+            stream >> seconds >> busy[0] >> busy[1] >> busy[2];
+            shard.seconds += seconds;
+            for (int i = 0; i < 3; ++i)
+            {
+                shard.busySeconds[i] += busy[i];
+            }
+        }
+        else if (kind == "exit")
+        {
+            int status = 0;
+            stream >> status;
+            exited(index, status);
+        }
+    }
+
+    // Wait for and handle one message; false if the socket failed
+    bool receive()
+    {
+        char sender[sizeof(sockaddr_un::sun_path)];
+        const int size = ipcRecvDataFrom(socket_, buffer_.data(), buffer_.size(), sender, sizeof(sender));
+        if (size < 0)
+        {
+            return false;
+        }
+        handle(std::string(buffer_.data(), std::min<size_t>(size, buffer_.size())));
+        return true;
+    }
+
+    bool anyRunning() const
+    {
+        for (const Shard &shard : shards_)
+        {
+            if (shard.running)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void cleanUp()
+    {
+        for (auto &waiter : waiters_)
+        {
+            waiter.join();
+        }
+        waiters_.clear();
+        for (size_t i = 0; i < shards_.size(); ++i)
+        {
+            unlink(listFile(i).c_str());
+        }
+        ipcCloseSocket(socket_);
+        socket_ = nullptr;
+    }
+
+public:
+    // stages is the parsed --pipeline, used here only to list the inputs
+    ShardProcessor(const ProcessingConfig &config, const std::vector<PipelineStage> &stages, int argc, char *argv[])
+        : config_(config), stages_(stages), socket_(nullptr), buffer_(kMaxShardMessage), aborting_(false)
+    {
+        for (int i = 0; i < argc; ++i)
+        {
+            if (i == 0 || !isShardedArgument(argv[i]))
+            {
+                childArgs_.push_back(argv[i]);
+            }
+        }
+    }
+
+    ShardProcessor(const ShardProcessor &) = delete;
+    ShardProcessor &operator=(const ShardProcessor &) = delete;
+
+    // Process every input; returns the number of images that failed
+    int run()
+    {
+        const std::vector<std::string> files = BatchProcessor(config_, stages_).inputFiles();
+        if (files.empty())
+        {
+            throw std::runtime_error("No input files found");
+        }
+
+        const std::vector<NumaNode> nodes = numaNodes();
+        const size_t count = std::min<size_t>(config_.shards, files.size());
+        for (size_t i = 0; i < count; ++i)
+        {
+            Shard shard = Shard();
+            shard.node = nodes[i % nodes.size()].id;
+            const size_t sharing = count / nodes.size() + (i % nodes.size() < count % nodes.size() ? 1 : 0);
+            shard.workers = std::max<int>(1, static_cast<int>(nodes[i % nodes.size()].cpus.size() / sharing));
+            shard.inputs.assign(files.begin() + files.size() * i / count, files.begin() + files.size() * (i + 1) / count);
+            shard.pending.insert(shard.inputs.begin(), shard.inputs.end());
+            shards_.push_back(shard);
+        }
+
+        const char *tmp = getenv("TMPDIR");
+        socketName_ = std::string(tmp && *tmp ? tmp : "/tmp") + "/imageFilter-shards." + std::to_string(getpid());
+        if (ipcCreateSocket(socket_, socketName_.c_str(), std::vector<Process>()) != 0)
+        {
+            throw std::runtime_error("Cannot create " + socketName_);
+        }
+
+        std::cout << "Sharding " << files.size() << " images across " << count << " processes on " << nodes.size()
+                  << " NUMA nodes" << std::endl;
+
+        const auto start = std::chrono::steady_clock::now();
+        try
+        {
+            for (size_t i = 0; i < shards_.size(); ++i)
+            {
+                launch(i);
+            }
+            while (anyRunning())
+            {
+                if (!receive())
+                {
+                    throw std::runtime_error(std::string("Cannot receive shard reports: ") + strerror(errno));
+                }
+            }
+        }
+        catch (...)
+        {
+            // the waiters still use the socket, so let the running children
+            // finish rather than orphan them
+            aborting_ = true;
+            while (anyRunning() && receive())
+            {
+            }
+            cleanUp();
+            throw;
+        }
+        cleanUp();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        size_t succeeded = 0;
+        size_t failed = 0;
+        double busySeconds[3] = {0.0, 0.0, 0.0};
+        for (size_t i = 0; i < shards_.size(); ++i)
+        {
+            const Shard &shard = shards_[i];
+            std::cout << "Shard " << i << " (node " << shard.node << ", " << shard.inputs.size() << " images): "
+                      << shard.succeeded << " processed, " << shard.failed + shard.lost << " failed in "
+                      << shard.seconds << " s, " << shard.restarts << " restarts" << std::endl;
+            succeeded += shard.succeeded;
+            failed += shard.failed + shard.lost;
+            for (int k = 0; k < 3; ++k)
+            {
+                busySeconds[k] += shard.busySeconds[k];
+            }
+        }
+        std::cout << "Processed " << succeeded << " of " << files.size() << " images in " << elapsed.count()
+                  << " s (" << succeeded / elapsed.count() << " images/sec), " << failed << " failed" << std::endl;
+        std::cout << "Stage busy time: decode " << busySeconds[0] << " s, filter " << busySeconds[1]
+                  << " s, encode " << busySeconds[2] << " s" << std::endl;
+
+        return static_cast<int>(failed);
+    }
+};
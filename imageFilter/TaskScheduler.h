@@ -0,0 +1,377 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "NumaTopology.h"
+
+// Resolve a requested thread count; 0 means "one per CPU the process may
+// run on", so taskset, cgroup cpusets and --numa-node size the pools too.
+inline int resolveThreadCount(int requested)
+{
+    if (requested > 0)
+    {
+        return requested;
+    }
+
+    return allowedCpuCount();
+}
+
+// Work-stealing task scheduler shared by every CPU engine, through
+// parallelForRows (ParallelFor.h). Each pool thread owns a deque: it pushes
+// and pops its own tasks at the back, and when it runs dry it steals from
+// the front of the others', so uneven tiles (textured against flat regions
+// in the bilateral or median filters) move to whichever thread finishes
+// first. A thread waiting for a group of tasks runs queued tasks instead of
+// blocking, so callers outside the pool, such as batch workers, add to the
+// compute threads rather than stacking private thread teams on top of it.
+//
+// With --numa the pool threads are spread over the NUMA nodes and pinned
+// there. A task queued from outside the pool goes to a deque of the
+// caller's node, and thieves try the deques of their own node before
+// crossing to another, so the tiles of an image are filtered on the node
+// holding its buffers unless that node has run out of work.
+class TaskScheduler
+{
+public:
+    typedef std::function<void()> Task;
+
+    // Tasks a caller waits for together; the first exception a task throws
+    // is rethrown by wait()
+    class Group
+    {
+        friend class TaskScheduler;
+
+        std::atomic<int> pending_{0};
+        std::mutex errorMutex_;
+        std::exception_ptr error_;
+    };
+
+    struct Stats
+    {
+        uint64_t tasks;        // tasks run
+        uint64_t steals;       // tasks taken from another thread's deque
+        uint64_t remoteSteals; // of which from a deque of another node
+        uint64_t idle;         // times a pool thread ran out of work and slept
+    };
+
+private:
+    struct Entry
+    {
+        Task task;
+        Group *group;
+    };
+
+    struct Deque
+    {
+        std::mutex mutex;
+        std::deque<Entry> entries;
+        int node = -1; // NUMA node of its thread, -1 without --numa
+    };
+
+    std::vector<std::unique_ptr<Deque>> deques_;
+    std::vector<std::thread> threads_;
+    int taskRows_;
+
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> queued_;
+    std::atomic<unsigned int> nextDeque_;
+    bool stop_;
+
+    std::atomic<uint64_t> tasks_;
+    std::atomic<uint64_t> steals_;
+    std::atomic<uint64_t> remoteSteals_;
+    std::atomic<uint64_t> idle_;
+
+    std::once_flag started_;
+
+    // Index of the calling pool thread's deque, -1 outside the pool
+    static int &currentWorker()
+    {
+        thread_local int worker = -1;
+        return worker;
+    }
+
+    // Own deque first (newest task, still warm in cache), then the oldest
+    // task of the other deques, those of the caller's node first
+    bool take(int self, Entry &entry)
+    {
+        const int count = static_cast<int>(deques_.size());
+        if (self >= 0)
+        {
+            Deque &own = *deques_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.entries.empty())
+            {
+                entry = std::move(own.entries.back());
+                own.entries.pop_back();
+                --queued_;
+                return true;
+            }
+        }
+
+        const int node = self >= 0 ? deques_[self]->node : currentNumaNode();
+        const int start = self >= 0 ? self : static_cast<int>(nextDeque_++ % count);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                const int victim = (start + i) % count;
+                Deque &other = *deques_[victim];
+                const bool local = node < 0 || other.node < 0 || other.node == node;
+                if (victim == self || local != (pass == 0))
+                {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(other.mutex);
+                if (!other.entries.empty())
+                {
+                    entry = std::move(other.entries.front());
+                    other.entries.pop_front();
+                    --queued_;
+                    ++steals_;
+                    if (!local)
+                    {
+                        ++remoteSteals_;
+                    }
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void execute(Entry &entry)
+    {
+        Group &group = *entry.group;
+        try
+        {
+            entry.task();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(group.errorMutex_);
+            if (!group.error_)
+            {
+                group.error_ = std::current_exception();
+            }
+        }
+        entry.task = nullptr;
+        ++tasks_;
+
+        // the waiter may return and destroy the group as soon as pending_
+        // drops to zero
+        if (--group.pending_ == 0)
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            wake_.notify_all();
+        }
+    }
+
+    void work(int self)
+    {
+        currentWorker() = self;
+        tryPinToNumaNode(deques_[self]->node);
+        Entry entry;
+        for (;;)
+        {
+            if (take(self, entry))
+            {
+                execute(entry);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            if (stop_)
+            {
+                return;
+            }
+            if (queued_ == 0)
+            {
+                ++idle_;
+                wake_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+            }
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &thread : threads_)
+        {
+            thread.join();
+        }
+        threads_.clear();
+        deques_.clear();
+    }
+
+    void start(int threads, int taskRows, bool numa)
+    {
+        stop();
+        stop_ = false;
+        taskRows_ = std::max(taskRows, 0);
+
+        const std::vector<NumaNode> nodes = numa ? allowedNumaNodes() : std::vector<NumaNode>();
+        const int poolThreads = resolveThreadCount(threads) - 1;
+        for (int i = 0; i < poolThreads; ++i)
+        {
+            deques_.emplace_back(new Deque());
+            if (!nodes.empty())
+            {
+                deques_.back()->node = nodes[i % nodes.size()].id;
+            }
+        }
+        for (int i = 0; i < poolThreads; ++i)
+        {
+            threads_.emplace_back([this, i]() { work(i); });
+        }
+    }
+
+    // The pool is started by the first configure, or with the defaults on
+    // first use if nothing configures it, so a configure at startup does
+    // not spin up a default pool only to tear it down again
+    void startDefault()
+    {
+        std::call_once(started_, [this]() { start(0, 0, false); });
+    }
+
+    TaskScheduler()
+        : taskRows_(0), queued_(0), nextDeque_(0), stop_(false), tasks_(0), steals_(0), remoteSteals_(0), idle_(0)
+    {
+    }
+
+public:
+    // The process-wide scheduler
+    static TaskScheduler &instance()
+    {
+        static TaskScheduler scheduler;
+        return scheduler;
+    }
+
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    ~TaskScheduler()
+    {
+        stop();
+    }
+
+    // (Re)start with threads compute threads (0 = one per allowed CPU)
+    // and taskRows rows per parallelForRows task (0 = about four tasks per
+    // thread). The thread that waits for a group works as well, so the pool
+    // holds threads - 1 threads; with numa they are dealt out to the NUMA
+    // nodes in turn and pinned there. Only call while no task is running.
+    void configure(int threads, int taskRows, bool numa = false)
+    {
+        std::call_once(started_, []() {});
+        start(threads, taskRows, numa);
+    }
+
+    // Compute threads, including the waiting caller
+    int threads()
+    {
+        startDefault();
+        return static_cast<int>(threads_.size()) + 1;
+    }
+
+    // Number of tasks a range of rows is split into
+    int taskCount(int rows)
+    {
+        startDefault();
+        if (threads_.empty() || rows <= 1)
+        {
+            return 1;
+        }
+        if (taskRows_ > 0)
+        {
+            return (rows + taskRows_ - 1) / taskRows_;
+        }
+        return std::min(rows, 4 * threads());
+    }
+
+    // Queue a task of group: on the calling pool thread's own deque, or
+    // spread over the deques (of the caller's node, if it is pinned to one)
+    // when called from outside the pool. Without pool threads the task runs
+    // right away.
+    void run(Group &group, Task task)
+    {
+        startDefault();
+        ++group.pending_;
+        if (deques_.empty())
+        {
+            Entry entry = {std::move(task), &group};
+            execute(entry);
+            return;
+        }
+
+        int index = currentWorker();
+        if (index < 0)
+        {
+            const int count = static_cast<int>(deques_.size());
+            const int node = currentNumaNode();
+            index = static_cast<int>(nextDeque_++ % count);
+            for (int i = 0; node >= 0 && i < count; ++i)
+            {
+                if (deques_[(index + i) % count]->node == node)
+                {
+                    index = (index + i) % count;
+                    break;
+                }
+            }
+        }
+        Deque &deque = *deques_[index];
+        ++queued_;
+        {
+            std::lock_guard<std::mutex> lock(deque.mutex);
+            deque.entries.push_back({std::move(task), &group});
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+        }
+        wake_.notify_one();
+    }
+
+    // Run queued tasks until every task of group has finished
+    void wait(Group &group)
+    {
+        const int self = currentWorker();
+        Entry entry;
+        while (group.pending_ > 0)
+        {
+            if (!deques_.empty() && take(self, entry))
+            {
+                execute(entry);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            wake_.wait(lock, [&]() { return group.pending_ == 0 || queued_ > 0; });
+        }
+
+        if (group.error_)
+        {
+            std::exception_ptr error = group.error_;
+            group.error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    Stats stats() const
+    {
+        return {tasks_, steals_, remoteSteals_, idle_};
+    }
+};
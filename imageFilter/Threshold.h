@@ -0,0 +1,32 @@
+#pragma once
+
+#include <npp.h>
+
+// Binary threshold, per channel: 255 where the value is above level, 0
+// elsewhere.
+inline void thresholdRow(const Npp8u *pIn, Npp8u *pOut, int count, int level)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        pOut[i] = pIn[i] > level ? 255 : 0;
+    }
+}
+
+// Row epilogues are called by the row kernels with each output row right
+// after it has been written, while it is still in L1. Fused filter chains
+// use them to apply a trailing point operation without another pass over
+// the image.
+struct NoRowEpilogue
+{
+    void operator()(Npp8u *, int) const {}
+};
+
+struct ThresholdEpilogue
+{
+    int level;
+
+    void operator()(Npp8u *pRow, int count) const
+    {
+        thresholdRow(pRow, pRow, count, level);
+    }
+};
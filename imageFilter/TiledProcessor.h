@@ -0,0 +1,365 @@
+#pragma once
+
+#include "Config.h"
+#include "FilterGraph.h"
+#include "ImageProcessor.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <ImagesCPU.h>
+#include <helper_image.h>
+
+// Binary PNM file accessed a range of rows at a time. Rows sit at fixed
+// offsets after the header, so any thread can read or write any rows with
+// pread/pwrite without seeking a shared file position. P5 (gray) input is
+// expanded to three channels; output is always P6.
+class PnmStripFile
+{
+private:
+    int fd_;
+    unsigned int width_;
+    unsigned int height_;
+    int channels_;
+    off_t dataOffset_;
+    std::string path_;
+
+    PnmStripFile(int fd, const std::string &path) : fd_(fd), width_(0), height_(0), channels_(3), dataOffset_(0), path_(path) {}
+
+    void fail(const std::string &what) const
+    {
+        throw std::runtime_error(what + " " + path_ + ": " + std::strerror(errno));
+    }
+
+    // The header is parsed by the shared PNM codec (helper_image.h), which
+    // allows comments between any fields
+    void parseHeader()
+    {
+        std::vector<unsigned char> header(helper_image_internal::PNMMaxHeaderSize);
+        const ssize_t size = pread(fd_, header.data(), header.size(), 0);
+        if (size < 0)
+        {
+            fail("Cannot read");
+        }
+
+        PNMInfo info;
+        if (helper_image_internal::parsePNMHeader(header.data(), static_cast<size_t>(size), &info) != 1)
+        {
+            throw std::runtime_error("Tiled mode needs a binary PPM or PGM (P6/P5) input: " + path_);
+        }
+        if (info.maxval != 255)
+        {
+            throw std::runtime_error("Only 8-bit PNM images are supported: " + path_);
+        }
+
+        channels_ = static_cast<int>(info.channels);
+        width_ = info.width;
+        height_ = info.height;
+        dataOffset_ = static_cast<off_t>(info.offset);
+    }
+
+    void readFully(void *pData, size_t bytes, off_t offset) const
+    {
+        char *p = static_cast<char *>(pData);
+        while (bytes > 0)
+        {
+            const ssize_t n = pread(fd_, p, bytes, offset);
+            if (n <= 0)
+            {
+                if (n == 0)
+                {
+                    throw std::runtime_error("Truncated image data: " + path_);
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                fail("Cannot read");
+            }
+            p += n;
+            bytes -= n;
+            offset += n;
+        }
+    }
+
+    void writeFully(const void *pData, size_t bytes, off_t offset) const
+    {
+        const char *p = static_cast<const char *>(pData);
+        while (bytes > 0)
+        {
+            const ssize_t n = pwrite(fd_, p, bytes, offset);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                fail("Cannot write");
+            }
+            p += n;
+            bytes -= n;
+            offset += n;
+        }
+    }
+
+    off_t rowOffset(unsigned int y) const
+    {
+        return dataOffset_ + static_cast<off_t>(y) * width_ * channels_;
+    }
+
+public:
+    PnmStripFile(const PnmStripFile &) = delete;
+    PnmStripFile &operator=(const PnmStripFile &) = delete;
+
+    ~PnmStripFile()
+    {
+        close(fd_);
+    }
+
+    static std::unique_ptr<PnmStripFile> openForReading(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open input file: " + path);
+        }
+        std::unique_ptr<PnmStripFile> file(new PnmStripFile(fd, path));
+        file->parseHeader();
+        return file;
+    }
+
+    // Create a P6 file of the given size; its rows can then be written in
+    // any order
+    static std::unique_ptr<PnmStripFile> create(const std::string &path, unsigned int width, unsigned int height)
+    {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot write output file: " + path);
+        }
+        std::unique_ptr<PnmStripFile> file(new PnmStripFile(fd, path));
+        file->width_ = width;
+        file->height_ = height;
+
+        const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        file->dataOffset_ = static_cast<off_t>(header.size());
+        file->writeFully(header.data(), header.size(), 0);
+        if (ftruncate(fd, file->rowOffset(height)) != 0)
+        {
+            file->fail("Cannot size");
+        }
+        return file;
+    }
+
+    unsigned int width() const
+    {
+        return width_;
+    }
+
+    unsigned int height() const
+    {
+        return height_;
+    }
+
+    // Rows [y, y + dst.height()) into dst, which must be width() wide
+    void readRows(unsigned int y, const npp::ImageView<Npp8u, 3> &dst) const
+    {
+        const size_t rowBytes = static_cast<size_t>(width_) * channels_;
+        if (channels_ == 3 && dst.pitch() == static_cast<int>(rowBytes))
+        {
+            readFully(dst.data(), rowBytes * dst.height(), rowOffset(y));
+            return;
+        }
+        if (channels_ == 3)
+        {
+            for (unsigned int r = 0; r < dst.height(); ++r)
+            {
+                readFully(dst.data(0, r), rowBytes, rowOffset(y + r));
+            }
+            return;
+        }
+
+        std::vector<Npp8u> line(rowBytes);
+        for (unsigned int r = 0; r < dst.height(); ++r)
+        {
+            readFully(line.data(), rowBytes, rowOffset(y + r));
+            Npp8u *pOut = dst.data(0, r);
+            for (unsigned int x = 0; x < width_; ++x)
+            {
+                pOut[3 * x] = pOut[3 * x + 1] = pOut[3 * x + 2] = line[x];
+            }
+        }
+    }
+
+    // The rows of src, which must be width() wide, become rows
+    // [y, y + src.height())
+    void writeRows(unsigned int y, const npp::ImageView<const Npp8u, 3> &src) const
+    {
+        for (unsigned int r = 0; r < src.height(); ++r)
+        {
+            writeFully(src.data(0, r), static_cast<size_t>(width_) * 3, rowOffset(y + r));
+        }
+    }
+};
+
+// Streams an image too large to hold in memory through the filter or
+// --pipeline in strips of --tile-rows rows. Each strip is read together
+// with the halo rows above and below it that the filters need (see
+// FilterGraph::haloRows), filtered by one of --workers threads with its own
+// FilterGraph, and its rows are written straight to their place in the
+// output files. Only the strips in flight are ever in memory, so peak
+// memory depends on the strip size and worker count, not on the image.
+// Strips span the full width: the input and output formats are row-major,
+// so a strip is a contiguous range of each file.
+class TiledProcessor
+{
+private:
+    ProcessingConfig config_;
+    std::vector<PipelineStage> stages_;
+    int workers_;
+
+public:
+    // stages is the parsed --pipeline, or empty to run config's filter
+    TiledProcessor(const ProcessingConfig &config, const std::vector<PipelineStage> &stages)
+        : config_(config), stages_(stages), workers_(resolveThreadCount(config.workers))
+    {
+        if (config_.tileRows <= 0)
+        {
+            throw std::runtime_error("Tiled mode needs a positive --tile-rows");
+        }
+
+        config_.outputExtension = ".ppm";
+        const std::string::size_type dot = config_.outputFile.rfind('.');
+        if (!config_.outputFile.empty() &&
+            (dot == std::string::npos || config_.outputFile.substr(dot) != config_.outputExtension))
+        {
+            throw std::runtime_error("Tiled mode writes binary PPM, --output must end in .ppm");
+        }
+        if (stages_.empty())
+        {
+            stages_.push_back({-1, config_});
+        }
+        for (PipelineStage &stage : stages_)
+        {
+            stage.config.outputExtension = config_.outputExtension;
+        }
+    }
+
+    void run()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<PnmStripFile> input = PnmStripFile::openForReading(config_.inputFile);
+        const unsigned int width = input->width();
+        const unsigned int height = input->height();
+
+        const unsigned int tileRows = static_cast<unsigned int>(config_.tileRows);
+        const unsigned int strips = (height + tileRows - 1) / tileRows;
+        const int workers = static_cast<int>(std::min<unsigned int>(workers_, strips));
+
+        std::vector<std::unique_ptr<FilterGraph>> graphs;
+        for (int i = 0; i < workers; ++i)
+        {
+            graphs.emplace_back(new FilterGraph(stages_));
+        }
+        const unsigned int halo = static_cast<unsigned int>(graphs[0]->haloRows());
+
+        std::vector<std::unique_ptr<PnmStripFile>> outputs;
+        for (size_t k = 0; k < graphs[0]->outputCount(); ++k)
+        {
+            outputs.push_back(PnmStripFile::create(graphs[0]->outputFilename(config_.inputFile, k), width, height));
+        }
+
+        if (config_.verbose)
+        {
+            const double stripMb = static_cast<double>(tileRows + 2 * halo) * width * 3 / (1 << 20);
+            std::cout << "Tiled " << width << "x" << height << " image: " << strips << " strips of "
+                      << tileRows << " rows + " << halo << " halo rows, " << workers << " workers, about "
+                      << stripMb * workers * (graphs[0]->bufferCount() + outputs.size() + 1)
+                      << " MB of strip buffers" << std::endl;
+        }
+
+        std::atomic<unsigned int> next(0);
+        std::atomic<bool> failed(false);
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        auto work = [&](int worker) {
+            npp::ImageCPU_8u_C3 src;
+            std::vector<npp::ImageCPU_8u_C3> results;
+            try
+            {
+                for (unsigned int strip = next++; strip < strips && !failed; strip = next++)
+                {
+                    const unsigned int y = strip * tileRows;
+                    const unsigned int rows = std::min(tileRows, height - y);
+                    const unsigned int top = y > halo ? y - halo : 0;
+                    const unsigned int bottom = std::min(height, y + rows + halo);
+
+                    // only the last strip and those at the borders differ in
+                    // size; strips are tight so a P6 strip is a single read
+                    if (src.width() != width || src.height() != bottom - top)
+                    {
+                        src = npp::ImageCPU_8u_C3(width, bottom - top, true);
+                    }
+
+                    input->readRows(top, src.view());
+                    graphs[worker]->run(src, results);
+                    for (size_t k = 0; k < outputs.size(); ++k)
+                    {
+                        outputs[k]->writeRows(y, results[k].view(0, y - top, width, rows));
+                    }
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < workers; ++i)
+        {
+            threads.emplace_back(work, i);
+        }
+        work(0);
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Processed " << width << "x" << height << " in " << strips << " strips in "
+                  << elapsed.count() << " s (" << static_cast<double>(width) * height / 1e6 / elapsed.count()
+                  << " Mpixel/s)" << std::endl;
+        for (size_t k = 0; k < outputs.size(); ++k)
+        {
+            std::cout << "  wrote " << graphs[0]->outputFilename(config_.inputFile, k) << std::endl;
+        }
+    }
+};
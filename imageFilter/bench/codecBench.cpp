@@ -0,0 +1,275 @@
+/* Output codec benchmark: the built-in QOI codec against FreeImage PNG at
+ * several compression levels.
+ *
+ * Usage: codecBench [--input=<file>[,<file>...]] [--repeat=N] [--check]
+ *
+ * Inputs are read like imageFilter inputs, .raw frames included; the default
+ * is sloth.png and three of the Common/data frames. Images are encoded to
+ * and decoded from memory, so the times leave out file I/O. Each row gives
+ * the best time of --repeat runs and the encoded size relative to the
+ * 24-bit pixels.
+ *
+ * Every QOI encode is decoded and compared with its source. Before the
+ * inputs, synthetic images that use every QOI op are round-tripped in both
+ * channel orders, through memory and through saveQoi, and truncated
+ * streams must be rejected; --check runs only these (make check).
+ */
+
+#include "InputImage.h"
+
+#include <helper_string.h>
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <ImageIO.h>
+#include <QoiCodec.h>
+
+template <typename Func>
+static double bestOfMs(int repeat, Func &&func)
+{
+    double best = 0.0;
+    for (int i = 0; i < repeat; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+// A 24-bit FreeImage bitmap holding a copy of image, as saveImage8uC3 builds it
+static FIBITMAP *toBitmap(const npp::ConstImageView_8u_C3 &image)
+{
+    FIBITMAP *bitmap = FreeImage_Allocate(image.width(), image.height(), 24);
+    if (!bitmap)
+    {
+        throw std::runtime_error("Cannot allocate a bitmap");
+    }
+    const unsigned int pitch = FreeImage_GetPitch(bitmap);
+    for (unsigned int y = 0; y < image.height(); ++y)
+    {
+        memcpy(FreeImage_GetBits(bitmap) + static_cast<size_t>(pitch) * (image.height() - 1 - y), image.data(0, y),
+               image.width() * 3);
+    }
+    return bitmap;
+}
+
+static bool sameImage(const npp::ConstImageView_8u_C3 &a, const npp::ConstImageView_8u_C3 &b)
+{
+    for (unsigned int y = 0; y < a.height(); ++y)
+    {
+        if (memcmp(a.data(0, y), b.data(0, y), a.width() * 3) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs, repeats of recent colours, small and luma-sized steps and jumps,
+// so the stream holds every op, runs crossing rows and the 62-pixel limit
+static void fillQoiPattern(npp::ImageCPU_8u_C3 &image)
+{
+    unsigned int seed = 7;
+    Npp8u pixel[3] = {0, 0, 0};
+    for (unsigned int y = 0; y < image.height(); ++y)
+    {
+        for (unsigned int x = 0; x < image.width(); ++x)
+        {
+            seed = seed * 1103515245u + 12345u;
+            const unsigned int i = y * image.width() + x;
+            switch ((i / 70) % 5)
+            {
+            case 0: // run
+                break;
+            case 1: // diff
+                pixel[0] = static_cast<Npp8u>(pixel[0] + (seed >> 16) % 3 - 1);
+                pixel[2] = static_cast<Npp8u>(pixel[2] + (seed >> 20) % 3 - 1);
+                break;
+            case 2: // luma
+                pixel[1] = static_cast<Npp8u>(pixel[1] + (seed >> 16) % 40 - 20);
+                pixel[0] = static_cast<Npp8u>(pixel[0] + (seed >> 22) % 10 - 5);
+                break;
+            case 3: // index: a few colours that recur
+                pixel[0] = pixel[1] = pixel[2] = static_cast<Npp8u>((seed >> 16) % 4 * 60);
+                break;
+            default: // literal
+                pixel[0] = static_cast<Npp8u>(seed >> 8);
+                pixel[1] = static_cast<Npp8u>(seed >> 16);
+                pixel[2] = static_cast<Npp8u>(seed >> 24);
+                break;
+            }
+            memcpy(image.data(0, y) + x * 3, pixel, 3);
+        }
+    }
+}
+
+static void checkQoi()
+{
+    static const int shapes[][2] = {{97, 61}, {1, 1}, {1, 300}, {500, 1}, {64, 64}};
+    int cases = 0;
+    for (const auto &shape : shapes)
+    {
+        npp::ImageCPU_8u_C3 src(shape[0], shape[1]);
+        fillQoiPattern(src);
+        for (const bool bgr : {false, true})
+        {
+            const std::string name = std::to_string(shape[0]) + "x" + std::to_string(shape[1]) +
+                                     (bgr ? " BGR" : " RGB") + " image";
+            std::vector<Npp8u> qoi(npp::qoiMaxSize(src.width(), src.height()));
+            const size_t bytes = npp::qoiEncode(src, qoi.data(), bgr);
+            npp::ImageCPU_8u_C3 decoded(src.width(), src.height());
+            if (!npp::qoiDecode(qoi.data(), bytes, decoded.view(), bgr) || !sameImage(decoded, src))
+            {
+                throw std::runtime_error("QOI round trip differs for the " + name);
+            }
+            for (size_t cut : {bytes - 1, bytes / 2, npp::qoi::HEADER_SIZE})
+            {
+                if (npp::qoiDecode(qoi.data(), cut, decoded.view(), bgr))
+                {
+                    throw std::runtime_error("QOI decode accepted a truncated stream of the " + name);
+                }
+            }
+
+            // the file path, with its per-thread encode buffer
+            const std::string file = "codecBench_check.qoi";
+            std::vector<Npp8u> written;
+            if (!npp::saveQoi(file, src, bgr) || !npp::readFileBytes(file, written) ||
+                written != std::vector<Npp8u>(qoi.begin(), qoi.begin() + bytes))
+            {
+                remove(file.c_str());
+                throw std::runtime_error("saveQoi did not write the encoded " + name);
+            }
+            remove(file.c_str());
+            cases += 2;
+        }
+    }
+    std::cout << "QOI round trips match their sources in " << cases << " cases\n";
+}
+
+struct PngLevel
+{
+    const char *name;
+    int flags;
+};
+
+static void printRow(const std::string &codec, size_t bytes, double rawBytes, double encodeMs, double decodeMs,
+                     double megapixels)
+{
+    std::cout << "  " << std::left << std::setw(10) << codec << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << bytes / 1024.0 << std::setw(8) << 100.0 * bytes / rawBytes << std::setprecision(2)
+              << std::setw(11) << encodeMs << std::setw(11) << megapixels / (encodeMs / 1000.0) << std::setw(11)
+              << decodeMs << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    const char **args = const_cast<const char **>(argv);
+
+    std::vector<std::string> inputs = {"sloth.png", "../Common/data/PCB_1280x720_8u.raw",
+                                       "../Common/data/PCB2_1024x683_8u.raw",
+                                       "../Common/data/Lena_512x512_8u_Gray.raw"};
+    char *inputStr = nullptr;
+    if (getCmdLineArgumentString(argc, args, "input", &inputStr))
+    {
+        inputs.clear();
+        std::stringstream list(inputStr);
+        for (std::string file; std::getline(list, file, ',');)
+        {
+            inputs.push_back(file);
+        }
+    }
+    const int repeat = checkCmdLineFlag(argc, args, "repeat") ? getCmdLineArgumentInt(argc, args, "repeat") : 5;
+
+    const PngLevel pngLevels[] = {{"png-store", PNG_Z_NO_COMPRESSION},
+                                  {"png-1", PNG_Z_BEST_SPEED},
+                                  {"png-6", PNG_Z_DEFAULT_COMPRESSION},
+                                  {"png-9", PNG_Z_BEST_COMPRESSION}};
+
+    try
+    {
+        checkQoi();
+        if (checkCmdLineFlag(argc, args, "check"))
+        {
+            return EXIT_SUCCESS;
+        }
+
+        std::cout << "\nCodec benchmark, best of " << repeat << " (png-9 is what saveImage8uC3 writes)\n";
+        for (const std::string &file : inputs)
+        {
+            InputImage input;
+            input.load(file, ProcessingConfig());
+            const npp::ConstImageView_8u_C3 &src = input.view();
+            const double megapixels = src.width() * static_cast<double>(src.height()) / 1.0e6;
+            const double rawBytes = src.width() * 3.0 * src.height();
+
+            std::cout << "\n" << file << " (" << src.width() << "x" << src.height() << ")\n"
+                      << "  " << std::left << std::setw(10) << "codec" << std::right << std::setw(10) << "KB"
+                      << std::setw(8) << "size %" << std::setw(11) << "encode ms" << std::setw(11) << "MP/s"
+                      << std::setw(11) << "decode ms" << "\n";
+
+            std::vector<Npp8u> qoi(npp::qoiMaxSize(src.width(), src.height()));
+            size_t qoiBytes = 0;
+            const double qoiEncodeMs = bestOfMs(repeat, [&]() {
+                qoiBytes = npp::qoiEncode(src, qoi.data(), npp::gbFreeImageBgr);
+            });
+            npp::ImageCPU_8u_C3 decoded(src.width(), src.height());
+            const double qoiDecodeMs = bestOfMs(repeat, [&]() {
+                if (!npp::qoiDecode(qoi.data(), qoiBytes, decoded.view(), npp::gbFreeImageBgr))
+                {
+                    throw std::runtime_error("QOI decode failed");
+                }
+            });
+            if (!sameImage(decoded, src))
+            {
+                throw std::runtime_error("QOI round trip differs for " + file);
+            }
+            printRow("qoi", qoiBytes, rawBytes, qoiEncodeMs, qoiDecodeMs, megapixels);
+
+            FIBITMAP *bitmap = toBitmap(src);
+            for (const PngLevel &level : pngLevels)
+            {
+                FIMEMORY *png = FreeImage_OpenMemory();
+                const double encodeMs = bestOfMs(repeat, [&]() {
+                    FreeImage_SeekMemory(png, 0, SEEK_SET);
+                    if (!FreeImage_SaveToMemory(FIF_PNG, bitmap, png, level.flags))
+                    {
+                        throw std::runtime_error("PNG encode failed");
+                    }
+                });
+                BYTE *data = nullptr;
+                DWORD bytes = 0;
+                FreeImage_AcquireMemory(png, &data, &bytes);
+                const double decodeMs = bestOfMs(repeat, [&]() {
+                    FreeImage_SeekMemory(png, 0, SEEK_SET);
+                    FIBITMAP *loaded = FreeImage_LoadFromMemory(FIF_PNG, png);
+                    if (!loaded)
+                    {
+                        throw std::runtime_error("PNG decode failed");
+                    }
+                    FreeImage_Unload(loaded);
+                });
+                FreeImage_CloseMemory(png);
+                printRow(level.name, bytes, rawBytes, encodeMs, decodeMs, megapixels);
+            }
+            FreeImage_Unload(bitmap);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
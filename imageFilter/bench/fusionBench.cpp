@@ -0,0 +1,191 @@
+/* Fusion benchmark: fused pipeline passes against the same stages run one
+ * by one (--no-fusion).
+ *
+ * Usage: fusionBench [--width=N] [--height=N] [--threads=N] [--repeat=N]
+ *                    [--check]
+ *
+ * Every chain that has a fused kernel is run on a synthetic RGB image both
+ * ways with the CPU backend. The outputs must be bit-identical: a
+ * difference is an error, and before timing every chain is also compared
+ * on small and odd image sizes, down to single rows and columns. --check
+ * runs only that comparison (make check).
+ */
+
+#include "ArgsParser.h"
+#include "FilterGraph.h"
+#include "TaskScheduler.h"
+
+#include <helper_string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static const char *const kPipelines[] = {
+    "gaussian:sigma=1,sobel",
+    "gaussian:sigma=2,sobel-vert",
+    "gaussian:sigma=1.5,sobel-mag,threshold:threshold=40",
+    "gaussian:sigma=1,scharr-mag:norm=l1,threshold:threshold=90",
+    "median:radius=1,threshold:threshold=100",
+    "median:radius=4,threshold:threshold=60",
+    "sobel-vert,threshold:threshold=30",
+    "scharr-horiz,threshold:threshold=200",
+};
+
+template <typename Func>
+static double bestOfMs(int repeat, Func &&func)
+{
+    double best = 0.0;
+    for (int i = 0; i < repeat; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+// Smooth gradients with edges and noise, so that every filter has work
+static void fillImage(npp::ImageCPU_8u_C3 &image)
+{
+    unsigned int seed = 1;
+    for (unsigned int y = 0; y < image.height(); ++y)
+    {
+        Npp8u *row = image.data(0, y);
+        for (unsigned int x = 0; x < image.width(); ++x)
+        {
+            seed = seed * 1103515245u + 12345u;
+            const int noise = static_cast<int>((seed >> 16) % 32);
+            const int edge = ((x / 13) + (y / 11)) % 2 == 0 ? 0 : 96;
+            row[x * 3 + 0] = static_cast<Npp8u>(std::min(255, static_cast<int>(x % 256) / 2 + edge + noise));
+            row[x * 3 + 1] = static_cast<Npp8u>(std::min(255, static_cast<int>(y % 256) / 2 + edge));
+            row[x * 3 + 2] = static_cast<Npp8u>(std::min(255, static_cast<int>((x + y) % 256) / 2 + noise));
+        }
+    }
+}
+
+static FilterGraph makeGraph(const ArgsParser &parser, const std::string &pipeline, bool fusion)
+{
+    ProcessingConfig config;
+    config.backend = Backend::CPU;
+    config.fusion = fusion;
+    config.pipeline = pipeline;
+    return FilterGraph(parser.parsePipeline(config));
+}
+
+static bool sameImage(const npp::ImageCPU_8u_C3 &a, const npp::ImageCPU_8u_C3 &b)
+{
+    if (a.width() != b.width() || a.height() != b.height())
+    {
+        return false;
+    }
+    for (unsigned int y = 0; y < a.height(); ++y)
+    {
+        if (!std::equal(a.data(0, y), a.data(0, y) + a.width() * 3, b.data(0, y)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run pipeline fused and unfused on src; throws if the outputs differ
+static void compare(FilterGraph &fused, FilterGraph &unfused, const npp::ImageCPU_8u_C3 &src,
+                    const std::string &pipeline)
+{
+    std::vector<npp::ImageCPU_8u_C3> fusedOut;
+    std::vector<npp::ImageCPU_8u_C3> unfusedOut;
+    fused.run(src, fusedOut);
+    unfused.run(src, unfusedOut);
+    if (!sameImage(fusedOut.back(), unfusedOut.back()))
+    {
+        throw std::runtime_error("Fused and unfused outputs differ for " + pipeline + " on a " +
+                                 std::to_string(src.width()) + "x" + std::to_string(src.height()) + " image");
+    }
+}
+
+static void checkFusion(const ArgsParser &parser)
+{
+    static const int shapes[][2] = {{67, 45}, {1, 33}, {29, 1}, {1, 1}, {256, 3}};
+    int cases = 0;
+    for (const char *pipeline : kPipelines)
+    {
+        FilterGraph fused = makeGraph(parser, pipeline, true);
+        FilterGraph unfused = makeGraph(parser, pipeline, false);
+        if (fused.passCount() >= unfused.passCount())
+        {
+            throw std::runtime_error(std::string("Pipeline was not fused: ") + pipeline);
+        }
+        for (const auto &shape : shapes)
+        {
+            npp::ImageCPU_8u_C3 src(shape[0], shape[1]);
+            fillImage(src);
+            compare(fused, unfused, src, pipeline);
+            ++cases;
+        }
+    }
+    std::cout << "Fused and unfused pipelines are bit-identical in " << cases << " cases\n";
+}
+
+int main(int argc, char *argv[])
+{
+    const char **args = const_cast<const char **>(argv);
+
+    const int width = checkCmdLineFlag(argc, args, "width") ? getCmdLineArgumentInt(argc, args, "width") : 1920;
+    const int height = checkCmdLineFlag(argc, args, "height") ? getCmdLineArgumentInt(argc, args, "height") : 1080;
+    const int threads = checkCmdLineFlag(argc, args, "threads") ? getCmdLineArgumentInt(argc, args, "threads") : 0;
+    const int repeat = checkCmdLineFlag(argc, args, "repeat") ? getCmdLineArgumentInt(argc, args, "repeat") : 3;
+
+    try
+    {
+        if (width <= 0 || height <= 0 || threads < 0 || repeat <= 0)
+        {
+            throw std::runtime_error("Sizes and counts must be positive");
+        }
+
+        TaskScheduler::instance().configure(threads, 0);
+        const ArgsParser parser;
+        checkFusion(parser);
+        if (checkCmdLineFlag(argc, args, "check"))
+        {
+            return EXIT_SUCCESS;
+        }
+
+        npp::ImageCPU_8u_C3 src(width, height);
+        fillImage(src);
+        std::vector<npp::ImageCPU_8u_C3> outputs;
+
+        std::cout << "\nFusion benchmark on a " << width << "x" << height << " RGB image, "
+                  << TaskScheduler::instance().threads() << " thread(s), best of " << repeat << "\n\n";
+        std::cout << std::left << std::setw(60) << "pipeline" << std::right << std::setw(12) << "fused ms"
+                  << std::setw(12) << "unfused ms" << std::setw(10) << "speedup" << "\n";
+
+        for (const char *pipeline : kPipelines)
+        {
+            FilterGraph fused = makeGraph(parser, pipeline, true);
+            FilterGraph unfused = makeGraph(parser, pipeline, false);
+            compare(fused, unfused, src, pipeline);
+
+            const double fusedMs = bestOfMs(repeat, [&]() { fused.run(src, outputs); });
+            const double unfusedMs = bestOfMs(repeat, [&]() { unfused.run(src, outputs); });
+
+            std::cout << std::left << std::setw(60) << pipeline << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(12) << fusedMs << std::setw(12) << unfusedMs << std::setw(9)
+                      << unfusedMs / fusedMs << "x\n";
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
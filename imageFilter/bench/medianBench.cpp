@@ -0,0 +1,235 @@
+/* Median filter benchmark: runtime vs. radius for the CPU median engines.
+ *
+ * Usage: medianBench [--input=<raw file>] [--width=N] [--height=N]
+ *                    [--max-radius=N] [--threads=N] [--repeat=N] [--check]
+ *
+ * The input is a headerless 8-bit single channel raw image; the default is
+ * Common/data/PCB_1280x720_8u.raw. Radii follow imageFilter's --radius
+ * convention, i.e. radius r uses a (2r+5) x (2r+5) mask.
+ *
+ * Before timing, both engines are checked against a brute-force median on
+ * small C1 and C3 images (odd and even masks, offset anchors, 1xN and Nx1
+ * images), and their outputs on the input are compared at every radius.
+ * --check runs only the brute-force comparison (make check).
+ */
+
+#include "CpuFilterEngine.h"
+
+#include <helper_string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static void loadRaw(const std::string &fileName, npp::ImageCPU_8u_C1 &image)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Cannot open " + fileName);
+    }
+
+    for (unsigned int y = 0; y < image.height(); ++y)
+    {
+        file.read(reinterpret_cast<char *>(image.data(0, y)), image.width());
+    }
+
+    if (!file)
+    {
+        throw std::runtime_error("Short read from " + fileName);
+    }
+}
+
+// Median of the mask around every pixel, with the engines' edge replication
+template <class Image>
+static void bruteForceMedian(const Image &src, Image &dst, const NppiSize &maskSize, const NppiPoint &anchor)
+{
+    const int n = Image::gnChannels;
+    const int width = static_cast<int>(src.width());
+    const int height = static_cast<int>(src.height());
+    std::vector<Npp8u> window(maskSize.width * maskSize.height);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            for (int c = 0; c < n; ++c)
+            {
+                size_t i = 0;
+                for (int dy = 0; dy < maskSize.height; ++dy)
+                {
+                    const int ys = std::min(std::max(y - anchor.y + dy, 0), height - 1);
+                    for (int dx = 0; dx < maskSize.width; ++dx)
+                    {
+                        const int xs = std::min(std::max(x - anchor.x + dx, 0), width - 1);
+                        window[i++] = src.data(0, ys)[xs * n + c];
+                    }
+                }
+                std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+                dst.data(0, y)[x * n + c] = window[window.size() / 2];
+            }
+        }
+    }
+}
+
+template <class Image>
+static bool sameImage(const Image &a, const Image &b)
+{
+    for (unsigned int y = 0; y < a.height(); ++y)
+    {
+        if (!std::equal(a.data(0, y), a.data(0, y) + a.width() * Image::gnChannels, b.data(0, y)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Both engines against the brute-force median on one image shape; returns
+// the number of cases run
+template <class Image>
+static int checkShape(const CpuFilterEngine &engine, int width, int height, unsigned int seed)
+{
+    Image src(width, height);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width * static_cast<int>(Image::gnChannels); ++x)
+        {
+            // a few values only, so that windows are full of ties
+            seed = seed * 1103515245u + 12345u;
+            src.data(0, y)[x] = static_cast<Npp8u>((seed >> 16) % 7 * 37);
+        }
+    }
+
+    static const NppiSize masks[] = {{1, 1}, {3, 3}, {5, 3}, {4, 4}, {2, 6}, {7, 1}, {1, 9}, {11, 11}};
+    int cases = 0;
+    for (const NppiSize &maskSize : masks)
+    {
+        const NppiPoint anchors[] = {
+            {maskSize.width / 2, maskSize.height / 2}, {0, 0}, {maskSize.width - 1, maskSize.height - 1}};
+        for (const NppiPoint &anchor : anchors)
+        {
+            Image expected(width, height);
+            Image huang(width, height);
+            Image ctmf(width, height);
+            bruteForceMedian(src, expected, maskSize, anchor);
+            engine.median(src, huang, maskSize, anchor, MedianEngine::HUANG);
+            engine.median(src, ctmf, maskSize, anchor, MedianEngine::CONSTANT_TIME);
+            if (!sameImage(huang, expected) || !sameImage(ctmf, expected))
+            {
+                throw std::runtime_error("Median engines differ from the brute-force median: " +
+                                         std::to_string(Image::gnChannels) + " channel(s), " +
+                                         std::to_string(width) + "x" + std::to_string(height) + " image, " +
+                                         std::to_string(maskSize.width) + "x" + std::to_string(maskSize.height) +
+                                         " mask, anchor " + std::to_string(anchor.x) + "," +
+                                         std::to_string(anchor.y));
+            }
+            ++cases;
+        }
+    }
+    return cases;
+}
+
+static void checkEngines(const CpuFilterEngine &engine)
+{
+    static const int shapes[][2] = {{37, 29}, {1, 17}, {23, 1}, {1, 1}};
+    int cases = 0;
+    for (const auto &shape : shapes)
+    {
+        cases += checkShape<npp::ImageCPU_8u_C1>(engine, shape[0], shape[1], 1);
+        cases += checkShape<npp::ImageCPU_8u_C3>(engine, shape[0], shape[1], 2);
+    }
+    std::cout << "Huang and constant-time medians match the brute-force median in " << cases << " cases\n";
+}
+
+template <typename Func>
+static double bestOfMs(int repeat, Func &&func)
+{
+    double best = 0.0;
+    for (int i = 0; i < repeat; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    const char **args = const_cast<const char **>(argv);
+
+    std::string inputFile = "../Common/data/PCB_1280x720_8u.raw";
+    char *inputStr = nullptr;
+    if (getCmdLineArgumentString(argc, args, "input", &inputStr))
+    {
+        inputFile = inputStr;
+    }
+
+    const int width = checkCmdLineFlag(argc, args, "width") ? getCmdLineArgumentInt(argc, args, "width") : 1280;
+    const int height = checkCmdLineFlag(argc, args, "height") ? getCmdLineArgumentInt(argc, args, "height") : 720;
+    const int maxRadius = checkCmdLineFlag(argc, args, "max-radius") ? getCmdLineArgumentInt(argc, args, "max-radius") : 50;
+    const int threads = checkCmdLineFlag(argc, args, "threads") ? getCmdLineArgumentInt(argc, args, "threads") : 1;
+    const int repeat = checkCmdLineFlag(argc, args, "repeat") ? getCmdLineArgumentInt(argc, args, "repeat") : 3;
+
+    try
+    {
+        TaskScheduler::instance().configure(threads, 0);
+        CpuFilterEngine engine(threads);
+        checkEngines(engine);
+        if (checkCmdLineFlag(argc, args, "check"))
+        {
+            return EXIT_SUCCESS;
+        }
+        std::cout << "\n";
+
+        npp::ImageCPU_8u_C1 src(width, height);
+        npp::ImageCPU_8u_C1 dst(width, height);
+        npp::ImageCPU_8u_C1 ctmfDst(width, height);
+        loadRaw(inputFile, src);
+        const NppiPoint anchor = {0, 0};
+        const double megapixels = width * static_cast<double>(height) / 1.0e6;
+
+        std::cout << "Median benchmark on " << inputFile << " (" << width << "x" << height
+                  << "), " << engine.threads() << " thread(s), best of " << repeat << "\n\n";
+        std::cout << std::setw(6) << "radius" << std::setw(8) << "mask"
+                  << std::setw(14) << "huang ms" << std::setw(14) << "ctmf ms"
+                  << std::setw(14) << "ctmf MP/s" << "\n";
+
+        for (int radius = 1; radius <= maxRadius; ++radius)
+        {
+            const NppiSize maskSize = {2 * radius + 5, 2 * radius + 5};
+
+            const double huangMs = bestOfMs(repeat, [&]() {
+                engine.median(src, dst, maskSize, anchor, MedianEngine::HUANG);
+            });
+            const double ctmfMs = bestOfMs(repeat, [&]() {
+                engine.median(src, ctmfDst, maskSize, anchor, MedianEngine::CONSTANT_TIME);
+            });
+            if (!sameImage(dst, ctmfDst))
+            {
+                throw std::runtime_error("Huang and constant-time medians differ at radius " + std::to_string(radius));
+            }
+
+            std::cout << std::setw(6) << radius << std::setw(8) << maskSize.width
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(14) << huangMs << std::setw(14) << ctmfMs
+                      << std::setw(14) << megapixels / (ctmfMs / 1000.0) << "\n";
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/* NUMA placement benchmark: filter throughput with the images in memory of
+ * the filtering threads' node against memory of another node.
+ *
+ * Usage: numaBench [--width=N] [--height=N] [--images=N] [--threads=N]
+ *                  [--repeat=N] [--filter=sobel|gaussian]
+ *
+ * For every pair of NUMA nodes (memory, compute), a thread pinned to the
+ * memory node allocates and first touches --images source and destination
+ * RGB images, then --threads threads pinned to the compute node filter
+ * them, each with a single-threaded CPU engine. The diagonal is the
+ * placement imageFilter --numa keeps to; the other cells are what a batch
+ * gets when an image is decoded on one node and filtered on another. The
+ * default thread count is the CPUs of the smallest node. A single-node
+ * host only has the local cell.
+ */
+
+#include "CpuFilterEngine.h"
+#include "NumaTopology.h"
+#include "TaskScheduler.h"
+
+#include <helper_string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Images
+{
+    std::vector<std::unique_ptr<npp::ImageCPU_8u_C3>> src;
+    std::vector<std::unique_ptr<npp::ImageCPU_8u_C3>> dst;
+};
+
+// Allocate and first touch the images on a thread pinned to node
+static void allocateOn(int node, Images &images, int count, int width, int height)
+{
+    std::thread([&]() {
+        pinToNumaNode(node);
+        for (int i = 0; i < count; ++i)
+        {
+            images.src.emplace_back(new npp::ImageCPU_8u_C3(width, height));
+            images.dst.emplace_back(new npp::ImageCPU_8u_C3(width, height));
+            for (int y = 0; y < height; ++y)
+            {
+                Npp8u *row = images.src.back()->data(0, y);
+                for (int x = 0; x < width * 3; ++x)
+                {
+                    row[x] = static_cast<Npp8u>(x * 7 + y * 13 + i);
+                }
+                memset(images.dst.back()->data(0, y), 0, static_cast<size_t>(width) * 3);
+            }
+        }
+    }).join();
+}
+
+// Filter every image once on threads pinned to node; returns the seconds
+static double filterOn(int node, Images &images, int threads, const std::string &filter)
+{
+    const int count = static_cast<int>(images.src.size());
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> team;
+    for (int t = 0; t < threads; ++t)
+    {
+        team.emplace_back([&, t]() {
+            pinToNumaNode(node);
+            const CpuFilterEngine engine(1);
+            ++ready;
+            while (!go)
+            {
+                std::this_thread::yield();
+            }
+            for (int i = t; i < count; i += threads)
+            {
+                if (filter == "gaussian")
+                {
+                    engine.gaussian(*images.src[i], *images.dst[i], 2.0f);
+                }
+                else
+                {
+                    engine.sobelHorizontal(*images.src[i], *images.dst[i]);
+                }
+            }
+        });
+    }
+    while (ready < threads)
+    {
+        std::this_thread::yield();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto &thread : team)
+    {
+        thread.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    const char **args = const_cast<const char **>(argv);
+
+    try
+    {
+        const std::vector<NumaNode> nodes = allowedNumaNodes();
+        size_t smallest = nodes[0].cpus.size();
+        for (const NumaNode &node : nodes)
+        {
+            smallest = std::min(smallest, node.cpus.size());
+        }
+
+        const int width = checkCmdLineFlag(argc, args, "width") ? getCmdLineArgumentInt(argc, args, "width") : 1920;
+        const int height = checkCmdLineFlag(argc, args, "height") ? getCmdLineArgumentInt(argc, args, "height") : 1080;
+        const int threads = checkCmdLineFlag(argc, args, "threads") ? getCmdLineArgumentInt(argc, args, "threads")
+                                                                     : static_cast<int>(smallest);
+        const int images = checkCmdLineFlag(argc, args, "images") ? getCmdLineArgumentInt(argc, args, "images")
+                                                                   : std::max(8, 2 * threads);
+        const int repeat = checkCmdLineFlag(argc, args, "repeat") ? getCmdLineArgumentInt(argc, args, "repeat") : 3;
+        std::string filter = "sobel";
+        char *filterStr = nullptr;
+        if (getCmdLineArgumentString(argc, args, "filter", &filterStr))
+        {
+            filter = filterStr;
+        }
+        if (width <= 0 || height <= 0 || threads <= 0 || images <= 0 || repeat <= 0)
+        {
+            throw std::runtime_error("Sizes and counts must be positive");
+        }
+
+        // the engines run on their own thread; no pool behind them
+        TaskScheduler::instance().configure(1, 0);
+        const double megapixels = images * (width * static_cast<double>(height) / 1.0e6);
+
+        std::cout << "NUMA benchmark: " << nodes.size() << " node(s), " << images << " images of " << width << "x"
+                  << height << " RGB, " << threads << " thread(s), " << filter << ", best of " << repeat << "\n\n";
+        std::cout << std::setw(18) << "memory \\ compute";
+        for (const NumaNode &node : nodes)
+        {
+            std::cout << std::setw(12) << ("node " + std::to_string(node.id));
+        }
+        std::cout << "   (MP/s)\n";
+
+        double localSum = 0.0;
+        double remoteSum = 0.0;
+        int remoteCells = 0;
+        for (const NumaNode &memory : nodes)
+        {
+            Images data;
+            allocateOn(memory.id, data, images, width, height);
+
+            std::cout << std::setw(18) << ("node " + std::to_string(memory.id));
+            for (const NumaNode &compute : nodes)
+            {
+                double best = 0.0;
+                for (int r = 0; r < repeat; ++r)
+                {
+                    const double seconds = filterOn(compute.id, data, threads, filter);
+                    best = r == 0 ? seconds : std::min(best, seconds);
+                }
+                const double rate = megapixels / best;
+                std::cout << std::fixed << std::setprecision(1) << std::setw(12) << rate;
+                if (compute.id == memory.id)
+                {
+                    localSum += rate;
+                }
+                else
+                {
+                    remoteSum += rate;
+                    ++remoteCells;
+                }
+            }
+            std::cout << "\n";
+        }
+
+        const double local = localSum / nodes.size();
+        std::cout << "\nlocal " << local << " MP/s";
+        if (remoteCells > 0)
+        {
+            const double remote = remoteSum / remoteCells;
+            std::cout << ", remote " << remote << " MP/s (local is " << std::setprecision(2) << local / remote
+                      << "x)";
+        }
+        std::cout << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
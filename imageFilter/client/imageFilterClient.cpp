@@ -0,0 +1,114 @@
+/* Client of imageFilter --serve: sends one job and waits for its result.
+ *
+ * Usage: imageFilterClient --socket=<path> --input=<file> [imageFilter options]
+ *        imageFilterClient --socket=<path> --shutdown
+ *
+ * The options are those of a single-image imageFilter run (--filter,
+ * --pipeline, --output, ...); relative --input, --output and --output-dir
+ * paths are made absolute before they are sent, since the server resolves
+ * them in its own directory. Prints the server's answer and exits with 0
+ * if the job succeeded.
+ */
+
+#include "JobProtocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <helper_multiprocess.h>
+
+static std::string absolutePath(const std::string &path)
+{
+    if (path.empty() || path[0] == '/')
+    {
+        return path;
+    }
+    std::vector<char> cwd(4096);
+    if (!getcwd(cwd.data(), cwd.size()))
+    {
+        return path;
+    }
+    return std::string(cwd.data()) + "/" + path;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *const pathOptions[] = {"--input=", "--output=", "--output-dir="};
+
+    std::string socketName;
+    std::vector<std::string> job;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--socket=") == 0)
+        {
+            socketName = arg.substr(9);
+            continue;
+        }
+        if (arg == "--shutdown")
+        {
+            job.assign(1, kShutdownJob);
+            break;
+        }
+        for (const char *option : pathOptions)
+        {
+            const size_t length = strlen(option);
+            if (arg.compare(0, length, option) == 0)
+            {
+                arg = option + absolutePath(arg.substr(length));
+            }
+        }
+        job.push_back(arg);
+    }
+    if (socketName.empty() || job.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " --socket=<path> --input=<file> [imageFilter options]\n"
+                  << "       " << argv[0] << " --socket=<path> --shutdown" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string message = encodeJob(job);
+    if (message.size() > kMaxJobMessage)
+    {
+        std::cerr << "Job larger than " << kMaxJobMessage << " bytes" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#if defined(__linux__)
+    // the server answers to the socket the job came from
+    ipcHandle *handle = nullptr;
+    const std::string clientName = absolutePath(socketName) + "." + std::to_string(getpid());
+    if (ipcCreateSocket(handle, clientName.c_str(), std::vector<Process>()) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    if (ipcSendDataTo(handle, socketName.c_str(), message.data(), message.size()) != 0)
+    {
+        std::cerr << "Cannot reach a server on " << socketName << ": " << strerror(errno) << std::endl;
+        ipcCloseSocket(handle);
+        return EXIT_FAILURE;
+    }
+
+    char reply[4096];
+    const int size = ipcRecvDataFrom(handle, reply, sizeof(reply) - 1, nullptr, 0);
+    ipcCloseSocket(handle);
+    if (size < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    reply[std::min<size_t>(size, sizeof(reply) - 1)] = '\0';
+
+    const bool ok = strncmp(reply, "ok", 2) == 0;
+    (ok ? std::cout : std::cerr) << reply << std::endl;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+    // the datagram helpers of helper_multiprocess are Linux-only
+    std::cerr << "imageFilterClient needs Unix datagram sockets, which are only supported on Linux" << std::endl;
+    return EXIT_FAILURE;
+#endif
+}